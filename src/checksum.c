@@ -0,0 +1,163 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "logging.h"
+#include "checksum.h"
+
+#if defined(__x86_64__)
+#include <nmmintrin.h>
+#endif
+
+#define CRC32C_POLYNOMIAL 0x82f63b78
+
+static const char* CHECKSUM_PREFIX = "crc32c: ";
+static const char* CHECKSUM_MARKER = "---\ncrc32c: ";
+
+static uint32_t table[8][256];
+static pthread_once_t table_once = PTHREAD_ONCE_INIT;
+
+static void init_table() {
+  for(int i=0; i<256; i++) {
+    uint32_t crc = i;
+    for(int j=0; j<8; j++) {
+      crc = crc & 1 ? (crc >> 1) ^ CRC32C_POLYNOMIAL : crc >> 1;
+    }
+    table[0][i] = crc;
+  }
+  for(int i=0; i<256; i++) {
+    for(int j=1; j<8; j++) {
+      table[j][i] = (table[j-1][i] >> 8) ^ table[0][table[j-1][i] & 0xff];
+    }
+  }
+}
+
+// Slicing by eight, eight table lookups per eight bytes.
+static uint32_t crc32c_table(uint32_t crc, const unsigned char* data, size_t size) {
+
+  while(size >= 8) {
+    uint64_t word;
+    memcpy(&word, data, 8);
+    word ^= crc;
+    crc = table[7][word & 0xff] ^ table[6][(word >> 8) & 0xff]
+      ^ table[5][(word >> 16) & 0xff] ^ table[4][(word >> 24) & 0xff]
+      ^ table[3][(word >> 32) & 0xff] ^ table[2][(word >> 40) & 0xff]
+      ^ table[1][(word >> 48) & 0xff] ^ table[0][word >> 56];
+    data += 8;
+    size -= 8;
+  }
+  while(size-- > 0) {
+    crc = (crc >> 8) ^ table[0][(crc ^ *data++) & 0xff];
+  }
+  return crc;
+}
+
+#if defined(__x86_64__)
+__attribute__((target("sse4.2")))
+static uint32_t crc32c_sse42(uint32_t crc, const unsigned char* data, size_t size) {
+  uint64_t value = crc;
+  while(size >= 8) {
+    uint64_t word;
+    memcpy(&word, data, 8);
+    value = _mm_crc32_u64(value, word);
+    data += 8;
+    size -= 8;
+  }
+  crc = value;
+  while(size-- > 0) {
+    crc = _mm_crc32_u8(crc, *data++);
+  }
+  return crc;
+}
+#endif
+
+// Same as crc32c without the crc32 instruction.
+uint32_t crc32c_portable(uint32_t crc, const char* data, size_t size) {
+  pthread_once(&table_once, init_table);
+  return ~crc32c_table(~crc, (const unsigned char*)data, size);
+}
+
+// CRC32C of the data, continuing from a previous crc or starting from zero.
+uint32_t crc32c(uint32_t crc, const char* data, size_t size) {
+#if defined(__x86_64__)
+  if(__builtin_cpu_supports("sse4.2")) {
+    return ~crc32c_sse42(~crc, (const unsigned char*)data, size);
+  }
+#endif
+  return crc32c_portable(crc, data, size);
+}
+
+// Ends the output of a memstream with a document holding the crc of all of
+// it. Empty output is left empty.
+void print_checksum(FILE* file, char** data, size_t* size) {
+  fflush(file);
+  if(*size == 0) {
+    return;
+  }
+  fprintf(file, "%s%08x\n---\n", CHECKSUM_PREFIX, crc32c(0, *data, *size));
+}
+
+// Checks every checksummed batch of an output file, each covers the bytes
+// since the end of the previous one. Trailing bytes without a checksum, like
+// a batch still being written, are only reported.
+// Output headers written each time a sink starts are not part of any batch.
+static size_t skip_headers(char* data, size_t size, size_t start) {
+  while(start + 4 <= size && memcmp(data + start, "---\n", 4) == 0) {
+    start += 4;
+  }
+  return start;
+}
+
+int verify_checksums(char* path) {
+  int fd = open(path, O_RDONLY);
+  struct stat status;
+  if(fd < 0 || fstat(fd, &status) < 0) {
+    ERROR("failed to open %s", path);
+    return 1;
+  }
+
+  size_t size = status.st_size;
+  char* data = size > 0 ? mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0) : NULL;
+  close(fd);
+  if(data == MAP_FAILED) {
+    ERROR("failed to map %s", path);
+    return 1;
+  }
+  if(size > 0) {
+    madvise(data, size, MADV_SEQUENTIAL);
+  }
+
+  size_t marker = strlen(CHECKSUM_MARKER);
+  size_t start = skip_headers(data, size, 0);
+  long batches = 0, failures = 0;
+  while(start < size) {
+    char* found = memmem(data + start, size - start, CHECKSUM_MARKER, marker);
+    if(found == NULL || (size_t)(found - data) + marker + 8 + 5 > size) {
+      break;
+    }
+
+    size_t end = found - data + 4;
+    char hex[9];
+    memcpy(hex, found + marker, 8);
+    hex[8] = '\0';
+    uint32_t expected = strtoul(hex, NULL, 16);
+    uint32_t actual = crc32c(0, data + start, end - start);
+    if(actual != expected) {
+      fprintf(stdout, "%s: checksum mismatch in bytes %zu-%zu: expected %08x, found %08x\n", path, start, end, expected, actual);
+      failures++;
+    }
+    batches++;
+    start = skip_headers(data, size, end + strlen(CHECKSUM_PREFIX) + 8 + 5);
+  }
+
+  fprintf(stdout, "%s: %ld batches verified, %ld failed, %zu trailing bytes unchecked\n", path, batches, failures, size - start);
+  if(size > 0) {
+    munmap(data, size);
+  }
+  return failures > 0 ? 1 : 0;
+}
@@ -0,0 +1,10 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+
+uint32_t crc32c(uint32_t crc, const char* data, size_t size);
+uint32_t crc32c_portable(uint32_t crc, const char* data, size_t size);
+void print_checksum(FILE* file, char** data, size_t* size);
+int verify_checksums(char* path);
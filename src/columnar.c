@@ -0,0 +1,524 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "logging.h"
+#include "columnar.h"
+
+const int64_t BATCH_INITIAL_ROWS = 1024;
+const int SYSTEM_COLUMNS = 2;
+
+// Flatbuffer with the metadata of an Arrow IPC message, written front to
+// back: every table, vector and string is placed after the offset that
+// points to it, and each vtable right before its table.
+typedef struct {
+  char* data;
+  size_t size;
+  size_t capacity;
+} builder_t;
+
+static size_t reserve(builder_t* builder, size_t size, size_t align, size_t shift) {
+  size_t position = builder->size;
+  while((position + shift) % align != 0) {
+    position++;
+  }
+
+  if(position + size > builder->capacity) {
+    builder->capacity = (position + size) * 2;
+    builder->data = realloc(builder->data, builder->capacity);
+  }
+  memset(builder->data + builder->size, 0, position + size - builder->size);
+  builder->size = position + size;
+  return position;
+}
+
+static void put16(builder_t* builder, size_t position, uint16_t value) {
+  memcpy(builder->data + position, &value, sizeof(value));
+}
+
+static void put32(builder_t* builder, size_t position, uint32_t value) {
+  memcpy(builder->data + position, &value, sizeof(value));
+}
+
+static void put64(builder_t* builder, size_t position, int64_t value) {
+  memcpy(builder->data + position, &value, sizeof(value));
+}
+
+static void put_offset(builder_t* builder, size_t position, size_t target) {
+  put32(builder, position, target - position);
+}
+
+// Adds a table with fields of the given sizes, 0 for absent fields, and
+// returns the position of each field.
+static size_t add_table(builder_t* builder, int number_fields, const int* sizes, size_t* fields) {
+  uint16_t offsets[8];
+  size_t size = 4;
+  for(int i=0; i<number_fields; i++) {
+    offsets[i] = 0;
+    if(sizes[i] > 0) {
+      size = (size + sizes[i] - 1) / sizes[i] * sizes[i];
+      offsets[i] = size;
+      size += sizes[i];
+    }
+  }
+
+  size_t vtable = reserve(builder, 4 + 2*number_fields, 2, 0);
+  size_t table = reserve(builder, size, 8, 0);
+  put16(builder, vtable, 4 + 2*number_fields);
+  put16(builder, vtable + 2, size);
+  for(int i=0; i<number_fields; i++) {
+    put16(builder, vtable + 4 + 2*i, offsets[i]);
+    fields[i] = table + offsets[i];
+  }
+  put32(builder, table, table - vtable);
+  return table;
+}
+
+static size_t add_vector(builder_t* builder, size_t length, size_t element_size) {
+  size_t position = reserve(builder, 4 + length*element_size, element_size >= 8 ? 8 : 4, 4);
+  put32(builder, position, length);
+  return position;
+}
+
+static size_t add_string(builder_t* builder, char* value) {
+  size_t length = strlen(value);
+  size_t position = reserve(builder, 4 + length + 1, 4, 0);
+  put32(builder, position, length);
+  memcpy(builder->data + position + 4, value, length);
+  return position;
+}
+
+// Message { version: V5, header, bodyLength }, returns the position of the
+// offset to the header table.
+static size_t add_message(builder_t* builder, uint8_t header_type, int64_t body_length) {
+  const int sizes[] = { 2, 1, 4, 8 };
+  size_t fields[4];
+  size_t root = reserve(builder, 4, 4, 0);
+  put_offset(builder, root, add_table(builder, 4, sizes, fields));
+  put16(builder, fields[0], 4);
+  builder->data[fields[1]] = header_type;
+  put64(builder, fields[3], body_length);
+  return fields[2];
+}
+
+static void print_message(builder_t* builder, char* body, size_t body_size, FILE* file) {
+  uint32_t prefix[2] = { 0xFFFFFFFF, (builder->size + 7) / 8 * 8 };
+  char padding[8] = { 0 };
+  fwrite(prefix, sizeof(prefix), 1, file);
+  fwrite(builder->data, builder->size, 1, file);
+  fwrite(padding, prefix[1] - builder->size, 1, file);
+  if(body_size > 0) {
+    fwrite(body, body_size, 1, file);
+  }
+  free(builder->data);
+}
+
+arrow_type_t arrow_type(int32_t oid) {
+  switch(oid) {
+    case 16: return ARROW_BOOL;
+    case 20: return ARROW_INT64;
+    case 21: return ARROW_INT16;
+    case 23: return ARROW_INT32;
+    case 700: return ARROW_FLOAT32;
+    case 701: return ARROW_FLOAT64;
+    default: return ARROW_UTF8;
+  }
+}
+
+static size_t type_width(arrow_type_t type) {
+  switch(type) {
+    case ARROW_INT16: return 2;
+    case ARROW_INT32: return 4;
+    case ARROW_FLOAT32: return 4;
+    case ARROW_INT64: return 8;
+    case ARROW_FLOAT64: return 8;
+    default: return 0;
+  }
+}
+
+// Type union of a field: Int = 2, FloatingPoint = 3, Utf8 = 5, Bool = 6.
+static uint8_t add_type(builder_t* builder, size_t slot, arrow_type_t type) {
+  const int int_sizes[] = { 4, 1 };
+  const int float_sizes[] = { 2 };
+  size_t fields[2];
+  switch(type) {
+    case ARROW_INT16:
+    case ARROW_INT32:
+    case ARROW_INT64:
+      put_offset(builder, slot, add_table(builder, 2, int_sizes, fields));
+      put32(builder, fields[0], type_width(type) * 8);
+      builder->data[fields[1]] = 1;
+      return 2;
+    case ARROW_FLOAT32:
+    case ARROW_FLOAT64:
+      put_offset(builder, slot, add_table(builder, 1, float_sizes, fields));
+      put16(builder, fields[0], type == ARROW_FLOAT32 ? 1 : 2);
+      return 3;
+    case ARROW_BOOL:
+      put_offset(builder, slot, add_table(builder, 0, NULL, fields));
+      return 6;
+    default:
+      put_offset(builder, slot, add_table(builder, 0, NULL, fields));
+      return 5;
+  }
+}
+
+// Schema { fields: [Field { name, nullable, type, children }] }
+void print_arrow_schema(batch_t* batch, FILE* file) {
+  const int schema_sizes[] = { 0, 4 };
+  const int field_sizes[] = { 4, 1, 1, 4, 0, 4 };
+  size_t schema_fields[2];
+  size_t fields[6];
+  builder_t builder = { 0 };
+
+  size_t header = add_message(&builder, 1, 0);
+  put_offset(&builder, header, add_table(&builder, 2, schema_sizes, schema_fields));
+  size_t vector = add_vector(&builder, batch->number_columns, 4);
+  put_offset(&builder, schema_fields[1], vector);
+  for(int i=0; i<batch->number_columns; i++) {
+    column_t* column = &batch->columns[i];
+    put_offset(&builder, vector + 4 + 4*i, add_table(&builder, 6, field_sizes, fields));
+    put_offset(&builder, fields[0], add_string(&builder, column->name));
+    builder.data[fields[1]] = 1;
+    builder.data[fields[2]] = add_type(&builder, fields[3], column->type);
+    put_offset(&builder, fields[5], add_vector(&builder, 0, 4));
+  }
+  print_message(&builder, NULL, 0, file);
+}
+
+typedef struct {
+  void* data;
+  int64_t offset;
+  int64_t length;
+} body_buffer_t;
+
+static int64_t add_buffer(body_buffer_t* buffer, void* data, int64_t length, int64_t offset) {
+  buffer->data = data;
+  buffer->offset = offset;
+  buffer->length = length;
+  return offset + (length + 7) / 8 * 8;
+}
+
+// RecordBatch { length, nodes: [FieldNode], buffers: [Buffer] } followed by
+// the validity, offsets and values of each column, padded to 8 bytes.
+void print_arrow_batch(batch_t* batch, FILE* file) {
+  const int batch_sizes[] = { 8, 4, 4 };
+  size_t batch_fields[3];
+  int64_t bitmap_size = (batch->rows + 7) / 8;
+  body_buffer_t* buffers = malloc(sizeof(body_buffer_t) * 3 * batch->number_columns);
+  int number_buffers = 0;
+  int64_t body_size = 0;
+  for(int i=0; i<batch->number_columns; i++) {
+    column_t* column = &batch->columns[i];
+    body_size = add_buffer(&buffers[number_buffers++], column->validity, bitmap_size, body_size);
+    if(column->type == ARROW_UTF8) {
+      body_size = add_buffer(&buffers[number_buffers++], column->offsets, 4 * (batch->rows + 1), body_size);
+      body_size = add_buffer(&buffers[number_buffers++], column->values, column->values_size, body_size);
+    } else if(column->type == ARROW_BOOL) {
+      body_size = add_buffer(&buffers[number_buffers++], column->values, bitmap_size, body_size);
+    } else {
+      body_size = add_buffer(&buffers[number_buffers++], column->values, batch->rows * type_width(column->type), body_size);
+    }
+  }
+
+  builder_t builder = { 0 };
+  size_t header = add_message(&builder, 3, body_size);
+  put_offset(&builder, header, add_table(&builder, 3, batch_sizes, batch_fields));
+  put64(&builder, batch_fields[0], batch->rows);
+  size_t nodes = add_vector(&builder, batch->number_columns, 16);
+  put_offset(&builder, batch_fields[1], nodes);
+  for(int i=0; i<batch->number_columns; i++) {
+    put64(&builder, nodes + 4 + 16*i, batch->rows);
+    put64(&builder, nodes + 4 + 16*i + 8, batch->columns[i].null_count);
+  }
+  size_t vector = add_vector(&builder, number_buffers, 16);
+  put_offset(&builder, batch_fields[2], vector);
+  for(int i=0; i<number_buffers; i++) {
+    put64(&builder, vector + 4 + 16*i, buffers[i].offset);
+    put64(&builder, vector + 4 + 16*i + 8, buffers[i].length);
+  }
+
+  char* body = calloc(1, body_size > 0 ? body_size : 1);
+  for(int i=0; i<number_buffers; i++) {
+    if(buffers[i].length > 0) {
+      memcpy(body + buffers[i].offset, buffers[i].data, buffers[i].length);
+    }
+  }
+  print_message(&builder, body, body_size, file);
+  free(body);
+  free(buffers);
+}
+
+void print_arrow_end(FILE* file) {
+  uint32_t end[2] = { 0xFFFFFFFF, 0 };
+  fwrite(end, sizeof(end), 1, file);
+}
+
+static void init_column(column_t* column, char* name, arrow_type_t type) {
+  memset(column, 0, sizeof(column_t));
+  column->name = strdup(name);
+  column->type = type;
+}
+
+static void grow_column(column_t* column, int64_t rows, int64_t capacity) {
+  size_t bitmap_size = (capacity + 7) / 8;
+  size_t old_size = (rows + 7) / 8;
+  column->validity = realloc(column->validity, bitmap_size);
+  memset(column->validity + old_size, 0, bitmap_size - old_size);
+  if(column->type == ARROW_UTF8) {
+    column->offsets = realloc(column->offsets, sizeof(int32_t) * (capacity + 1));
+    column->offsets[0] = rows == 0 ? 0 : column->offsets[0];
+  } else if(column->type == ARROW_BOOL) {
+    column->values = realloc(column->values, bitmap_size);
+    memset(column->values + old_size, 0, bitmap_size - old_size);
+    column->values_capacity = bitmap_size;
+  } else {
+    column->values_capacity = capacity * type_width(column->type);
+    column->values = realloc(column->values, column->values_capacity);
+  }
+}
+
+static void reset_column(column_t* column, int64_t capacity) {
+  size_t bitmap_size = (capacity + 7) / 8;
+  memset(column->validity, 0, bitmap_size);
+  if(column->type == ARROW_BOOL) {
+    memset(column->values, 0, bitmap_size);
+  }
+  if(column->type == ARROW_UTF8) {
+    column->offsets[0] = 0;
+  }
+  column->values_size = 0;
+  column->null_count = 0;
+}
+
+static void delete_column(column_t* column) {
+  free(column->name);
+  free(column->validity);
+  free(column->values);
+  free(column->offsets);
+}
+
+static bool parse_number(column_t* column, char* value, void* number) {
+  char* end;
+  int16_t int16;
+  int32_t int32;
+  int64_t int64;
+  float float32;
+  double float64;
+  switch(column->type) {
+    case ARROW_INT16: int16 = int64 = strtoll(value, &end, 10); memcpy(number, &int16, 2); break;
+    case ARROW_INT32: int32 = int64 = strtoll(value, &end, 10); memcpy(number, &int32, 4); break;
+    case ARROW_INT64: int64 = strtoll(value, &end, 10); memcpy(number, &int64, 8); break;
+    case ARROW_FLOAT32: float32 = strtof(value, &end); memcpy(number, &float32, 4); break;
+    case ARROW_FLOAT64: float64 = strtod(value, &end); memcpy(number, &float64, 8); break;
+    default: return false;
+  }
+  return end != value && *end == '\0';
+}
+
+// Appends a value in text format, NULL and unchanged toasted values are
+// appended as nulls.
+static void append_value(column_t* column, int64_t row, char* value) {
+  bool valid = !is_static_tuple(value);
+  size_t width = type_width(column->type);
+  if(column->type == ARROW_UTF8) {
+    size_t length = valid ? strlen(value) : 0;
+    if(column->values_size + length > column->values_capacity) {
+      column->values_capacity = (column->values_size + length) * 2;
+      column->values = realloc(column->values, column->values_capacity);
+    }
+    memcpy(column->values + column->values_size, value, length);
+    column->values_size += length;
+    column->offsets[row + 1] = column->values_size;
+  } else if(column->type == ARROW_BOOL) {
+    if(valid && value[0] == 't') {
+      column->values[row / 8] |= 1 << (row % 8);
+    }
+  } else {
+    char number[8] = { 0 };
+    valid = valid && parse_number(column, value, number);
+    memcpy(column->values + row * width, number, width);
+  }
+
+  if(valid) {
+    column->validity[row / 8] |= 1 << (row % 8);
+  } else {
+    column->null_count++;
+  }
+}
+
+static bool same_schema(batch_t* batch, relation_t* relation) {
+  if(batch->number_columns != relation->number_columns + SYSTEM_COLUMNS) {
+    return false;
+  }
+
+  for(int i=0; i<relation->number_columns; i++) {
+    if(batch->types[i] != relation->column_types[i]
+        || strcmp(batch->columns[i + SYSTEM_COLUMNS].name, relation->columns[i]) != 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static batch_t* create_batch(relation_t* relation, FILE* file) {
+  batch_t* batch = calloc(1, sizeof(batch_t));
+  batch->relation_id = relation->id;
+  batch->file = file;
+  batch->number_columns = relation->number_columns + SYSTEM_COLUMNS;
+  batch->columns = malloc(sizeof(column_t) * batch->number_columns);
+  batch->types = malloc(sizeof(int32_t) * relation->number_columns);
+  init_column(&batch->columns[0], "_lsn", ARROW_INT64);
+  init_column(&batch->columns[1], "_operation", ARROW_UTF8);
+  for(int i=0; i<relation->number_columns; i++) {
+    batch->types[i] = relation->column_types[i];
+    init_column(&batch->columns[i + SYSTEM_COLUMNS], relation->columns[i], arrow_type(relation->column_types[i]));
+  }
+
+  batch->capacity = BATCH_INITIAL_ROWS;
+  for(int i=0; i<batch->number_columns; i++) {
+    grow_column(&batch->columns[i], 0, batch->capacity);
+  }
+  return batch;
+}
+
+static void flush_batch(batch_t* batch) {
+  if(batch->rows == 0) {
+    return;
+  }
+
+  print_arrow_batch(batch, batch->file);
+  if(fflush(batch->file) != 0 || fsync(fileno(batch->file)) != 0) {
+    ERROR("failed to sync arrow batch of relation %ld", batch->relation_id);
+  }
+  for(int i=0; i<batch->number_columns; i++) {
+    reset_column(&batch->columns[i], batch->capacity);
+  }
+  batch->rows = 0;
+}
+
+static void delete_batch(batch_t* batch) {
+  flush_batch(batch);
+  print_arrow_end(batch->file);
+  fclose(batch->file);
+  for(int i=0; i<batch->number_columns; i++) {
+    delete_column(&batch->columns[i]);
+  }
+  free(batch->columns);
+  free(batch->types);
+  free(batch);
+}
+
+columnar_t* create_columnar(char* dir, long batch_rows, int batch_ms) {
+  columnar_t* columnar = calloc(1, sizeof(columnar_t));
+  columnar->dir = dir;
+  columnar->batch_rows = batch_rows;
+  columnar->batch_ms = batch_ms;
+  return columnar;
+}
+
+void delete_columnar(columnar_t* columnar) {
+  batch_t* batch = columnar->head;
+  while(batch != NULL) {
+    batch_t* next = batch->next;
+    delete_batch(batch);
+    batch = next;
+  }
+  free(columnar);
+}
+
+static batch_t** find_batch(columnar_t* columnar, int64_t relation_id) {
+  batch_t** slot = &columnar->head;
+  for(; *slot != NULL; slot = &(*slot)->next) {
+    if((*slot)->relation_id == relation_id) {
+      return slot;
+    }
+  }
+  return slot;
+}
+
+// Each relation gets a new stream when it is first seen or its columns
+// change, in a file named after the relation and the lsn of the change.
+int columnar_relation(columnar_t* columnar, relation_t* relation, int64_t lsn) {
+  batch_t** slot = find_batch(columnar, relation->id);
+  if(*slot != NULL && same_schema(*slot, relation)) {
+    return OK;
+  }
+
+  if(*slot != NULL) {
+    batch_t* batch = *slot;
+    *slot = batch->next;
+    delete_batch(batch);
+  }
+
+  char path[4096];
+  snprintf(path, sizeof(path), "%s/%s.%s.%016lX.arrows", columnar->dir, relation->namespace, relation->name, lsn);
+  FILE* file = fopen(path, "w");
+  if(file == NULL) {
+    ERROR("failed to open %s", path);
+    return FAILED;
+  }
+
+  batch_t* batch = create_batch(relation, file);
+  print_arrow_schema(batch, file);
+  batch->next = columnar->head;
+  columnar->head = batch;
+  return OK;
+}
+
+void columnar_append(columnar_t* columnar, relation_t* relation, char operation, int64_t lsn, tuples_t* tuples) {
+  batch_t* batch = relation != NULL ? *find_batch(columnar, relation->id) : NULL;
+  if(batch == NULL) {
+    return;
+  }
+
+  if(batch->rows == batch->capacity) {
+    for(int i=0; i<batch->number_columns; i++) {
+      grow_column(&batch->columns[i], batch->rows, batch->capacity * 2);
+    }
+    batch->capacity *= 2;
+  }
+
+  if(batch->rows == 0) {
+    clock_gettime(CLOCK_MONOTONIC, &batch->started);
+    batch->first_lsn = lsn;
+  }
+
+  int64_t row = batch->rows++;
+  char lsn_text[24];
+  sprintf(lsn_text, "%ld", lsn);
+  append_value(&batch->columns[0], row, lsn_text);
+  append_value(&batch->columns[1], row, operation == 'I' ? "insert" : operation == 'U' ? "update" : "delete");
+  for(int i=SYSTEM_COLUMNS; i<batch->number_columns; i++) {
+    int index = i - SYSTEM_COLUMNS;
+    append_value(&batch->columns[i], row, index < tuples->size ? tuples->values[index] : (char*)NULL_STR);
+  }
+
+  if(batch->rows >= columnar->batch_rows) {
+    flush_batch(batch);
+  }
+}
+
+// Writes the batches that are older than the batch delay, at a commit so
+// that a record batch never ends inside a transaction unless it is full.
+void columnar_commit(columnar_t* columnar) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  for(batch_t* batch = columnar->head; batch != NULL; batch = batch->next) {
+    long elapsed = (now.tv_sec - batch->started.tv_sec) * 1000 + (now.tv_nsec - batch->started.tv_nsec) / 1000000;
+    if(batch->rows > 0 && elapsed >= columnar->batch_ms) {
+      flush_batch(batch);
+    }
+  }
+}
+
+// Lowest commit lsn of the rows not yet written, or 0 when every batch is
+// empty. Positions from it on must not be confirmed.
+int64_t columnar_buffered_lsn(columnar_t* columnar) {
+  int64_t lsn = 0;
+  for(batch_t* batch = columnar->head; batch != NULL; batch = batch->next) {
+    if(batch->rows > 0 && (lsn == 0 || batch->first_lsn < lsn)) {
+      lsn = batch->first_lsn;
+    }
+  }
+  return lsn;
+}
@@ -0,0 +1,65 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include "decoder.h"
+
+typedef enum {
+  ARROW_UTF8,
+  ARROW_BOOL,
+  ARROW_INT16,
+  ARROW_INT32,
+  ARROW_INT64,
+  ARROW_FLOAT32,
+  ARROW_FLOAT64
+} arrow_type_t;
+
+// Values of one column in Arrow layout: a validity bitmap, fixed width
+// values or a bitmap for booleans, and offsets into the values for text.
+typedef struct {
+  char* name;
+  arrow_type_t type;
+  uint8_t* validity;
+  char* values;
+  size_t values_size;
+  size_t values_capacity;
+  int32_t* offsets;
+  int64_t null_count;
+} column_t;
+
+// Rows of one relation since the last record batch, written as an Arrow IPC
+// stream to a file of its own. The first two columns are the commit lsn and
+// the operation of each row.
+typedef struct batch_s {
+  int64_t relation_id;
+  FILE* file;
+  int number_columns;
+  column_t* columns;
+  int32_t* types;
+  int64_t rows;
+  int64_t capacity;
+  int64_t first_lsn;
+  struct timespec started;
+  struct batch_s* next;
+} batch_t;
+
+typedef struct {
+  char* dir;
+  long batch_rows;
+  int batch_ms;
+  batch_t* head;
+} columnar_t;
+
+columnar_t* create_columnar(char* dir, long batch_rows, int batch_ms);
+void delete_columnar(columnar_t* columnar);
+int columnar_relation(columnar_t* columnar, relation_t* relation, int64_t lsn);
+void columnar_append(columnar_t* columnar, relation_t* relation, char operation, int64_t lsn, tuples_t* tuples);
+void columnar_commit(columnar_t* columnar);
+int64_t columnar_buffered_lsn(columnar_t* columnar);
+
+arrow_type_t arrow_type(int32_t oid);
+void print_arrow_schema(batch_t* batch, FILE* file);
+void print_arrow_batch(batch_t* batch, FILE* file);
+void print_arrow_end(FILE* file);
@@ -0,0 +1,298 @@
+#include "logging.h"
+#include "compact.h"
+
+compactor_t* create_compactor(int window_ms, int64_t window_lsn) {
+  compactor_t* compactor = calloc(1, sizeof(compactor_t));
+  compactor->number_buckets = 1024;
+  compactor->buckets = calloc(compactor->number_buckets, sizeof(change_t*));
+  compactor->window_ms = window_ms;
+  compactor->window_lsn = window_lsn;
+  return compactor;
+}
+
+static void delete_change(change_t* change) {
+  if(change->from != NULL) {
+    delete_tuples(change->from);
+  }
+  if(change->to != NULL) {
+    delete_tuples(change->to);
+  }
+  free(change->key);
+  free(change);
+}
+
+static void clear(compactor_t* compactor) {
+  change_t* change = compactor->head;
+  while(change != NULL) {
+    change_t* next = change->next;
+    delete_change(change);
+    change = next;
+  }
+  memset(compactor->buckets, 0, compactor->number_buckets * sizeof(change_t*));
+  compactor->head = NULL;
+  compactor->tail = NULL;
+  compactor->size = 0;
+  compactor->first_lsn = 0;
+}
+
+void delete_compactor(compactor_t* compactor) {
+  clear(compactor);
+  free(compactor->buckets);
+  free(compactor);
+}
+
+static change_t** find_slot(compactor_t* compactor, int32_t relation_id, uint64_t hash, char* key, size_t key_size) {
+  change_t** slot = &compactor->buckets[hash % compactor->number_buckets];
+  for(; *slot != NULL; slot = &(*slot)->bucket_next) {
+    change_t* change = *slot;
+    if(change->hash == hash && change->relation_id == relation_id
+        && change->key_size == key_size && memcmp(change->key, key, key_size) == 0) {
+      return slot;
+    }
+  }
+  return slot;
+}
+
+static void resize(compactor_t* compactor) {
+  size_t number_buckets = compactor->number_buckets * 2;
+  change_t** buckets = calloc(number_buckets, sizeof(change_t*));
+  for(change_t* change = compactor->head; change != NULL; change = change->next) {
+    if(change->key != NULL) {
+      change_t** bucket = &buckets[change->hash % number_buckets];
+      change->bucket_next = *bucket;
+      *bucket = change;
+    }
+  }
+  free(compactor->buckets);
+  compactor->buckets = buckets;
+  compactor->number_buckets = number_buckets;
+}
+
+static void append(compactor_t* compactor, change_t* change) {
+  if(compactor->head == NULL) {
+    clock_gettime(CLOCK_MONOTONIC, &compactor->opened);
+  }
+
+  change->next = NULL;
+  change->prev = compactor->tail;
+  if(compactor->tail != NULL) {
+    compactor->tail->next = change;
+  } else {
+    compactor->head = change;
+  }
+  compactor->tail = change;
+  compactor->size++;
+
+  if(change->key != NULL) {
+    if(compactor->size > compactor->number_buckets * 2) {
+      resize(compactor);
+    }
+    change_t** bucket = &compactor->buckets[change->hash % compactor->number_buckets];
+    change->bucket_next = *bucket;
+    *bucket = change;
+  }
+}
+
+static change_t* take(compactor_t* compactor, int32_t relation_id, char* key, size_t key_size) {
+  uint64_t hash = hash_relation_key(relation_id, key, key_size);
+  change_t** slot = find_slot(compactor, relation_id, hash, key, key_size);
+  change_t* change = *slot;
+  if(change == NULL) {
+    return NULL;
+  }
+
+  *slot = change->bucket_next;
+  if(change->prev != NULL) {
+    change->prev->next = change->next;
+  } else {
+    compactor->head = change->next;
+  }
+  if(change->next != NULL) {
+    change->next->prev = change->prev;
+  } else {
+    compactor->tail = change->prev;
+  }
+  compactor->size--;
+
+  free(change->key);
+  change->key = NULL;
+  return change;
+}
+
+static void replace(tuples_t** target, tuples_t* value) {
+  if(*target != NULL) {
+    delete_tuples(*target);
+  }
+  *target = value;
+}
+
+// Moves values of the pending image into the columns the new image left as
+// unchanged toast, which only mark that the update did not touch them.
+static void keep_unchanged(tuples_t* previous, tuples_t* next) {
+  if(previous == NULL || next == NULL || previous->size != next->size) {
+    return;
+  }
+
+  for(int i=0; i<next->size; i++) {
+    if(next->values[i] == UNCHANGED_STR) {
+      next->values[i] = previous->values[i];
+      previous->values[i] = (char*)UNCHANGED_STR;
+    }
+  }
+}
+
+// Folds a new change of a row into the pending one. Returns NULL when the
+// changes cancel each other.
+static change_t* merge(change_t* change, char operation, tuples_t* from, tuples_t* to) {
+  switch(operation) {
+    case 'I':
+      if(change->operation == 'D') {
+        change->operation = 'U';
+      } else {
+        change->operation = 'I';
+        replace(&change->from, NULL);
+      }
+      keep_unchanged(change->to, to);
+      replace(&change->to, to);
+      break;
+    case 'U':
+      if(change->operation == 'D') {
+        change->operation = 'U';
+      }
+      if(change->operation == 'U' && change->from == NULL) {
+        change->from = from;
+        from = NULL;
+      }
+      keep_unchanged(change->to, to);
+      replace(&change->to, to);
+      break;
+    case 'D':
+      if(change->operation == 'I') {
+        delete_change(change);
+        change = NULL;
+        break;
+      }
+      if(change->from == NULL || change->operation == 'D') {
+        replace(&change->from, from);
+        from = NULL;
+      }
+      change->operation = 'D';
+      replace(&change->to, NULL);
+      break;
+  }
+
+  if(from != NULL) {
+    delete_tuples(from);
+  }
+  return change;
+}
+
+static void add(compactor_t* compactor, relation_t* relation, char operation, int32_t relation_id, tuples_t* from, tuples_t* to) {
+  size_t key_size = 0;
+  char* key = NULL;
+  if(relation != NULL) {
+    key = relation_key(relation, from != NULL ? from : to, &key_size);
+  }
+
+  change_t* change = NULL;
+  if(key != NULL) {
+    change = take(compactor, relation_id, key, key_size);
+  }
+
+  if(change != NULL) {
+    change = merge(change, operation, from, to);
+  } else {
+    change = calloc(1, sizeof(change_t));
+    change->operation = operation;
+    change->relation_id = relation_id;
+    change->from = from;
+    change->to = to;
+  }
+
+  if(change == NULL) {
+    free(key);
+    return;
+  }
+
+  if(key != NULL && change->operation != 'D') {
+    free(key);
+    key = relation_key(relation, change->to, &key_size);
+  }
+
+  change->key = key;
+  change->key_size = key_size;
+  if(key != NULL) {
+    change->hash = hash_relation_key(relation_id, key, key_size);
+  }
+  append(compactor, change);
+}
+
+void compact_insert(compactor_t* compactor, relation_t* relation, insert_t* insert) {
+  add(compactor, relation, 'I', insert->relation_id, NULL, insert->data);
+  free(insert);
+}
+
+void compact_update(compactor_t* compactor, relation_t* relation, update_t* update) {
+  add(compactor, relation, 'U', update->relation_id, update->from, update->to);
+  free(update);
+}
+
+void compact_delete(compactor_t* compactor, relation_t* relation, delete_t* del) {
+  add(compactor, relation, 'D', del->relation_id, del->data, NULL);
+  free(del);
+}
+
+static int elapsed_ms(compactor_t* compactor) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return (now.tv_sec - compactor->opened.tv_sec) * 1000 + (now.tv_nsec - compactor->opened.tv_nsec) / 1000000;
+}
+
+bool compact_window_closed(compactor_t* compactor, int64_t lsn) {
+  if(compactor->head == NULL) {
+    return true;
+  }
+
+  if(compactor->first_lsn == 0) {
+    compactor->first_lsn = lsn;
+  }
+
+  if(compactor->window_lsn > 0 && lsn - compactor->first_lsn >= compactor->window_lsn) {
+    return true;
+  }
+  return compactor->window_ms > 0 && elapsed_ms(compactor) >= compactor->window_ms;
+}
+
+// Time left before the window closes, or -1 when it only closes by lsn.
+int compact_remaining_ms(compactor_t* compactor) {
+  if(compactor->window_ms <= 0) {
+    return -1;
+  }
+
+  int remaining = compactor->window_ms - elapsed_ms(compactor);
+  return remaining > 0 ? remaining : 0;
+}
+
+bool compact_empty(compactor_t* compactor) {
+  return compactor->head == NULL;
+}
+
+void compact_flush(compactor_t* compactor, FILE* file) {
+  for(change_t* change = compactor->head; change != NULL; change = change->next) {
+    switch(change->operation) {
+      case 'I':
+        insert_t insert = { .relation_id = change->relation_id, .data = change->to };
+        print_insert(&insert, file);
+        break;
+      case 'U':
+        update_t update = { .relation_id = change->relation_id, .from = change->from, .to = change->to };
+        print_update(&update, file);
+        break;
+      case 'D':
+        delete_t del = { .relation_id = change->relation_id, .data = change->from };
+        print_delete(&del, file);
+        break;
+    }
+  }
+  clear(compactor);
+}
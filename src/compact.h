@@ -0,0 +1,46 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include "decoder.h"
+#include "relations.h"
+
+typedef struct change_s {
+  char operation;
+  int32_t relation_id;
+  tuples_t* from;
+  tuples_t* to;
+  char* key;
+  size_t key_size;
+  uint64_t hash;
+  struct change_s* prev;
+  struct change_s* next;
+  struct change_s* bucket_next;
+} change_t;
+
+// Merges the changes of a window by relation and replica identity key into
+// the net change of each row. Changes are kept in the order of their last
+// modification, which is the commit order of the net changes.
+typedef struct {
+  change_t** buckets;
+  size_t number_buckets;
+  size_t size;
+  change_t* head;
+  change_t* tail;
+  int window_ms;
+  int64_t window_lsn;
+  struct timespec opened;
+  int64_t first_lsn;
+} compactor_t;
+
+compactor_t* create_compactor(int window_ms, int64_t window_lsn);
+void delete_compactor(compactor_t* compactor);
+void compact_insert(compactor_t* compactor, relation_t* relation, insert_t* insert);
+void compact_update(compactor_t* compactor, relation_t* relation, update_t* update);
+void compact_delete(compactor_t* compactor, relation_t* relation, delete_t* del);
+bool compact_window_closed(compactor_t* compactor, int64_t lsn);
+int compact_remaining_ms(compactor_t* compactor);
+bool compact_empty(compactor_t* compactor);
+void compact_flush(compactor_t* compactor, FILE* file);
@@ -0,0 +1,55 @@
+#include <stdio.h>
+#include "logging.h"
+#include "stream.h"
+#include "connection.h"
+
+const int ERR_CONNECT = 1;
+const int ERR_QUERY = 2;
+const int ERR_FORMAT = 3;
+const int ERR_HANDLE = 4;
+
+const char* START_REPLICATION_COMMAND = "START_REPLICATION SLOT \"%s\" LOGICAL %X/%X (proto_version '1', publication_names '%s')";
+
+static int open_connection(PGconn **conn, options_t options, char* hostaddr, bool replication) {
+  char conn_str[1024];
+  int conn_str_err = sprintf(conn_str, "%sdbname=%s user=%s password=%s host=%s port=%s", replication ? "replication=database " : "", options.dbname, options.user, options.password, options.host, options.port);
+  if(conn_str_err > 0 && hostaddr != NULL && hostaddr[0] != '\0') {
+    conn_str_err = snprintf(conn_str + conn_str_err, sizeof(conn_str) - conn_str_err, " hostaddr=%s", hostaddr);
+  }
+
+  if(conn_str_err <= 0) {
+    ERROR("failed to format connection");
+    return ERR_FORMAT;
+  }
+
+  INFO("establishing connection: %s", conn_str);
+  *conn = PQconnectdb(conn_str);
+
+  if (PQstatus(*conn) != CONNECTION_OK) {
+    ERROR("connection failure");
+    return ERR_CONNECT;
+  }
+
+  return 0;
+}
+
+int create_connection(PGconn **conn, options_t options, char* hostaddr) {
+  return open_connection(conn, options, hostaddr, true);
+}
+
+int create_database_connection(PGconn **conn, options_t options) {
+  return open_connection(conn, options, NULL, false);
+}
+
+// Standby status update confirming everything up to lsn as written, flushed
+// and applied, without asking for a reply.
+void write_standby_status(char* buffer, int64_t lsn, int64_t timestamp) {
+  stream_t stream;
+  init_stream(&stream, buffer, STANDBY_STATUS_SIZE);
+  write_char(&stream, 'r');
+  write_int64(&stream, lsn+1);
+  write_int64(&stream, lsn+1);
+  write_int64(&stream, lsn+1);
+  write_int64(&stream, timestamp);
+  write_char(&stream, 0);
+}
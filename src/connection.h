@@ -0,0 +1,18 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <libpq-fe.h>
+#include "options.h"
+
+extern const int ERR_CONNECT;
+extern const int ERR_QUERY;
+extern const int ERR_FORMAT;
+extern const int ERR_HANDLE;
+extern const char* START_REPLICATION_COMMAND;
+
+#define STANDBY_STATUS_SIZE (1+8+8+8+8+1)
+
+int create_connection(PGconn **conn, options_t options, char* hostaddr);
+int create_database_connection(PGconn **conn, options_t options);
+void write_standby_status(char* buffer, int64_t lsn, int64_t timestamp);
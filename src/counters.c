@@ -0,0 +1,170 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#include <linux/perf_event.h>
+#include "logging.h"
+#include "counters.h"
+
+static const uint64_t EVENTS[NUMBER_EVENTS] = {
+  PERF_COUNT_HW_CPU_CYCLES,
+  PERF_COUNT_HW_INSTRUCTIONS,
+  PERF_COUNT_HW_CACHE_MISSES,
+  PERF_COUNT_HW_BRANCH_MISSES,
+};
+
+static const char* EVENT_NAMES[NUMBER_EVENTS] = { "cycles", "instructions", "cache_misses", "branch_misses" };
+static const char* STAGE_NAMES[NUMBER_STAGES] = { "receive", "parse", "print", "flush" };
+
+// Counter group of each thread, opened on its first sample. A leader of -2
+// means the group could not be opened.
+static __thread int group[NUMBER_EVENTS];
+static __thread int leader = -1;
+
+static int open_event(uint64_t config, int group_fd) {
+  struct perf_event_attr attr;
+  memset(&attr, 0, sizeof(attr));
+  attr.size = sizeof(attr);
+  attr.type = PERF_TYPE_HARDWARE;
+  attr.config = config;
+  attr.disabled = group_fd == -1;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+  attr.read_format = PERF_FORMAT_GROUP;
+  return syscall(SYS_perf_event_open, &attr, 0, -1, group_fd, 0);
+}
+
+static bool open_group() {
+  if(leader != -1) {
+    return leader >= 0;
+  }
+
+  for(int i=0; i<NUMBER_EVENTS; i++) {
+    group[i] = open_event(EVENTS[i], i == 0 ? -1 : group[0]);
+    if(group[i] < 0) {
+      for(int j=0; j<i; j++) {
+        close(group[j]);
+      }
+      leader = -2;
+      return false;
+    }
+  }
+  leader = group[0];
+  ioctl(leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+  return true;
+}
+
+static bool read_group(uint64_t* values) {
+  uint64_t buffer[1 + NUMBER_EVENTS];
+  if(read(leader, buffer, sizeof(buffer)) != sizeof(buffer) || buffer[0] != NUMBER_EVENTS) {
+    return false;
+  }
+  memcpy(values, buffer + 1, sizeof(uint64_t) * NUMBER_EVENTS);
+  return true;
+}
+
+void counters_begin(counters_t* counters, counter_sample_t* sample) {
+  sample->valid = counters != NULL && open_group() && read_group(sample->values);
+}
+
+void counters_end(counters_t* counters, counter_sample_t* sample, char operation, stage_t stage) {
+  uint64_t values[NUMBER_EVENTS];
+  if(!sample->valid || !read_group(values)) {
+    return;
+  }
+
+  stage_counters_t* counter = &counters->stages[operation & (NUMBER_OPERATIONS - 1)][stage];
+  for(int i=0; i<NUMBER_EVENTS; i++) {
+    atomic_fetch_add_explicit(&counter->values[i], values[i] - sample->values[i], memory_order_relaxed);
+  }
+  atomic_fetch_add_explicit(&counter->count, 1, memory_order_relaxed);
+}
+
+static void print_averages(FILE* file, uint64_t* values, uint64_t count) {
+  for(int i=0; i<NUMBER_EVENTS; i++) {
+    fprintf(file, " %s=%.1f", EVENT_NAMES[i], count > 0 ? (double)values[i] / count : 0.0);
+  }
+}
+
+// One line per operation and stage with averages per message, then the
+// averages of all stages per row.
+void print_counters(counters_t* counters) {
+  uint64_t totals[NUMBER_EVENTS] = { 0 };
+  uint64_t rows = 0;
+  for(int operation=0; operation<NUMBER_OPERATIONS; operation++) {
+    for(int stage=0; stage<NUMBER_STAGES; stage++) {
+      stage_counters_t* counter = &counters->stages[operation][stage];
+      uint64_t count = atomic_load_explicit(&counter->count, memory_order_relaxed);
+      if(count == 0) {
+        continue;
+      }
+
+      uint64_t values[NUMBER_EVENTS];
+      for(int i=0; i<NUMBER_EVENTS; i++) {
+        values[i] = atomic_load_explicit(&counter->values[i], memory_order_relaxed);
+        totals[i] += values[i];
+      }
+      if(stage == STAGE_PARSE && (operation == 'I' || operation == 'U' || operation == 'D')) {
+        rows += count;
+      }
+
+      if(stage == STAGE_FLUSH) {
+        fprintf(counters->file, "counters flush: count=%lu", count);
+      } else {
+        fprintf(counters->file, "counters %c %s: count=%lu", operation, STAGE_NAMES[stage], count);
+      }
+      print_averages(counters->file, values, count);
+      fprintf(counters->file, "\n");
+    }
+  }
+
+  fprintf(counters->file, "counters per row: rows=%lu", rows);
+  print_averages(counters->file, totals, rows);
+  fprintf(counters->file, "\n");
+  fflush(counters->file);
+}
+
+static void* run_reporter(void* arg) {
+  counters_t* counters = arg;
+  pthread_mutex_lock(&counters->lock);
+  while(!counters->closed) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += counters->interval;
+    if(pthread_cond_timedwait(&counters->stop, &counters->lock, &deadline) != 0) {
+      print_counters(counters);
+    }
+  }
+  pthread_mutex_unlock(&counters->lock);
+  return NULL;
+}
+
+counters_t* create_counters(int interval, FILE* file) {
+  if(!open_group()) {
+    ERROR("hardware counters are not available, check perf_event_paranoid");
+    return NULL;
+  }
+
+  counters_t* counters = calloc(1, sizeof(counters_t));
+  counters->interval = interval;
+  counters->file = file;
+  pthread_mutex_init(&counters->lock, NULL);
+  pthread_cond_init(&counters->stop, NULL);
+  pthread_create(&counters->thread, NULL, run_reporter, counters);
+  return counters;
+}
+
+void delete_counters(counters_t* counters) {
+  pthread_mutex_lock(&counters->lock);
+  counters->closed = true;
+  pthread_cond_signal(&counters->stop);
+  pthread_mutex_unlock(&counters->lock);
+  pthread_join(counters->thread, NULL);
+
+  print_counters(counters);
+  pthread_cond_destroy(&counters->stop);
+  pthread_mutex_destroy(&counters->lock);
+  free(counters);
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#define NUMBER_EVENTS 4
+#define NUMBER_OPERATIONS 128
+
+typedef enum {
+  STAGE_RECEIVE,
+  STAGE_PARSE,
+  STAGE_PRINT,
+  STAGE_FLUSH,
+  NUMBER_STAGES
+} stage_t;
+
+// Cycles, instructions, cache misses and branch misses of the calling thread.
+typedef struct {
+  uint64_t values[NUMBER_EVENTS];
+  bool valid;
+} counter_sample_t;
+
+typedef struct {
+  atomic_uint_fast64_t values[NUMBER_EVENTS];
+  atomic_uint_fast64_t count;
+} stage_counters_t;
+
+// Hardware counters around each stage of the decode loop, by operation.
+typedef struct {
+  stage_counters_t stages[NUMBER_OPERATIONS][NUMBER_STAGES];
+  int interval;
+  FILE* file;
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t stop;
+  bool closed;
+} counters_t;
+
+counters_t* create_counters(int interval, FILE* file);
+void delete_counters(counters_t* counters);
+void counters_begin(counters_t* counters, counter_sample_t* sample);
+void counters_end(counters_t* counters, counter_sample_t* sample, char operation, stage_t stage);
+void print_counters(counters_t* counters);
@@ -2,11 +2,25 @@
 #include "decoder.h"
 
 const char* NULL_STR = "NULL";
+const char* UNCHANGED_STR = "UNCHANGED_TOAST";
+
+begin_t* parse_begin(stream_t *stream) {
+  begin_t* begin = malloc(sizeof(begin_t));
+  begin->lsn = read_int64(stream);
+  begin->timestamp = read_int64(stream);
+  begin->transaction = read_int32(stream);
+  return begin;
+}
+
+void delete_begin(begin_t* begin) {
+  free(begin);
+}
 
 commit_t* parse_commit(stream_t *stream) {
   commit_t* commit = malloc(sizeof(commit_t));
   if(read_int8(stream) != 0) {
     ERROR("flag commit should be zero");
+    free(commit);
     return NULL;
   } 
 
@@ -20,50 +34,114 @@ void delete_commit(commit_t* commit) {
   free(commit);
 }
 
+stream_start_t* parse_stream_start(stream_t *stream) {
+  stream_start_t* start = malloc(sizeof(stream_start_t));
+  start->transaction = read_int32(stream);
+  start->first_segment = read_int8(stream);
+  return start;
+}
+
+void delete_stream_start(stream_start_t* start) {
+  free(start);
+}
+
+stream_commit_t* parse_stream_commit(stream_t *stream) {
+  stream_commit_t* commit = malloc(sizeof(stream_commit_t));
+  commit->transaction = read_int32(stream);
+  if(read_int8(stream) != 0) {
+    ERROR("flag stream commit should be zero");
+    free(commit);
+    return NULL;
+  }
+
+  commit->lsn = read_int64(stream);
+  commit->end_lsn = read_int64(stream);
+  commit->timestamp = read_int64(stream);
+  return commit;
+}
+
+void delete_stream_commit(stream_commit_t* commit) {
+  free(commit);
+}
+
+stream_abort_t* parse_stream_abort(stream_t *stream) {
+  stream_abort_t* abort = malloc(sizeof(stream_abort_t));
+  abort->transaction = read_int32(stream);
+  abort->subtransaction = read_int32(stream);
+  abort->lsn = 0;
+  abort->timestamp = 0;
+  if(stream_remaining(stream) >= 8+8) {
+    abort->lsn = read_int64(stream);
+    abort->timestamp = read_int64(stream);
+  }
+  return abort;
+}
+
+void delete_stream_abort(stream_abort_t* abort) {
+  free(abort);
+}
+
 relation_t* parse_relation(stream_t *stream) {
   relation_t* relation = malloc(sizeof(relation_t));
   relation->id = read_int32(stream);
-  relation->namespace = read_string(stream);
-  relation->name = read_string(stream);
+  relation->namespace = strdup(read_string(stream));
+  relation->name = strdup(read_string(stream));
   relation->replicate_identity_settings = read_int8(stream);
   relation->number_columns = read_int16(stream);
+  relation->changed_columns = false;
 
   relation->columns = malloc(sizeof(char*)*relation->number_columns);
+  relation->column_flags = malloc(sizeof(int8_t)*relation->number_columns);
+  relation->column_types = malloc(sizeof(int32_t)*relation->number_columns);
   for(int i=0; i<relation->number_columns; i++) {
-    read_int8(stream); // read flag column
-    relation->columns[i] = read_string(stream);
-    read_int32(stream); // read oid
+    relation->column_flags[i] = read_int8(stream);
+    relation->columns[i] = strdup(read_string(stream));
+    relation->column_types[i] = read_int32(stream);
     read_int32(stream); // atttypmod
   }
   return relation;
 }
 
 void delete_relation(relation_t* relation) {
+  for(int i=0; i<relation->number_columns; i++) {
+    free(relation->columns[i]);
+  }
+  free(relation->namespace);
+  free(relation->name);
+  free(relation->column_flags);
+  free(relation->column_types);
   free(relation->columns);
   free(relation);
 }
 
 char* parse_tuple(stream_t* stream) {
   char type = read_char(stream);
-  char* tuple;
+  char* tuple = NULL;
 
   switch(type) {
     case 't':
+    case 'b':
       int32_t size = read_int32(stream);
-      tuple = calloc(size+1, sizeof(char));
-      for(int i=0; i<size; i++) {
-        tuple[i] = read_char(stream);
-      }
+      tuple = malloc(size+1);
+      memcpy(tuple, stream->current, size);
+      skip_bytes(stream, size);
       tuple[size] = '\0';
       break;
     case 'n':
       tuple = (char*)NULL_STR;
       break;
+    case 'u':
+      tuple = (char*)UNCHANGED_STR;
+      break;
   }
 
   return tuple;
 }
 
+bool is_static_tuple(char* tuple) {
+  return tuple == NULL_STR || tuple == UNCHANGED_STR;
+}
+
 tuples_t* parse_tuples(stream_t* stream) {
   tuples_t* tuples = malloc(sizeof(tuples_t));
   tuples->size = read_int16(stream);
@@ -77,7 +155,9 @@ tuples_t* parse_tuples(stream_t* stream) {
 
 void delete_tuples(tuples_t* tuples) {
   for(int i=0; i<tuples->size; i++) {
-    free(tuples->values[i]);
+    if(!is_static_tuple(tuples->values[i])) {
+      free(tuples->values[i]);
+    }
   }
 
   free(tuples->values);
@@ -87,16 +167,26 @@ void delete_tuples(tuples_t* tuples) {
 update_t* parse_update(stream_t* stream) {
   update_t* update = malloc(sizeof(update_t));
   update->relation_id = read_int32(stream);
+  update->from = NULL;
 
   char key_char = read_char(stream);
-  if(key_char != 'K' && key_char != 'O') {
+  update->identity = key_char;
+  if(key_char != 'K' && key_char != 'O' && key_char != 'N') {
     ERROR("unexpected key char %c", key_char);
+    free(update);
     return NULL;
   }
 
-  update->from = parse_tuples(stream);
-  key_char = read_char(stream);
   if(key_char != 'N') {
+    update->from = parse_tuples(stream);
+    key_char = read_char(stream);
+  }
+
+  if(key_char != 'N') {
+    if(update->from != NULL) {
+      delete_tuples(update->from);
+    }
+    free(update);
     return NULL;
   }
 
@@ -105,7 +195,9 @@ update_t* parse_update(stream_t* stream) {
 }
 
 void delete_update(update_t* update) {
-  delete_tuples(update->from);
+  if(update->from != NULL) {
+    delete_tuples(update->from);
+  }
   delete_tuples(update->to);
   free(update);
 }
@@ -117,6 +209,7 @@ delete_t* parse_delete(stream_t* stream) {
   char key_char = read_char(stream);
   if(key_char != 'K' && key_char != 'O') {
     ERROR("unexpected key char %c", key_char);
+    free(del);
     return NULL;
   }
 
@@ -166,13 +259,69 @@ void print_tuples(tuples_t *tuples, FILE *file) {
 void print_update(update_t *update, FILE *file) {
   fprintf(file, "relation_id: %d\n", update->relation_id);
   fprintf(file, "operation: update\n");
-  fprintf(file, "from:\n");
-  print_tuples(update->from, file);
+  if(update->from != NULL) {
+    fprintf(file, "from:\n");
+    print_tuples(update->from, file);
+  }
   fprintf(file, "to:\n");
   print_tuples(update->to, file);
   fprintf(file, "---\n");
 }
 
+static bool same_value(char* from, char* to) {
+  if(from == to || to == UNCHANGED_STR) {
+    return true;
+  }
+
+  if(is_static_tuple(from) || is_static_tuple(to)) {
+    return false;
+  }
+  return strcmp(from, to) == 0;
+}
+
+// Prints only the key columns and the columns that changed, listed by index,
+// when the update carries the old row. Other updates are printed in full.
+// Under replica identity full every column is flagged as key, so only the
+// changed ones are kept.
+void print_changed_update(update_t* update, relation_t* relation, FILE* file) {
+  tuples_t* from = update->from;
+  tuples_t* to = update->to;
+  if(update->identity != 'O' || from->size != to->size || to->size != relation->number_columns) {
+    print_update(update, file);
+    return;
+  }
+
+  bool full = relation->replicate_identity_settings == 'f';
+  bool* selected = malloc(sizeof(bool)*to->size);
+  for(int i=0; i<to->size; i++) {
+    bool key = !full && (relation->column_flags[i] & COLUMN_FLAG_KEY);
+    selected[i] = key || !same_value(from->values[i], to->values[i]);
+  }
+
+  fprintf(file, "relation_id: %d\n", update->relation_id);
+  fprintf(file, "operation: update\n");
+  fprintf(file, "columns:\n");
+  for(int i=0; i<to->size; i++) {
+    if(selected[i]) {
+      fprintf(file, "  - %d\n", i);
+    }
+  }
+  fprintf(file, "from:\n");
+  for(int i=0; i<from->size; i++) {
+    if(selected[i]) {
+      fprintf(file, "  - %s\n", from->values[i]);
+    }
+  }
+  fprintf(file, "to:\n");
+  for(int i=0; i<to->size; i++) {
+    if(selected[i]) {
+      fprintf(file, "  - %s\n", to->values[i]);
+    }
+  }
+  fprintf(file, "---\n");
+  free(selected);
+}
+
 void print_delete(delete_t *del, FILE *file) {
   fprintf(file, "relation_id: %d\n", del->relation_id);
   fprintf(file, "operation: delete\n");
@@ -190,3 +339,123 @@ void print_insert(insert_t *insert, FILE *file) {
 }
 
 
+
+static bool validate_tuples(stream_t* stream) {
+  int16_t size;
+  if(!check_int16(stream, &size) || size < 0) {
+    return false;
+  }
+
+  for(int i=0; i<size; i++) {
+    int8_t type;
+    int32_t length;
+    if(!check_int8(stream, &type)) {
+      return false;
+    }
+
+    switch(type) {
+      case 'n':
+      case 'u':
+        break;
+      case 't':
+      case 'b':
+        if(!check_int32(stream, &length) || length < 0 || !check_bytes(stream, length)) {
+          return false;
+        }
+        break;
+      default:
+        ERROR("unexpected tuple type %c", type);
+        return false;
+    }
+  }
+
+  return true;
+}
+
+static bool validate_relation(stream_t* stream) {
+  int16_t number_columns;
+  if(!check_bytes(stream, 4) || !check_string(stream) || !check_string(stream)
+      || !check_bytes(stream, 1) || !check_int16(stream, &number_columns) || number_columns < 0) {
+    return false;
+  }
+
+  for(int i=0; i<number_columns; i++) {
+    if(!check_bytes(stream, 1) || !check_string(stream) || !check_bytes(stream, 8)) {
+      return false;
+    }
+  }
+
+  return true;
+}
+
+static bool validate_update(stream_t* stream) {
+  int8_t key_char;
+  if(!check_bytes(stream, 4) || !check_int8(stream, &key_char)) {
+    return false;
+  }
+
+  if(key_char == 'K' || key_char == 'O') {
+    if(!validate_tuples(stream) || !check_int8(stream, &key_char)) {
+      return false;
+    }
+  }
+
+  return key_char == 'N' && validate_tuples(stream);
+}
+
+static bool validate_delete(stream_t* stream) {
+  int8_t key_char;
+  if(!check_bytes(stream, 4) || !check_int8(stream, &key_char)) {
+    return false;
+  }
+
+  return (key_char == 'K' || key_char == 'O') && validate_tuples(stream);
+}
+
+static bool validate_insert(stream_t* stream) {
+  int8_t key_char;
+  if(!check_bytes(stream, 4) || !check_int8(stream, &key_char)) {
+    return false;
+  }
+
+  return key_char == 'N' && validate_tuples(stream);
+}
+
+// Inside a stream the row and relation messages start with the xid of their
+// (sub)transaction.
+bool validate_message(stream_t* stream, bool streamed) {
+  stream_t cursor = *stream;
+  int8_t operation;
+  if(!check_int8(&cursor, &operation)) {
+    return false;
+  }
+
+  if(streamed && (operation == 'R' || operation == 'I' || operation == 'U' || operation == 'D') && !check_bytes(&cursor, 4)) {
+    return false;
+  }
+
+  switch(operation) {
+    case 'S':
+      return check_bytes(&cursor, 4+1);
+    case 'E':
+      return true;
+    case 'c':
+      return check_bytes(&cursor, 4+1+8+8+8);
+    case 'A':
+      return check_bytes(&cursor, 4+4);
+    case 'B':
+      return check_bytes(&cursor, 8+8+4);
+    case 'C':
+      return check_bytes(&cursor, 1+8+8+8);
+    case 'R':
+      return validate_relation(&cursor);
+    case 'I':
+      return validate_insert(&cursor);
+    case 'U':
+      return validate_update(&cursor);
+    case 'D':
+      return validate_delete(&cursor);
+    default:
+      return true;
+  }
+}
@@ -6,6 +6,17 @@
 
 enum Error { OK, FAILED };
 
+bool validate_message(stream_t *stream, bool streamed);
+
+typedef struct {
+  int64_t lsn;
+  int64_t timestamp;
+  int32_t transaction;
+} begin_t;
+
+begin_t* parse_begin(stream_t *stream);
+void delete_begin(begin_t* begin);
+
 typedef struct {
   int64_t lsn;
   int64_t transaction;
@@ -15,6 +26,36 @@ typedef struct {
 commit_t* parse_commit(stream_t *stream);
 void delete_commit(commit_t* commit);
 
+typedef struct {
+  int32_t transaction;
+  int8_t first_segment;
+} stream_start_t;
+
+stream_start_t* parse_stream_start(stream_t *stream);
+void delete_stream_start(stream_start_t* start);
+
+typedef struct {
+  int32_t transaction;
+  int64_t lsn;
+  int64_t end_lsn;
+  int64_t timestamp;
+} stream_commit_t;
+
+stream_commit_t* parse_stream_commit(stream_t *stream);
+void delete_stream_commit(stream_commit_t* commit);
+
+// The abort lsn and timestamp are only sent with parallel streaming, they
+// are zero otherwise.
+typedef struct {
+  int32_t transaction;
+  int32_t subtransaction;
+  int64_t lsn;
+  int64_t timestamp;
+} stream_abort_t;
+
+stream_abort_t* parse_stream_abort(stream_t *stream);
+void delete_stream_abort(stream_abort_t* abort);
+
 typedef struct {
   int64_t id;
   char* namespace;
@@ -22,13 +63,22 @@ typedef struct {
   int8_t replicate_identity_settings;
   int16_t number_columns;
   char** columns;
+  int8_t* column_flags;
+  int32_t* column_types;
+  bool changed_columns;
 } relation_t;
 
+#define COLUMN_FLAG_KEY 1
+
 relation_t* parse_relation(stream_t *stream);
 void delete_relation(relation_t* relation);
 void print_relation(relation_t* relation, FILE *file);
 
+extern const char* NULL_STR;
+extern const char* UNCHANGED_STR;
+
 char* parse_tuple(stream_t *stream);
+bool is_static_tuple(char* tuple);
 
 typedef struct {
   int16_t size;
@@ -39,8 +89,11 @@ tuples_t* parse_tuples(stream_t* stream);
 void delete_tuples(tuples_t* tuples);
 void print_tuples(tuples_t *tuples, FILE *file);
 
+// The identity is 'O' when from is the old row, 'K' when it only holds the
+// old key and 'N' without from.
 typedef struct {
   int32_t relation_id;
+  char identity;
   tuples_t* from;
   tuples_t* to;
 } update_t;
@@ -48,6 +101,7 @@ typedef struct {
 update_t* parse_update(stream_t* stream);
 void delete_update(update_t* update);
 void print_update(update_t *update, FILE *file);
+void print_changed_update(update_t* update, relation_t* relation, FILE* file);
 
 typedef struct {
   int32_t relation_id;
@@ -0,0 +1,570 @@
+#include "logging.h"
+#include "handler.h"
+
+const size_t WAL_HEADER_SIZE = 8+8+8;
+const long BATCH_LIMIT = 1024*1024;
+const long BEHIND_BATCH_LIMIT = 16*1024*1024;
+const int BATCH_DELAY_MS = 50;
+
+handler_t* create_handler(sinks_t* sinks, queue_t* queue, options_t* options) {
+  handler_t* handler = malloc(sizeof(handler_t));
+  handler->file = open_memstream(&handler->data, &handler->size);
+  handler->lsn = 0;
+  handler->commit_lsn = 0;
+  handler->final_lsn = 0;
+  handler->timestamp = 0;
+  handler->oldest_timestamp = 0;
+  handler->stamp_latency = options->stamp_latency;
+  handler->checksum = options->checksum;
+  handler->counters = NULL;
+  handler->changed_tables = options->changed_columns;
+  handler->number_changed_tables = options->number_changed_columns;
+  handler->columnar = NULL;
+  if(options->arrow_dir != NULL) {
+    handler->columnar = create_columnar(options->arrow_dir, options->arrow_batch_rows, options->arrow_batch_ms);
+  }
+  handler->stats = NULL;
+  if(options->stats != NULL) {
+    handler->stats = create_stats(options->stats);
+  }
+  handler->mirror = NULL;
+  if(options->number_mirrors > 0) {
+    handler->mirror = create_mirror(options->mirrors, options->number_mirrors, options->mirror_dump, options->mirror_interval);
+  }
+  handler->streams = create_streams(options->spill_dir);
+  handler->in_stream = false;
+  handler->stream_transaction = 0;
+  handler->number_partitions = options->partitions;
+  handler->partitions = calloc(options->partitions, sizeof(partition_t));
+  for(int i=0; i<handler->number_partitions; i++) {
+    partition_t* partition = &handler->partitions[i];
+    partition->file = open_memstream(&partition->data, &partition->size);
+  }
+  handler->queue = queue;
+  handler->sinks = sinks;
+  handler->relations = create_relations();
+  handler->toast_cache = NULL;
+  if(options->toast_cache > 0) {
+    handler->toast_cache = create_toast_cache(options->toast_cache);
+  }
+  handler->compactor = NULL;
+  if(options->compact_window > 0 || options->compact_lsn > 0) {
+    handler->compactor = create_compactor(options->compact_window, options->compact_lsn);
+  }
+  atomic_init(&handler->in_transaction, false);
+  atomic_init(&handler->compacting, false);
+  atomic_init(&handler->pending, false);
+  atomic_init(&handler->open_streams, 0);
+  atomic_init(&handler->commit_batch, 0);
+  atomic_init(&handler->handled, 0);
+  atomic_init(&handler->buffered_lsn, 0);
+  return handler;
+}
+
+void delete_handler(handler_t* handler) {
+  if(handler->compactor != NULL) {
+    delete_compactor(handler->compactor);
+  }
+  fclose(handler->file);
+  free(handler->data);
+  for(int i=0; i<handler->number_partitions; i++) {
+    fclose(handler->partitions[i].file);
+    free(handler->partitions[i].data);
+  }
+  free(handler->partitions);
+  if(handler->toast_cache != NULL) {
+    delete_toast_cache(handler->toast_cache);
+  }
+  delete_relations(handler->relations);
+  delete_streams(handler->streams);
+  if(handler->mirror != NULL) {
+    delete_mirror(handler->mirror);
+  }
+  if(handler->columnar != NULL) {
+    delete_columnar(handler->columnar);
+  }
+  if(handler->stats != NULL) {
+    delete_stats(handler->stats);
+  }
+  free(handler);
+}
+
+static void flush_partitions(handler_t* handler) {
+  for(int i=0; i<handler->number_partitions; i++) {
+    partition_t* partition = &handler->partitions[i];
+    if(handler->checksum) {
+      print_checksum(partition->file, &partition->data, &partition->size);
+    }
+    fclose(partition->file);
+    buffer_t* buffer = create_buffer(partition->data, partition->size, handler->lsn);
+    buffer->timestamp = handler->oldest_timestamp;
+    sink_push(handler->sinks->sinks[i], buffer);
+    release_buffer(buffer);
+    partition->file = open_memstream(&partition->data, &partition->size);
+  }
+}
+
+// Hands the encoded output to the sinks. Transactions without output still
+// produce an empty buffer, so the durable position of the sinks advances.
+void flush_handler(handler_t* handler) {
+  counter_sample_t sample;
+  counters_begin(handler->counters, &sample);
+  if(handler->number_partitions > 0) {
+    flush_partitions(handler);
+    handler->oldest_timestamp = 0;
+    atomic_store(&handler->pending, false);
+    counters_end(handler->counters, &sample, 0, STAGE_FLUSH);
+    return;
+  }
+
+  if(handler->checksum) {
+    print_checksum(handler->file, &handler->data, &handler->size);
+  }
+  fclose(handler->file);
+  buffer_t* buffer = create_buffer(handler->data, handler->size, handler->lsn);
+  buffer->timestamp = handler->oldest_timestamp;
+  handler->oldest_timestamp = 0;
+  sinks_push(handler->sinks, buffer);
+  handler->file = open_memstream(&handler->data, &handler->size);
+  atomic_store(&handler->pending, false);
+  counters_end(handler->counters, &sample, 0, STAGE_FLUSH);
+}
+
+// Commits are grouped into one buffer while the slot is behind, up to a
+// larger size or a short delay, and flushed one by one when caught up.
+void handler_set_batching(handler_t* handler, bool behind) {
+  atomic_store(&handler->commit_batch, behind ? BEHIND_BATCH_LIMIT : 0);
+}
+
+// Writes the net changes of the compaction window and hands them to the sinks.
+static void close_window(handler_t* handler, int64_t lsn) {
+  compact_flush(handler->compactor, handler->file);
+  handler->lsn = lsn;
+  flush_handler(handler);
+  atomic_store(&handler->compacting, false);
+}
+
+static long output_size(handler_t* handler) {
+  long size = ftell(handler->file);
+  for(int i=0; i<handler->number_partitions; i++) {
+    size += ftell(handler->partitions[i].file);
+  }
+  return size;
+}
+
+// Commit time of the transaction and the delay until it was encoded.
+static void stamp_latency(handler_t* handler, FILE* file) {
+  char timestamp[64];
+  format_timestamp(handler->timestamp, timestamp, sizeof(timestamp));
+  fprintf(file, "commit_timestamp: %s\n", timestamp);
+  fprintf(file, "encode_latency_us: %ld\n", postgres_now() - handler->timestamp);
+}
+
+// Output of a row change. With partitions it is chosen by a hash of the
+// relation and the replica identity key, so changes of a key stay in order,
+// and the record starts with the commit lsn of its transaction.
+static FILE* record_file(handler_t* handler, relation_t* relation, int32_t relation_id, tuples_t* tuples) {
+  if(handler->number_partitions == 0) {
+    return handler->file;
+  }
+
+  size_t size = 0;
+  char* key = relation != NULL ? relation_key(relation, tuples, &size) : NULL;
+  uint64_t hash = hash_relation_key(relation_id, key, size);
+  free(key);
+
+  FILE* file = handler->partitions[hash % handler->number_partitions].file;
+  fprintf(file, "commit_lsn: %X/%X\n", (uint32_t)(handler->final_lsn >> 32), (uint32_t)handler->final_lsn);
+  return file;
+}
+
+// Output of a row change: the spill file of a streamed transaction, or the
+// output of the current transaction.
+static FILE* begin_record(handler_t* handler, stream_transaction_t* streamed, relation_t* relation,
+    int32_t relation_id, tuples_t* tuples, long* offset) {
+  if(streamed != NULL) {
+    *offset = ftell(streamed->file);
+    return streamed->file;
+  }
+
+  FILE* file = record_file(handler, relation, relation_id, tuples);
+  if(handler->stamp_latency) {
+    stamp_latency(handler, file);
+  }
+  return file;
+}
+
+// Ends a transaction in the output, handing it to the sinks unless commits
+// are grouped or compacted.
+static void commit_transaction(handler_t* handler, int64_t lsn, int64_t timestamp) {
+  compactor_t* compactor = handler->compactor;
+  handler->commit_lsn = lsn;
+  if(handler->columnar != NULL) {
+    columnar_commit(handler->columnar);
+  }
+  if(handler->oldest_timestamp == 0) {
+    handler->oldest_timestamp = timestamp;
+  }
+
+  if(compactor == NULL) {
+    handler->lsn = lsn;
+    if(output_size(handler) >= atomic_load(&handler->commit_batch)) {
+      flush_handler(handler);
+    } else {
+      atomic_store(&handler->pending, true);
+    }
+  } else if(compact_window_closed(compactor, lsn)) {
+    close_window(handler, lsn);
+  }
+}
+
+// Rows of a streamed transaction may still be aborted, so they only evict the
+// images of the keys they touch and their unchanged values are kept as is.
+static void forget_streamed_update(toast_cache_t* toast_cache, relation_t* relation, update_t* update) {
+  if(update->from != NULL) {
+    toast_cache_delete(toast_cache, relation, update->from);
+  }
+  toast_cache_delete(toast_cache, relation, update->to);
+}
+
+int handle_wal(handler_t* handler, stream_t *stream) {
+  compactor_t* compactor = handler->compactor;
+  FILE* file = handler->file;
+  relations_t* relations = handler->relations;
+  toast_cache_t* toast_cache = handler->toast_cache;
+
+  DEBUG("handling wal");
+  if(!check_bytes(stream, WAL_HEADER_SIZE) || !validate_message(stream, handler->in_stream)) {
+    ERROR("malformed wal message");
+    return FAILED;
+  }
+
+  relation_t* relation;
+  counter_sample_t sample;
+  stream_transaction_t* streamed = NULL;
+  int32_t subtransaction = 0;
+  long offset = 0;
+  char operation = read_char(stream);
+  DEBUG("handling operation %c", operation);
+  if(handler->in_stream && (operation == 'R' || operation == 'I' || operation == 'U' || operation == 'D')) {
+    subtransaction = read_int32(stream);
+    if(operation != 'R') {
+      streamed = open_stream_transaction(handler->streams, handler->stream_transaction);
+      if(streamed == NULL) {
+        return FAILED;
+      }
+    }
+  }
+
+  switch (operation) {
+    case 'B':
+      counters_begin(handler->counters, &sample);
+      begin_t* begin = parse_begin(stream);
+      counters_end(handler->counters, &sample, operation, STAGE_PARSE);
+      handler->final_lsn = begin->lsn;
+      handler->timestamp = begin->timestamp;
+      atomic_store(&handler->in_transaction, true);
+      delete_begin(begin);
+      break;
+    case 'C':
+      counters_begin(handler->counters, &sample);
+      commit_t* commit = parse_commit(stream);
+      counters_end(handler->counters, &sample, operation, STAGE_PARSE);
+      if(commit == NULL) {
+        return FAILED;
+      }
+
+      commit_transaction(handler, commit->lsn, commit->timestamp);
+      atomic_store(&handler->in_transaction, false);
+      delete_commit(commit);
+      break;
+    case 'S':
+      counters_begin(handler->counters, &sample);
+      stream_start_t* start = parse_stream_start(stream);
+      counters_end(handler->counters, &sample, operation, STAGE_PARSE);
+      handler->in_stream = true;
+      handler->stream_transaction = start->transaction;
+      delete_stream_start(start);
+      break;
+    case 'E':
+      handler->in_stream = false;
+      break;
+    case 'c':
+      counters_begin(handler->counters, &sample);
+      stream_commit_t* stream_commit = parse_stream_commit(stream);
+      counters_end(handler->counters, &sample, operation, STAGE_PARSE);
+      if(stream_commit == NULL) {
+        return FAILED;
+      }
+
+      if(compactor != NULL && !compact_empty(compactor)) {
+        close_window(handler, handler->commit_lsn);
+      }
+      if(commit_stream_transaction(handler->streams, stream_commit->transaction, handler->file) < 0) {
+        delete_stream_commit(stream_commit);
+        return FAILED;
+      }
+      commit_transaction(handler, stream_commit->lsn, stream_commit->timestamp);
+      delete_stream_commit(stream_commit);
+      break;
+    case 'A':
+      counters_begin(handler->counters, &sample);
+      stream_abort_t* abort = parse_stream_abort(stream);
+      counters_end(handler->counters, &sample, operation, STAGE_PARSE);
+      abort_stream_transaction(handler->streams, abort->transaction, abort->subtransaction);
+      if(abort->transaction == abort->subtransaction && abort->lsn > 0) {
+        DEBUG("streamed transaction %d aborted at %X/%X", abort->transaction,
+          (uint32_t)(abort->lsn >> 32), (uint32_t)abort->lsn);
+        if(!atomic_load(&handler->in_transaction) && (compactor == NULL || compact_empty(compactor))) {
+          handler->lsn = abort->lsn;
+          flush_handler(handler);
+        }
+      }
+      delete_stream_abort(abort);
+      break;
+    case 'R':
+      counters_begin(handler->counters, &sample);
+      relation = parse_relation(stream);
+      counters_end(handler->counters, &sample, operation, STAGE_PARSE);
+      if(relation == NULL) {
+        return FAILED;
+      }
+
+      counters_begin(handler->counters, &sample);
+      if(handler->number_partitions == 0) {
+        print_relation(relation, file);
+      }
+      for(int i=0; i<handler->number_partitions; i++) {
+        print_relation(relation, handler->partitions[i].file);
+      }
+      counters_end(handler->counters, &sample, operation, STAGE_PRINT);
+      relation->changed_columns = relation_selected(relation, handler->changed_tables, handler->number_changed_tables);
+      if(handler->mirror != NULL) {
+        mirror_relation(handler->mirror, relation);
+      }
+      if(handler->columnar != NULL) {
+        columnar_relation(handler->columnar, relation, handler->final_lsn);
+      }
+      put_relation(relations, relation);
+      break;
+    case 'I':
+      counters_begin(handler->counters, &sample);
+      insert_t* insert = parse_insert(stream);
+      counters_end(handler->counters, &sample, operation, STAGE_PARSE);
+      if(insert == NULL) {
+        return FAILED;
+      }
+
+      relation = get_relation(relations, insert->relation_id);
+      if(toast_cache != NULL && relation != NULL && streamed != NULL) {
+        toast_cache_delete(toast_cache, relation, insert->data);
+      } else if(toast_cache != NULL && relation != NULL) {
+        toast_cache_insert(toast_cache, relation, insert->data);
+      }
+      if(handler->stats != NULL) {
+        stats_change(handler->stats, insert->relation_id, relation, operation, stream->end - stream->start, insert->data);
+      }
+      if(handler->columnar != NULL) {
+        columnar_append(handler->columnar, relation, operation, handler->final_lsn, insert->data);
+      }
+      if(handler->mirror != NULL) {
+        mirror_insert(handler->mirror, relation, insert->data);
+      }
+
+      if(compactor != NULL && streamed == NULL) {
+        atomic_store(&handler->compacting, true);
+        compact_insert(compactor, relation, insert);
+        break;
+      }
+
+      file = begin_record(handler, streamed, relation, insert->relation_id, insert->data, &offset);
+      counters_begin(handler->counters, &sample);
+      print_insert(insert, file);
+      counters_end(handler->counters, &sample, operation, STAGE_PRINT);
+      if(streamed != NULL) {
+        stream_transaction_add(streamed, subtransaction, offset);
+      }
+      delete_insert(insert);
+      break;
+    case 'U':
+      counters_begin(handler->counters, &sample);
+      update_t* update = parse_update(stream);
+      counters_end(handler->counters, &sample, operation, STAGE_PARSE);
+      if(update == NULL) {
+        return FAILED;
+      }
+
+      relation = get_relation(relations, update->relation_id);
+      if(toast_cache != NULL && relation != NULL && streamed != NULL) {
+        forget_streamed_update(toast_cache, relation, update);
+      } else if(toast_cache != NULL && relation != NULL) {
+        toast_cache_update(toast_cache, relation, update->from, update->to);
+      }
+      if(handler->stats != NULL) {
+        tuples_t* key = update->from != NULL ? update->from : update->to;
+        stats_change(handler->stats, update->relation_id, relation, operation, stream->end - stream->start, key);
+      }
+      if(handler->columnar != NULL) {
+        columnar_append(handler->columnar, relation, operation, handler->final_lsn, update->to);
+      }
+      if(handler->mirror != NULL) {
+        mirror_update(handler->mirror, relation, update->from, update->to);
+      }
+
+      if(compactor != NULL && streamed == NULL) {
+        atomic_store(&handler->compacting, true);
+        compact_update(compactor, relation, update);
+        break;
+      }
+
+      // An update of the key stays in the partition of the old key.
+      tuples_t* routed = update->from != NULL ? update->from : update->to;
+      file = begin_record(handler, streamed, relation, update->relation_id, routed, &offset);
+      counters_begin(handler->counters, &sample);
+      if(relation != NULL && relation->changed_columns) {
+        print_changed_update(update, relation, file);
+      } else {
+        print_update(update, file);
+      }
+      counters_end(handler->counters, &sample, operation, STAGE_PRINT);
+      if(streamed != NULL) {
+        stream_transaction_add(streamed, subtransaction, offset);
+      }
+      delete_update(update);
+      break;
+    case 'D':
+      counters_begin(handler->counters, &sample);
+      delete_t* delete = parse_delete(stream);
+      counters_end(handler->counters, &sample, operation, STAGE_PARSE);
+      if(delete == NULL) {
+        return FAILED;
+      }
+
+      relation = get_relation(relations, delete->relation_id);
+      if(toast_cache != NULL && relation != NULL) {
+        toast_cache_delete(toast_cache, relation, delete->data);
+      }
+      if(handler->stats != NULL) {
+        stats_change(handler->stats, delete->relation_id, relation, operation, stream->end - stream->start, delete->data);
+      }
+      if(handler->columnar != NULL) {
+        columnar_append(handler->columnar, relation, operation, handler->final_lsn, delete->data);
+      }
+      if(handler->mirror != NULL) {
+        mirror_delete(handler->mirror, relation, delete->data);
+      }
+
+      if(compactor != NULL && streamed == NULL) {
+        atomic_store(&handler->compacting, true);
+        compact_delete(compactor, relation, delete);
+        break;
+      }
+
+      file = begin_record(handler, streamed, relation, delete->relation_id, delete->data, &offset);
+      counters_begin(handler->counters, &sample);
+      print_delete(delete, file);
+      counters_end(handler->counters, &sample, operation, STAGE_PRINT);
+      if(streamed != NULL) {
+        stream_transaction_add(streamed, subtransaction, offset);
+      }
+      delete_delete(delete);
+      break;
+    default:
+      DEBUG("unknown operation: %c", operation);
+  }
+
+  long limit = atomic_load(&handler->commit_batch) > BATCH_LIMIT ? atomic_load(&handler->commit_batch) : BATCH_LIMIT;
+  atomic_store(&handler->open_streams, handler->streams->size);
+  if(compactor == NULL && streamed == NULL && ftell(file) > limit) {
+    flush_handler(handler);
+  }
+
+  return OK;
+}
+
+// Streamed transactions are sent again from their start after a reconnect.
+void handler_reset_streams(handler_t* handler) {
+  reset_streams(handler->streams);
+  handler->in_stream = false;
+  atomic_store(&handler->open_streams, 0);
+}
+
+void* run_handler(void* arg) {
+  handler_t* handler = arg;
+  frame_t* frame;
+
+  while(1) {
+    compactor_t* compactor = handler->compactor;
+    if(compactor != NULL && !compact_empty(compactor) && !atomic_load(&handler->in_transaction)
+        && compact_remaining_ms(compactor) >= 0) {
+      if(!queue_wait(handler->queue, compact_remaining_ms(compactor))) {
+        close_window(handler, handler->commit_lsn);
+        continue;
+      }
+    }
+
+    if(atomic_load(&handler->pending) && !atomic_load(&handler->in_transaction)
+        && !queue_wait(handler->queue, BATCH_DELAY_MS)) {
+      flush_handler(handler);
+      continue;
+    }
+
+    stats_t* stats = handler->stats;
+    if(stats != NULL) {
+      if(stats_remaining_ms(stats) == 0) {
+        stats_dump(stats, handler->relations, handler->commit_lsn);
+      } else if(!queue_wait(handler->queue, stats_remaining_ms(stats))) {
+        continue;
+      }
+    }
+
+    mirror_t* mirror = handler->mirror;
+    if(mirror != NULL && !atomic_load(&handler->in_transaction)) {
+      if(mirror_remaining_ms(mirror) == 0) {
+        mirror_dump(mirror, handler->relations, handler->commit_lsn);
+      } else if(!queue_wait(handler->queue, mirror_remaining_ms(mirror))) {
+        continue;
+      }
+    }
+
+    if((frame = queue_pop(handler->queue)) == NULL) {
+      break;
+    }
+
+    stream_t stream;
+    init_stream(&stream, frame->data, frame->size);
+    if(read_char(&stream) == 'x') {
+      handler_reset_streams(handler);
+    } else {
+      handle_wal(handler, &stream);
+    }
+    if(handler->columnar != NULL) {
+      atomic_store(&handler->buffered_lsn, columnar_buffered_lsn(handler->columnar));
+    }
+    atomic_fetch_add(&handler->handled, 1);
+    delete_frame(frame);
+  }
+
+  if(atomic_load(&handler->pending)) {
+    flush_handler(handler);
+  }
+  return NULL;
+}
+
+// Position that is safe to confirm to the server, the lowest one written by
+// all sinks. The server position is only confirmed when every received frame
+// was written and no transaction, streamed transaction, compaction window or
+// commit group is open. Either stays below rows still held in arrow batches.
+int64_t handler_feedback_lsn(handler_t* handler, int64_t received, int64_t server_lsn) {
+  int64_t lsn = sinks_durable_lsn(handler->sinks);
+  if(atomic_load(&handler->handled) == received && !atomic_load(&handler->in_transaction)
+      && !atomic_load(&handler->compacting) && !atomic_load(&handler->pending) && atomic_load(&handler->open_streams) == 0 && server_lsn > lsn && sinks_idle(handler->sinks)) {
+    lsn = server_lsn;
+  }
+
+  int64_t buffered = atomic_load(&handler->buffered_lsn);
+  if(buffered > 0 && lsn >= buffered) {
+    lsn = buffered - 1;
+  }
+  return lsn;
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include "stream.h"
+#include "decoder.h"
+#include "relations.h"
+#include "toast.h"
+#include "queue.h"
+#include "sink.h"
+#include "compact.h"
+#include "options.h"
+#include "checksum.h"
+#include "streams.h"
+#include "counters.h"
+#include "mirror.h"
+#include "columnar.h"
+#include "stats.h"
+
+// Output of one partition, written to the sink of the same index.
+typedef struct {
+  FILE* file;
+  char* data;
+  size_t size;
+} partition_t;
+
+// Decodes wal frames and encodes them once per transaction into a buffer that
+// is handed to every sink. Runs on its own thread, fed by the queue.
+typedef struct {
+  FILE* file;
+  char* data;
+  size_t size;
+  int64_t lsn;
+  int64_t commit_lsn;
+  int64_t final_lsn;
+  int64_t timestamp;
+  int64_t oldest_timestamp;
+  bool stamp_latency;
+  bool checksum;
+  counters_t* counters;
+  mirror_t* mirror;
+  columnar_t* columnar;
+  stats_t* stats;
+  char** changed_tables;
+  int number_changed_tables;
+  streams_t* streams;
+  bool in_stream;
+  int32_t stream_transaction;
+  partition_t* partitions;
+  int number_partitions;
+  queue_t* queue;
+  sinks_t* sinks;
+  relations_t* relations;
+  toast_cache_t* toast_cache;
+  compactor_t* compactor;
+  atomic_bool in_transaction;
+  atomic_bool compacting;
+  atomic_bool pending;
+  atomic_int open_streams;
+  atomic_long commit_batch;
+  atomic_int_fast64_t handled;
+  atomic_int_fast64_t buffered_lsn;
+} handler_t;
+
+handler_t* create_handler(sinks_t* sinks, queue_t* queue, options_t* options);
+void delete_handler(handler_t* handler);
+int handle_wal(handler_t* handler, stream_t* stream);
+void flush_handler(handler_t* handler);
+void* run_handler(void* handler);
+void handler_reset_streams(handler_t* handler);
+void handler_set_batching(handler_t* handler, bool behind);
+int64_t handler_feedback_lsn(handler_t* handler, int64_t received, int64_t server_lsn);
@@ -0,0 +1,166 @@
+#include <stdlib.h>
+#include <stdbool.h>
+#include <time.h>
+#include "latency.h"
+
+const int64_t POSTGRES_EPOCH_USEC = 946684800LL * 1000000LL;
+
+histogram_t* create_histogram() {
+  histogram_t* histogram = calloc(1, sizeof(histogram_t));
+  return histogram;
+}
+
+void delete_histogram(histogram_t* histogram) {
+  free(histogram);
+}
+
+static int bucket_of(uint64_t value) {
+  if(value < HISTOGRAM_SUB_BUCKETS) {
+    return value;
+  }
+
+  int exponent = 63 - __builtin_clzll(value);
+  int sub = (value >> (exponent - HISTOGRAM_SUB_BITS)) - HISTOGRAM_SUB_BUCKETS;
+  return (exponent - HISTOGRAM_SUB_BITS + 1) * HISTOGRAM_SUB_BUCKETS + sub;
+}
+
+static int64_t value_of(int bucket) {
+  if(bucket < HISTOGRAM_SUB_BUCKETS) {
+    return bucket;
+  }
+
+  int exponent = bucket / HISTOGRAM_SUB_BUCKETS + HISTOGRAM_SUB_BITS - 1;
+  int sub = bucket % HISTOGRAM_SUB_BUCKETS;
+  return (int64_t)(HISTOGRAM_SUB_BUCKETS + sub) << (exponent - HISTOGRAM_SUB_BITS);
+}
+
+void histogram_record(histogram_t* histogram, int64_t value) {
+  if(value < 0) {
+    value = 0;
+  }
+
+  atomic_fetch_add_explicit(&histogram->counts[bucket_of(value)], 1, memory_order_relaxed);
+  atomic_fetch_add_explicit(&histogram->total, 1, memory_order_relaxed);
+
+  int64_t max = atomic_load_explicit(&histogram->max, memory_order_relaxed);
+  while(value > max && !atomic_compare_exchange_weak(&histogram->max, &max, value));
+}
+
+int64_t histogram_percentile(histogram_t* histogram, double percentile) {
+  uint64_t total = atomic_load(&histogram->total);
+  if(total == 0) {
+    return 0;
+  }
+
+  uint64_t target = (uint64_t)(percentile / 100.0 * total + 0.5);
+  if(target == 0) {
+    target = 1;
+  }
+
+  uint64_t count = 0;
+  for(int i=0; i<HISTOGRAM_BUCKETS; i++) {
+    count += atomic_load_explicit(&histogram->counts[i], memory_order_relaxed);
+    if(count >= total) {
+      return atomic_load(&histogram->max);
+    }
+    if(count >= target) {
+      return value_of(i);
+    }
+  }
+  return atomic_load(&histogram->max);
+}
+
+uint64_t histogram_count(histogram_t* histogram) {
+  return atomic_load(&histogram->total);
+}
+
+static void print_histogram(FILE* file, const char* sink, const char* name, histogram_t* histogram) {
+  fprintf(file, "latency %s %s count=%lu p50=%ldus p99=%ldus p999=%ldus max=%ldus\n", sink, name,
+    histogram_count(histogram),
+    histogram_percentile(histogram, 50),
+    histogram_percentile(histogram, 99),
+    histogram_percentile(histogram, 99.9),
+    atomic_load(&histogram->max));
+}
+
+void print_latency(latency_t* latency) {
+  for(int i=0; i<latency->number_sinks; i++) {
+    sink_latency_t* sink = latency->sinks[i];
+    print_histogram(latency->file, sink->name, "written", sink->written);
+    print_histogram(latency->file, sink->name, "flushed", sink->flushed);
+  }
+  fflush(latency->file);
+}
+
+static void* run_reporter(void* arg) {
+  latency_t* latency = arg;
+  pthread_mutex_lock(&latency->lock);
+  while(!latency->closed) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += latency->interval;
+    if(pthread_cond_timedwait(&latency->stop, &latency->lock, &deadline) != 0) {
+      print_latency(latency);
+    }
+  }
+  pthread_mutex_unlock(&latency->lock);
+  return NULL;
+}
+
+latency_t* create_latency(int interval, FILE* file) {
+  latency_t* latency = calloc(1, sizeof(latency_t));
+  latency->interval = interval;
+  latency->file = file;
+  pthread_mutex_init(&latency->lock, NULL);
+  pthread_cond_init(&latency->stop, NULL);
+  pthread_create(&latency->thread, NULL, run_reporter, latency);
+  return latency;
+}
+
+void delete_latency(latency_t* latency) {
+  pthread_mutex_lock(&latency->lock);
+  latency->closed = true;
+  pthread_cond_signal(&latency->stop);
+  pthread_mutex_unlock(&latency->lock);
+  pthread_join(latency->thread, NULL);
+
+  print_latency(latency);
+  pthread_cond_destroy(&latency->stop);
+  pthread_mutex_destroy(&latency->lock);
+  for(int i=0; i<latency->number_sinks; i++) {
+    delete_histogram(latency->sinks[i]->written);
+    delete_histogram(latency->sinks[i]->flushed);
+    free(latency->sinks[i]);
+  }
+  free(latency->sinks);
+  free(latency);
+}
+
+sink_latency_t* latency_add_sink(latency_t* latency, char* name) {
+  sink_latency_t* sink = malloc(sizeof(sink_latency_t));
+  sink->name = name;
+  sink->written = create_histogram();
+  sink->flushed = create_histogram();
+
+  pthread_mutex_lock(&latency->lock);
+  latency->sinks = realloc(latency->sinks, sizeof(sink_latency_t*)*(latency->number_sinks+1));
+  latency->sinks[latency->number_sinks++] = sink;
+  pthread_mutex_unlock(&latency->lock);
+  return sink;
+}
+
+// Microseconds since 2000-01-01, the epoch of PostgreSQL timestamps.
+int64_t postgres_now() {
+  struct timespec now;
+  clock_gettime(CLOCK_REALTIME, &now);
+  return now.tv_sec * 1000000LL + now.tv_nsec / 1000 - POSTGRES_EPOCH_USEC;
+}
+
+void format_timestamp(int64_t timestamp, char* buffer, size_t size) {
+  int64_t unix_usec = timestamp + POSTGRES_EPOCH_USEC;
+  time_t seconds = unix_usec / 1000000;
+  struct tm time;
+  gmtime_r(&seconds, &time);
+  size_t length = strftime(buffer, size, "%Y-%m-%dT%H:%M:%S", &time);
+  snprintf(buffer + length, size - length, ".%06ldZ", (long)(unix_usec % 1000000));
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+
+#define HISTOGRAM_SUB_BITS 5
+#define HISTOGRAM_SUB_BUCKETS (1 << HISTOGRAM_SUB_BITS)
+#define HISTOGRAM_BUCKETS ((64 - HISTOGRAM_SUB_BITS) * HISTOGRAM_SUB_BUCKETS)
+
+// Log-linear histogram of microseconds, about 3% precision, safe to record
+// from several threads.
+typedef struct {
+  atomic_uint_fast64_t counts[HISTOGRAM_BUCKETS];
+  atomic_uint_fast64_t total;
+  atomic_int_fast64_t max;
+} histogram_t;
+
+histogram_t* create_histogram();
+void delete_histogram(histogram_t* histogram);
+void histogram_record(histogram_t* histogram, int64_t value);
+int64_t histogram_percentile(histogram_t* histogram, double percentile);
+uint64_t histogram_count(histogram_t* histogram);
+
+// Delay from the commit on the source to the output being written and
+// flushed by one sink.
+typedef struct {
+  char* name;
+  histogram_t* written;
+  histogram_t* flushed;
+} sink_latency_t;
+
+// Delays of every tracked sink, reported together.
+typedef struct {
+  sink_latency_t** sinks;
+  int number_sinks;
+  int interval;
+  FILE* file;
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t stop;
+  bool closed;
+} latency_t;
+
+latency_t* create_latency(int interval, FILE* file);
+void delete_latency(latency_t* latency);
+sink_latency_t* latency_add_sink(latency_t* latency, char* name);
+void print_latency(latency_t* latency);
+
+int64_t postgres_now();
+void format_timestamp(int64_t timestamp, char* buffer, size_t size);
@@ -1,32 +1,58 @@
 #include <libpq-fe.h>
 #include <unistd.h>
+#include <poll.h>
+#include <time.h>
+#include <pthread.h>
+#include <signal.h>
 
 #include "options.h"
 #include "logging.h"
 #include "stream.h"
 #include "decoder.h"
-
-const int ERR_CONNECT = 1;
-const int ERR_QUERY = 2;
-const int ERR_FORMAT = 3;
-const int ERR_HANDLE = 4;
-
-const char* START_REPLICATION_COMMAND = "START_REPLICATION SLOT \"%s\" LOGICAL 0/0 (proto_version '1', publication_names '%s')";
+#include "queue.h"
+#include "handler.h"
+#include "sink.h"
+#include "connection.h"
+#include "snapshot.h"
+#include "latency.h"
+#include "monitor.h"
+#include "checksum.h"
+#include "receiver.h"
+#include "multiplex.h"
+
+const size_t KEEPALIVE_SIZE = 8+8+1;
+const int FEEDBACK_INTERVAL = 1;
+const int BEHIND_FEEDBACK_INTERVAL = 5;
+const int STATUS_INTERVAL = 10;
+const int POLL_TIMEOUT_MS = 1000;
+const int RECONNECT_BASE_DELAY_MS = 50;
+const int RECONNECT_MAX_DELAY_MS = 30000;
+const int RECONNECT_RESOLVE_ATTEMPTS = 3;
+const int RECONNECT_QUERY_ATTEMPTS = 5;
+
+typedef struct {
+  int64_t received;
+  int64_t received_lsn;
+  int64_t server_lsn;
+  int64_t reported;
+  time_t reported_at;
+  monitor_t* monitor;
+  receiver_t* receiver;
+} feedback_t;
+
+const char* START_STREAMING_REPLICATION_COMMAND = "START_REPLICATION SLOT \"%s\" LOGICAL %X/%X (proto_version '%d', streaming '%s', publication_names '%s')";
 const char* CREATE_REPLICATION_SLOT_COMMAND = "SELECT pg_create_logical_replication_slot('%s', 'pgoutput');";
 const char* DROP_REPLICATION_SLOT_COMMAND = "SELECT pg_drop_replication_slot('%s');";
 
-int update_status(PGconn *conn, int64_t wal, int64_t timestamp) {
+int update_status(PGconn *conn, receiver_t* receiver, int64_t wal, int64_t timestamp) {
   DEBUG("updating status: %ld", wal);
   int err;
-  char buffer[1+8+8+8+8+1];
-
-  stream_t* stream = create_stream(buffer, sizeof(buffer));
-  write_char(stream, 'r');
-  write_int64(stream, wal+1);
-  write_int64(stream, wal+1);
-  write_int64(stream, wal+1);
-  write_int64(stream, timestamp);
-  write_char(stream, 0);
+  char buffer[STANDBY_STATUS_SIZE];
+  write_standby_status(buffer, wal, timestamp);
+  if(receiver != NULL) {
+    return receiver_send(receiver, buffer, sizeof(buffer)) < 0 ? ERR_CONNECT : 0;
+  }
+
   err = PQputCopyData(conn, buffer, sizeof(buffer));
   if(err != PGRES_COMMAND_OK) {
     char *error = PQerrorMessage(conn);
@@ -34,84 +60,88 @@ int update_status(PGconn *conn, int64_t wal, int64_t timestamp) {
     return ERR_QUERY;
   }
   PQflush(conn);
-  delete_stream(stream);
+  return 0;
 }
 
-int handle_wal(PGconn *conn, stream_t *stream, FILE* file) {
-  int err;
-
-  DEBUG("handling wal");
-  skip_bytes(stream, 24); // Skip reading wal metadata
-
-  int32_t relation_id;
-  int16_t number_columns;
-  char operation = read_char(stream);
-  DEBUG("handling operation %c", operation);
-  switch (operation) {
-    case 'C':
-      commit_t* commit = parse_commit(stream);
-      if(commit == NULL) {
-        return ERR_HANDLE;
-      }
-
-      fflush(file);
-      update_status(conn, commit->lsn, commit->timestamp);
-      delete_commit(commit);
-      break;
-    case 'R':
-      relation_t* relation = parse_relation(stream);
-      print_relation(relation, file);
-      delete_relation(relation);
-      break;
-    case 'I':
-      insert_t* insert = parse_insert(stream);
-      print_insert(insert, file);
-      delete_insert(insert);
-      break;
-    case 'U':
-      update_t* update = parse_update(stream);
-      print_update(update, file);
-      delete_update(update);
-      break;
-    case 'D':
-      delete_t* delete = parse_delete(stream);
-      print_delete(delete, file);
-      delete_delete(delete);
-      break;
-    default:
-      DEBUG("unknown operation: %c", operation);
+int send_feedback(PGconn *conn, handler_t* handler, feedback_t* feedback, bool force) {
+  int64_t lsn = handler_feedback_lsn(handler, feedback->received, feedback->server_lsn);
+  time_t now = time(NULL);
+  int interval = monitor_behind(feedback->monitor) ? BEHIND_FEEDBACK_INTERVAL : FEEDBACK_INTERVAL;
+  bool advanced = lsn > feedback->reported && now - feedback->reported_at >= interval;
+  if(!force && !advanced && now - feedback->reported_at < STATUS_INTERVAL) {
+    return 0;
   }
+
+  feedback->reported = lsn;
+  feedback->reported_at = now;
+  return update_status(conn, feedback->receiver, lsn, postgres_now());
 }
 
-void handle_keepalive(PGconn *conn, stream_t *stream) {
+void handle_keepalive(PGconn *conn, stream_t *stream, handler_t* handler, feedback_t* feedback) {
   DEBUG("handling keep alive");
-  int64_t wal = read_int64(stream);
-  int64_t timestamp = read_int64(stream);
-  char ops = read_char(stream);
-  if(ops == 1) {
-    update_status(conn, wal, timestamp);
+  if(stream_remaining(stream) < KEEPALIVE_SIZE) {
+    ERROR("malformed keepalive message");
+    return;
   }
+
+  feedback->server_lsn = read_int64(stream);
+  read_int64(stream); // server timestamp
+  char ops = read_char(stream);
+  send_feedback(conn, handler, feedback, ops == 1);
 }
 
-int create_connection(PGconn **conn, options_t options){
-  char conn_str[1024];
-  int conn_str_err = sprintf(conn_str, "replication=database dbname=%s user=%s password=%s host=%s port=%s", options.dbname, options.user, options.password, options.host, options.port);
-  if(conn_str_err <= 0) {
-    ERROR("failed to format connection");
-    return ERR_FORMAT;
+int wait_socket(PGconn *conn) {
+  struct pollfd fd = { .fd = PQsocket(conn), .events = POLLIN };
+  poll(&fd, 1, POLL_TIMEOUT_MS);
+  if(PQconsumeInput(conn) == 0) {
+    ERROR("failed to read connection: %s", PQerrorMessage(conn));
+    return ERR_CONNECT;
   }
+  return 0;
+}
 
-  INFO("establishing connection: %s", conn_str);
-  *conn = PQconnectdb(conn_str);
-
-  if (PQstatus(*conn) != CONNECTION_OK) {
-    ERROR("connection failure");
-    return ERR_CONNECT;
+// Keeps the commit position of the last fully received transaction, so that
+// streaming resumes after it when the connection is established again.
+void track_commit(feedback_t* feedback, stream_t stream) {
+  if(stream_remaining(&stream) < 8+8+8+1+4+1+8) {
+    return;
   }
 
-  return 0;
+  skip_bytes(&stream, 8+8+8);
+  switch(read_char(&stream)) {
+    case 'C':
+      skip_bytes(&stream, 1);
+      feedback->received_lsn = read_int64(&stream);
+      break;
+    case 'c':
+      skip_bytes(&stream, 4+1);
+      feedback->received_lsn = read_int64(&stream);
+      break;
+  }
 }
 
+// Connects again with jittered exponential backoff. The address resolved by the
+// first connection is reused to skip name resolution, unless it keeps failing.
+int reconnect(PGconn **conn, options_t options, char* hostaddr) {
+  for(int attempt = 0; ; attempt++) {
+    int delay = RECONNECT_MAX_DELAY_MS;
+    if(attempt < 20) {
+      delay = RECONNECT_BASE_DELAY_MS << attempt;
+      if(delay > RECONNECT_MAX_DELAY_MS) {
+        delay = RECONNECT_MAX_DELAY_MS;
+      }
+    }
+    delay = random() % (delay + 1);
+
+    INFO("reconnecting in %d ms", delay);
+    usleep(delay * 1000);
+
+    PQfinish(*conn);
+    if(create_connection(conn, options, attempt < RECONNECT_RESOLVE_ATTEMPTS ? hostaddr : NULL) == 0) {
+      return 0;
+    }
+  }
+}
 
 int install(PGconn *conn, char* slotname) {
   INFO("starting install");
@@ -158,48 +188,110 @@ int uninstall(PGconn *conn, char* slotname) {
   return 0;
 }
 
-int watch(PGconn *conn, FILE *file, char* slotname, char* publication) {
+int watch(PGconn *conn, options_t* options, handler_t* handler, queue_t* queue, feedback_t* feedback) {
   int err;
   char query[1024];
   char* buffer;
   int buffer_size;
   PGresult *result;
+  receiver_t* receiver = feedback->receiver;
+  void (*release)(void*) = receiver != NULL ? release_received : PQfreemem;
 
   INFO("watching changes");
-  fprintf(file, "---\n");
   while (1) {
-    err = sprintf(query, START_REPLICATION_COMMAND, slotname, publication);
+    int64_t start_lsn = feedback->received_lsn > 0 ? feedback->received_lsn + 1 : 0;
+    if(options->streaming == NULL) {
+      err = sprintf(query, START_REPLICATION_COMMAND, options->slotname,
+        (uint32_t)(start_lsn >> 32), (uint32_t)start_lsn, options->publication);
+    } else {
+      int version = strcmp(options->streaming, "parallel") == 0 ? 4 : 2;
+      err = sprintf(query, START_STREAMING_REPLICATION_COMMAND, options->slotname,
+        (uint32_t)(start_lsn >> 32), (uint32_t)start_lsn, version, options->streaming, options->publication);
+    }
     if(err < 0) {
       ERROR("format query replication error");
       return ERR_FORMAT;
     }
 
-    result = PQexec(conn, query);
-    err = PQresultStatus(result);
+    if(receiver != NULL && receiver_start(receiver, PQsocket(conn), query) < 0) {
+      return ERR_QUERY;
+    }
 
-    DEBUG("query return code: %d", err);
+    if(receiver == NULL) {
+      result = PQexec(conn, query);
+      err = PQresultStatus(result);
 
-    if(err == PGRES_FATAL_ERROR) {
-      char *error = PQerrorMessage(conn);
-      ERROR("fatal error: %s", error);
-      return ERR_QUERY;
+      DEBUG("query return code: %d", err);
+
+      if(err == PGRES_FATAL_ERROR) {
+        char *error = PQerrorMessage(conn);
+        ERROR("fatal error: %s", error);
+        return ERR_QUERY;
+      }
     }
 
-    while(buffer_size = PQgetCopyData(conn, &buffer, 0) > 0) {
-      stream_t *stream = create_stream(buffer, buffer_size);
-      switch(read_char(stream)) {
-        case 'w':
-          handle_wal(conn, stream, file);
+    counter_sample_t sample;
+    while(1) {
+      counters_begin(handler->counters, &sample);
+      if(receiver != NULL) {
+        buffer_size = receiver_next(receiver, &buffer, POLL_TIMEOUT_MS);
+      } else {
+        buffer_size = PQgetCopyData(conn, &buffer, 1);
+      }
+      if(buffer_size < 0) {
+        break;
+      }
+
+      if(buffer_size == 0) {
+        send_feedback(conn, handler, feedback, false);
+        if(receiver == NULL && wait_socket(conn) > 0) {
           break;
+        }
+        continue;
+      }
+
+      stream_t stream;
+      init_stream(&stream, buffer, buffer_size);
+      switch(read_char(&stream)) {
+        case 'w':
+          if(sinks_failed(handler->sinks)) {
+            ERROR("sink failed");
+            release(buffer);
+            return ERR_HANDLE;
+          }
+          if(queue_failed(queue)) {
+            ERROR("queue failed");
+            release(buffer);
+            return ERR_HANDLE;
+          }
+
+          feedback->received++;
+          track_commit(feedback, stream);
+          char operation = buffer_size > 1+8+8+8 ? buffer[1+8+8+8] : 0;
+          if(queue_push(queue, buffer, buffer_size, release) != 0) {
+            ERROR("failed to queue frame");
+            return ERR_HANDLE;
+          }
+          counters_end(handler->counters, &sample, operation, STAGE_RECEIVE);
+          continue;
         case 'k':
-          handle_keepalive(conn, stream);
+          handle_keepalive(conn, &stream, handler, feedback);
           break;
         default:
-          DEBUG("buffer input not parsed: %s", buffer);
+          DEBUG("buffer input not parsed: %c", buffer[0]);
       }
 
-      delete_stream(stream);
-      PQfreemem(buffer);
+      release(buffer);
+    }
+
+    // libpq never saw the copy start, so the connection can not be reused.
+    if(receiver != NULL) {
+      return ERR_CONNECT;
+    }
+
+    if(PQstatus(conn) == CONNECTION_BAD) {
+      ERROR("connection lost: %s", PQerrorMessage(conn));
+      return ERR_CONNECT;
     }
 
     result = PQgetResult(conn);
@@ -212,6 +304,56 @@ int watch(PGconn *conn, FILE *file, char* slotname, char* publication) {
   }
 }
 
+// Each partition is written by the sink of the same index. A single sink
+// with %d in its spec is expanded to one sink per partition.
+int partition_sinks(options_t* options) {
+  if(options->partitions <= 0) {
+    return 0;
+  }
+
+  if(options->partitions > MAX_SINKS || options->compact_window > 0 || options->compact_lsn > 0) {
+    ERROR("partitions must be at most %d and can not be compacted", MAX_SINKS);
+    return ERR_FORMAT;
+  }
+
+  if(options->streaming != NULL) {
+    ERROR("partitions can not be combined with streaming");
+    return ERR_FORMAT;
+  }
+
+  if(options->number_sinks == 1 && strstr(options->sinks[0], "%d") != NULL) {
+    char* pattern = options->sinks[0];
+    int prefix = strstr(pattern, "%d") - pattern;
+    for(int i=0; i<options->partitions; i++) {
+      options->sinks[i] = malloc(strlen(pattern) + 16);
+      sprintf(options->sinks[i], "%.*s%d%s", prefix, pattern, i, pattern + prefix + 2);
+    }
+    options->number_sinks = options->partitions;
+  }
+
+  if(options->number_sinks != options->partitions) {
+    ERROR("partitions need one sink each or a sink with %%d");
+    return ERR_FORMAT;
+  }
+  return 0;
+}
+
+// Mirror dumped on SIGUSR1.
+static mirror_t* dumped_mirror = NULL;
+
+static void request_mirror_dump(int sig) {
+  (void)sig;
+  mirror_request_dump(dumped_mirror);
+}
+
+// Stats dumped on SIGUSR2.
+static stats_t* dumped_stats = NULL;
+
+static void request_stats_dump(int sig) {
+  (void)sig;
+  stats_request_dump(dumped_stats);
+}
+
 int main(int argc, char *argv[]) {
   int err;
   FILE *file;
@@ -222,15 +364,48 @@ int main(int argc, char *argv[]) {
   INFO("=======================\n");
 
   options = parse_options(argc, argv);
+  if(options.streaming != NULL && strcmp(options.streaming, "on") != 0 && strcmp(options.streaming, "parallel") != 0) {
+    ERROR("streaming must be on or parallel");
+    return ERR_FORMAT;
+  }
+
+  if(options.streaming != NULL && (options.number_mirrors > 0 || options.arrow_dir != NULL)) {
+    ERROR("mirrors and arrow output can not be combined with streaming");
+    return ERR_FORMAT;
+  }
 
-  err = create_connection(&conn, options);
+  if(options.verify != NULL) {
+    return verify_checksums(options.verify);
+  }
+
+  if(options.tenants != NULL) {
+    multiplexer_t* multiplexer = create_multiplexer(&options, options.tenants);
+    if(multiplexer == NULL) {
+      return ERR_FORMAT;
+    }
+    signal(SIGPIPE, SIG_IGN);
+    srandom(time(NULL) ^ getpid());
+    err = run_multiplexer(multiplexer);
+    delete_multiplexer(multiplexer);
+    return err < 0 ? ERR_CONNECT : 0;
+  }
+
+  char* sink_pattern = options.sinks[0];
+  err = partition_sinks(&options);
+  if(err > 0) {
+    return err;
+  }
+  bool expanded_sinks = options.sinks[0] != sink_pattern;
+
+  err = create_connection(&conn, options, NULL);
   if(err > 0) {
     return err;
   }
 
   INFO("database connected");
+  char* hostaddr = strdup(PQhostaddr(conn) != NULL ? PQhostaddr(conn) : "");
 
-  if(options.install) {
+  if(options.install && options.snapshot == 0) {
     return install(conn, options.slotname);
   }
 
@@ -238,8 +413,106 @@ int main(int argc, char *argv[]) {
     return uninstall(conn, options.slotname);
   }
 
-  err = watch(conn, stdout, options.slotname, options.publication);
+  signal(SIGPIPE, SIG_IGN);
+  sinks_t* sinks = create_sinks(options.sinks, options.number_sinks, &options);
+  if(sinks == NULL) {
+    return ERR_HANDLE;
+  }
+
+  latency_t* latency = NULL;
+  if(options.latency_report > 0) {
+    latency = create_latency(options.latency_report, stderr);
+    sinks_track_latency(sinks, latency);
+  }
+
+  queue_policy_t policy = strcmp(options.queue_full, "spill") == 0 ? QUEUE_SPILL : QUEUE_BLOCK;
+  queue_t* queue = create_queue(options.queue_size, policy, options.spill_dir);
+  handler_t* handler = create_handler(sinks, queue, &options);
+  if(options.counters_report > 0) {
+    handler->counters = create_counters(options.counters_report, stderr);
+  }
+  if(handler->mirror != NULL) {
+    dumped_mirror = handler->mirror;
+    signal(SIGUSR1, request_mirror_dump);
+  }
+  if(handler->stats != NULL) {
+    dumped_stats = handler->stats;
+    signal(SIGUSR2, request_stats_dump);
+  }
+
+  if(options.install) {
+    err = install_snapshot(conn, &options, sinks, handler->mirror, handler->relations);
+    if(err > 0) {
+      close_sinks(sinks);
+      return err;
+    }
+  }
+
+  pthread_t writer;
+  pthread_create(&writer, NULL, run_handler, handler);
+
+  feedback_t feedback = { 0 };
+  if(options.lag_interval > 0) {
+    feedback.monitor = create_monitor(&options, handler);
+  }
+  if(options.receive_buffer > 0 && (PQsslInUse(conn) || PQgssEncInUse(conn))) {
+    INFO("receiving through libpq on an encrypted connection");
+  } else if(options.receive_buffer > 0) {
+    feedback.receiver = create_receiver(options.receive_buffer);
+  }
+  srandom(time(NULL) ^ getpid());
+  int query_errors = 0;
+  while(1) {
+    int64_t received = feedback.received;
+    err = watch(conn, &options, handler, queue, &feedback);
+    if(!options.reconnect || (err != ERR_CONNECT && err != ERR_QUERY)) {
+      break;
+    }
+
+    // A query failing again before anything is received, like a missing
+    // slot or publication, will not be fixed by reconnecting.
+    query_errors = err == ERR_QUERY && feedback.received == received ? query_errors + 1 : 0;
+    if(query_errors >= RECONNECT_QUERY_ATTEMPTS) {
+      ERROR("giving up after %d failed queries", query_errors);
+      break;
+    }
 
+    reconnect(&conn, options, hostaddr);
+    feedback.reported_at = 0;
+    if(options.streaming != NULL) {
+      feedback.received++;
+      if(queue_push(queue, strdup("x"), 1, free) != 0) {
+        err = ERR_HANDLE;
+        break;
+      }
+    }
+  }
+
+  if(feedback.monitor != NULL) {
+    delete_monitor(feedback.monitor);
+  }
+  queue_close(queue);
+  pthread_join(writer, NULL);
+  if(err == 0 && queue_failed(queue)) {
+    err = ERR_HANDLE;
+  }
+  close_sinks(sinks);
+  if(handler->counters != NULL) {
+    delete_counters(handler->counters);
+  }
+  delete_handler(handler);
+  delete_queue(queue);
+  if(feedback.receiver != NULL) {
+    delete_receiver(feedback.receiver);
+  }
+  delete_sinks(sinks);
+  for(int i=0; expanded_sinks && i<options.number_sinks; i++) {
+    free(options.sinks[i]);
+  }
+  if(latency != NULL) {
+    delete_latency(latency);
+  }
+  free(hostaddr);
   PQfinish(conn);
   fclose(stdout);
   return err;
@@ -0,0 +1,378 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "logging.h"
+#include "mirror.h"
+
+const size_t MIRROR_CHUNK_SIZE = 1024*1024;
+const int MIRROR_POLL_MS = 1000;
+
+mirror_t* create_mirror(char** tables, int number_tables, char* path, int interval) {
+  mirror_t* mirror = calloc(1, sizeof(mirror_t));
+  mirror->tables = tables;
+  mirror->number_tables = number_tables;
+  mirror->relation_ids = calloc(MAX_TABLES, sizeof(int64_t));
+  mirror->number_buckets = 1024;
+  mirror->buckets = calloc(mirror->number_buckets, sizeof(mirror_row_t*));
+  mirror->path = path;
+  mirror->interval = interval;
+  clock_gettime(CLOCK_MONOTONIC, &mirror->dumped_at);
+  atomic_init(&mirror->requested, false);
+  return mirror;
+}
+
+static void delete_chunks(mirror_chunk_t* chunk) {
+  while(chunk != NULL) {
+    mirror_chunk_t* next = chunk->next;
+    free(chunk);
+    chunk = next;
+  }
+}
+
+static void wait_dump(mirror_t* mirror, int flags) {
+  int status;
+  if(mirror->child <= 0 || waitpid(mirror->child, &status, flags) == 0) {
+    return;
+  }
+
+  if(!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+    ERROR("mirror dump to %s failed", mirror->path);
+  }
+  mirror->child = 0;
+}
+
+void delete_mirror(mirror_t* mirror) {
+  wait_dump(mirror, 0);
+  delete_chunks(mirror->chunks);
+  free(mirror->buckets);
+  free(mirror->relation_ids);
+  free(mirror);
+}
+
+// Tables are selected by their qualified name when the relation is received.
+void mirror_relation(mirror_t* mirror, relation_t* relation) {
+  for(int i=0; i<mirror->number_relations; i++) {
+    if(mirror->relation_ids[i] == relation->id) {
+      return;
+    }
+  }
+
+  if(relation_selected(relation, mirror->tables, mirror->number_tables) && mirror->number_relations < MAX_TABLES) {
+    mirror->relation_ids[mirror->number_relations++] = relation->id;
+  }
+}
+
+static bool mirrored(mirror_t* mirror, relation_t* relation) {
+  for(int i=0; relation != NULL && i<mirror->number_relations; i++) {
+    if(mirror->relation_ids[i] == relation->id) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static size_t row_bytes(size_t size) {
+  return (sizeof(mirror_row_t) + size + 7) & ~(size_t)7;
+}
+
+static mirror_row_t* allocate_row(mirror_t* mirror, size_t size) {
+  size_t bytes = row_bytes(size);
+  mirror_chunk_t* chunk = mirror->chunks;
+  if(chunk == NULL || chunk->capacity - chunk->used < bytes) {
+    size_t capacity = bytes > MIRROR_CHUNK_SIZE ? bytes : MIRROR_CHUNK_SIZE;
+    chunk = malloc(sizeof(mirror_chunk_t) + capacity);
+    chunk->used = 0;
+    chunk->capacity = capacity;
+    chunk->next = mirror->chunks;
+    mirror->chunks = chunk;
+  }
+
+  mirror_row_t* row = (mirror_row_t*)(chunk->data + chunk->used);
+  chunk->used += bytes;
+  mirror->bytes += bytes;
+  return row;
+}
+
+static char* next_value(char* value) {
+  return *value == 't' ? value + 1 + strlen(value + 1) + 1 : value + 1;
+}
+
+static mirror_row_t** find_row(mirror_t* mirror, int64_t relation_id, uint64_t hash, char* key, size_t key_size) {
+  mirror_row_t** slot = &mirror->buckets[hash % mirror->number_buckets];
+  for(; *slot != NULL; slot = &(*slot)->bucket_next) {
+    mirror_row_t* row = *slot;
+    if(row->hash == hash && row->relation_id == relation_id
+        && row->key_size == key_size && memcmp(row->data, key, key_size) == 0) {
+      return slot;
+    }
+  }
+  return slot;
+}
+
+static void remove_row(mirror_t* mirror, mirror_row_t** slot) {
+  mirror_row_t* row = *slot;
+  *slot = row->bucket_next;
+  mirror->garbage += row_bytes(row->size);
+  mirror->size--;
+}
+
+static void link_row(mirror_row_t** buckets, size_t number_buckets, mirror_row_t* row) {
+  mirror_row_t** slot = &buckets[row->hash % number_buckets];
+  row->bucket_next = *slot;
+  *slot = row;
+}
+
+static void grow_buckets(mirror_t* mirror) {
+  size_t number_buckets = mirror->number_buckets * 2;
+  mirror_row_t** buckets = calloc(number_buckets, sizeof(mirror_row_t*));
+  for(size_t i=0; i<mirror->number_buckets; i++) {
+    mirror_row_t* row = mirror->buckets[i];
+    while(row != NULL) {
+      mirror_row_t* next = row->bucket_next;
+      link_row(buckets, number_buckets, row);
+      row = next;
+    }
+  }
+  free(mirror->buckets);
+  mirror->buckets = buckets;
+  mirror->number_buckets = number_buckets;
+}
+
+// Copies the live rows into a new arena once most of it is garbage.
+static void collect_garbage(mirror_t* mirror) {
+  if(mirror->garbage < MIRROR_CHUNK_SIZE || mirror->garbage < mirror->bytes / 2) {
+    return;
+  }
+
+  mirror_chunk_t* chunks = mirror->chunks;
+  mirror->chunks = NULL;
+  mirror->bytes = 0;
+  mirror->garbage = 0;
+  for(size_t i=0; i<mirror->number_buckets; i++) {
+    mirror_row_t* row = mirror->buckets[i];
+    mirror_row_t** slot = &mirror->buckets[i];
+    for(; row != NULL; row = row->bucket_next) {
+      mirror_row_t* copy = allocate_row(mirror, row->size);
+      memcpy(copy, row, sizeof(mirror_row_t) + row->size);
+      *slot = copy;
+      slot = &copy->bucket_next;
+    }
+  }
+  delete_chunks(chunks);
+}
+
+// Stores the row under key, taking unchanged toasted values from the
+// previous image of the row.
+static void store(mirror_t* mirror, relation_t* relation, tuples_t* data, char* key, size_t key_size, mirror_row_t* previous) {
+  char* previous_value = NULL;
+  if(previous != NULL && previous->number_values == data->size) {
+    previous_value = previous->data + previous->key_size;
+  }
+
+  size_t size = key_size;
+  char* value = previous_value;
+  for(int i=0; i<data->size; i++) {
+    if(data->values[i] == UNCHANGED_STR && value != NULL) {
+      size += next_value(value) - value;
+    } else {
+      size += 1 + (is_static_tuple(data->values[i]) ? 0 : strlen(data->values[i]) + 1);
+    }
+    value = value != NULL ? next_value(value) : NULL;
+  }
+
+  mirror_row_t* row = allocate_row(mirror, size);
+  row->hash = hash_relation_key(relation->id, key, key_size);
+  row->relation_id = relation->id;
+  row->key_size = key_size;
+  row->size = size;
+  row->number_values = data->size;
+  memcpy(row->data, key, key_size);
+
+  char* current = row->data + key_size;
+  value = previous_value;
+  for(int i=0; i<data->size; i++) {
+    char* tuple = data->values[i];
+    if(tuple == UNCHANGED_STR && value != NULL) {
+      memcpy(current, value, next_value(value) - value);
+      current += next_value(value) - value;
+    } else if(is_static_tuple(tuple)) {
+      *current++ = tuple == NULL_STR ? 'n' : 'u';
+    } else {
+      *current++ = 't';
+      size_t length = strlen(tuple) + 1;
+      memcpy(current, tuple, length);
+      current += length;
+    }
+    value = value != NULL ? next_value(value) : NULL;
+  }
+
+  mirror_row_t** slot = find_row(mirror, relation->id, row->hash, key, key_size);
+  if(*slot != NULL) {
+    remove_row(mirror, slot);
+  }
+  link_row(mirror->buckets, mirror->number_buckets, row);
+  mirror->size++;
+  if(mirror->size > mirror->number_buckets) {
+    grow_buckets(mirror);
+  }
+}
+
+void mirror_insert(mirror_t* mirror, relation_t* relation, tuples_t* data) {
+  size_t key_size;
+  char* key = mirrored(mirror, relation) ? relation_key(relation, data, &key_size) : NULL;
+  if(key == NULL) {
+    return;
+  }
+
+  store(mirror, relation, data, key, key_size, NULL);
+  free(key);
+  collect_garbage(mirror);
+}
+
+void mirror_update(mirror_t* mirror, relation_t* relation, tuples_t* from, tuples_t* to) {
+  size_t key_size;
+  char* key = mirrored(mirror, relation) ? relation_key(relation, from != NULL ? from : to, &key_size) : NULL;
+  if(key == NULL) {
+    return;
+  }
+
+  uint64_t hash = hash_relation_key(relation->id, key, key_size);
+  mirror_row_t** slot = find_row(mirror, relation->id, hash, key, key_size);
+  mirror_row_t* previous = *slot;
+  if(previous != NULL) {
+    remove_row(mirror, slot);
+  }
+
+  size_t new_key_size;
+  char* new_key = relation_key(relation, to, &new_key_size);
+  if(new_key != NULL) {
+    store(mirror, relation, to, new_key, new_key_size, previous);
+    free(new_key);
+  } else {
+    store(mirror, relation, to, key, key_size, previous);
+  }
+  free(key);
+  collect_garbage(mirror);
+}
+
+void mirror_delete(mirror_t* mirror, relation_t* relation, tuples_t* data) {
+  size_t key_size;
+  char* key = mirrored(mirror, relation) ? relation_key(relation, data, &key_size) : NULL;
+  if(key == NULL) {
+    return;
+  }
+
+  uint64_t hash = hash_relation_key(relation->id, key, key_size);
+  mirror_row_t** slot = find_row(mirror, relation->id, hash, key, key_size);
+  if(*slot != NULL) {
+    remove_row(mirror, slot);
+  }
+  free(key);
+  collect_garbage(mirror);
+}
+
+static void print_row(mirror_row_t* row, FILE* file) {
+  fprintf(file, "relation_id: %ld\n", row->relation_id);
+  fprintf(file, "operation: insert\n");
+  fprintf(file, "data:\n");
+  char* value = row->data + row->key_size;
+  for(int i=0; i<row->number_values; i++) {
+    char* tuple = *value == 't' ? value + 1 : (char*)(*value == 'n' ? NULL_STR : UNCHANGED_STR);
+    fprintf(file, "  - %s\n", tuple);
+    value = next_value(value);
+  }
+  fprintf(file, "---\n");
+}
+
+// Writes each mirrored table as its relation followed by an insert of every
+// row, the documents a consumer of the stream would apply up to lsn.
+int write_mirror(mirror_t* mirror, relations_t* relations, int64_t lsn, FILE* file) {
+  fprintf(file, "---\nmirror_lsn: %X/%X\n---\n", (uint32_t)(lsn >> 32), (uint32_t)lsn);
+  for(int i=0; i<mirror->number_relations; i++) {
+    relation_t* relation = get_relation(relations, mirror->relation_ids[i]);
+    if(relation != NULL) {
+      print_relation(relation, file);
+    }
+
+    for(size_t j=0; j<mirror->number_buckets; j++) {
+      for(mirror_row_t* row = mirror->buckets[j]; row != NULL; row = row->bucket_next) {
+        if(row->relation_id == mirror->relation_ids[i]) {
+          print_row(row, file);
+        }
+      }
+    }
+  }
+  return ferror(file) ? FAILED : OK;
+}
+
+static int dump_file(mirror_t* mirror, relations_t* relations, int64_t lsn) {
+  char path[4096];
+  snprintf(path, sizeof(path), "%s.tmp", mirror->path);
+  FILE* file = fopen(path, "w");
+  if(file == NULL) {
+    return FAILED;
+  }
+
+  int err = write_mirror(mirror, relations, lsn, file);
+  if(fflush(file) != 0 || fdatasync(fileno(file)) != 0) {
+    err = FAILED;
+  }
+  if(fclose(file) != 0 || err != OK) {
+    return FAILED;
+  }
+  return rename(path, mirror->path) == 0 ? OK : FAILED;
+}
+
+// Safe to call from a signal handler.
+void mirror_request_dump(mirror_t* mirror) {
+  atomic_store(&mirror->requested, true);
+}
+
+// Time until the next dump is due, bounded so that requests are noticed
+// while the stream is idle.
+int mirror_remaining_ms(mirror_t* mirror) {
+  if(atomic_load(&mirror->requested)) {
+    return 0;
+  }
+
+  if(mirror->interval <= 0) {
+    return MIRROR_POLL_MS;
+  }
+
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  long elapsed = (now.tv_sec - mirror->dumped_at.tv_sec) * 1000 + (now.tv_nsec - mirror->dumped_at.tv_nsec) / 1000000;
+  long remaining = mirror->interval * 1000L - elapsed;
+  if(remaining <= 0) {
+    return 0;
+  }
+  return remaining < MIRROR_POLL_MS ? remaining : MIRROR_POLL_MS;
+}
+
+// Dumps the mirror as of lsn from a forked child, which keeps a copy on
+// write image of it, so replication goes on while the dump is written. The
+// other threads are not in the child, so it only allocates and writes its own
+// file, which glibc keeps usable after fork, and must not log or touch the
+// streams of the sinks.
+void mirror_dump(mirror_t* mirror, relations_t* relations, int64_t lsn) {
+  atomic_store(&mirror->requested, false);
+  clock_gettime(CLOCK_MONOTONIC, &mirror->dumped_at);
+  wait_dump(mirror, WNOHANG);
+  if(mirror->child > 0) {
+    INFO("mirror dump still running, skipped");
+    return;
+  }
+
+  pid_t pid = fork();
+  if(pid == 0) {
+    _exit(dump_file(mirror, relations, lsn));
+  }
+
+  if(pid < 0) {
+    ERROR("mirror dump failed to fork");
+    return;
+  }
+  mirror->child = pid;
+  INFO("dumping mirror at %X/%X to %s", (uint32_t)(lsn >> 32), (uint32_t)lsn, mirror->path);
+}
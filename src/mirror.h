@@ -0,0 +1,63 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <time.h>
+#include <sys/types.h>
+#include "decoder.h"
+#include "relations.h"
+#include "options.h"
+
+// Current image of a row. The key is followed by each value as a tag, 't'
+// for text, 'n' for null or 'u' for an unknown toasted value, and the text
+// of 't' values with its terminating NUL.
+typedef struct mirror_row_s {
+  struct mirror_row_s* bucket_next;
+  uint64_t hash;
+  int64_t relation_id;
+  uint32_t key_size;
+  uint32_t size;
+  int16_t number_values;
+  char data[];
+} mirror_row_t;
+
+typedef struct mirror_chunk_s {
+  struct mirror_chunk_s* next;
+  size_t used;
+  size_t capacity;
+  char data[];
+} mirror_chunk_t;
+
+// Rows of the selected tables by relation and replica identity key, stored
+// in an arena of chunks. Replaced rows stay in the arena until their garbage
+// outweighs the live rows and the arena is copied.
+typedef struct {
+  char** tables;
+  int number_tables;
+  int64_t* relation_ids;
+  int number_relations;
+  mirror_row_t** buckets;
+  size_t number_buckets;
+  size_t size;
+  mirror_chunk_t* chunks;
+  size_t bytes;
+  size_t garbage;
+  char* path;
+  int interval;
+  struct timespec dumped_at;
+  atomic_bool requested;
+  pid_t child;
+} mirror_t;
+
+mirror_t* create_mirror(char** tables, int number_tables, char* path, int interval);
+void delete_mirror(mirror_t* mirror);
+void mirror_relation(mirror_t* mirror, relation_t* relation);
+void mirror_insert(mirror_t* mirror, relation_t* relation, tuples_t* data);
+void mirror_update(mirror_t* mirror, relation_t* relation, tuples_t* from, tuples_t* to);
+void mirror_delete(mirror_t* mirror, relation_t* relation, tuples_t* data);
+void mirror_request_dump(mirror_t* mirror);
+int mirror_remaining_ms(mirror_t* mirror);
+void mirror_dump(mirror_t* mirror, relations_t* relations, int64_t lsn);
+int write_mirror(mirror_t* mirror, relations_t* relations, int64_t lsn, FILE* file);
@@ -0,0 +1,103 @@
+#include <stdlib.h>
+#include <time.h>
+#include "logging.h"
+#include "connection.h"
+#include "monitor.h"
+
+const char* SLOT_LAG_QUERY = "SELECT pg_current_wal_lsn() - restart_lsn, pg_current_wal_lsn() - confirmed_flush_lsn "
+  "FROM pg_replication_slots WHERE slot_name = $1";
+
+// Queries the slot once and updates the batching of the handler. The slot is
+// behind above the threshold and caught up again below half of it.
+int monitor_check(monitor_t* monitor) {
+  if(PQstatus(monitor->conn) != CONNECTION_OK) {
+    PQreset(monitor->conn);
+  }
+
+  const char* params[] = { monitor->slotname };
+  PGresult* result = PQexecParams(monitor->conn, SLOT_LAG_QUERY, 1, NULL, params, NULL, NULL, 0);
+  if(PQresultStatus(result) != PGRES_TUPLES_OK || PQntuples(result) != 1) {
+    ERROR("failed to query slot lag: %s", PQerrorMessage(monitor->conn));
+    PQclear(result);
+    return ERR_QUERY;
+  }
+
+  int64_t retained = atoll(PQgetvalue(result, 0, 0));
+  int64_t lag = atoll(PQgetvalue(result, 0, 1));
+  PQclear(result);
+  atomic_store(&monitor->retained, retained);
+  atomic_store(&monitor->lag, lag);
+
+  bool behind = atomic_load(&monitor->behind);
+  if(!behind && lag > monitor->threshold) {
+    behind = true;
+  } else if(behind && lag < monitor->threshold / 2) {
+    behind = false;
+  }
+
+  if(behind != atomic_load(&monitor->behind)) {
+    INFO("slot %s is %s", monitor->slotname, behind ? "behind, batching" : "caught up");
+    atomic_store(&monitor->behind, behind);
+    if(monitor->handler != NULL) {
+      handler_set_batching(monitor->handler, behind);
+    }
+  }
+
+  INFO("slot %s retains %ld bytes, lag %ld bytes", monitor->slotname, retained, lag);
+  return 0;
+}
+
+static void* run_monitor(void* arg) {
+  monitor_t* monitor = arg;
+  pthread_mutex_lock(&monitor->lock);
+  while(!monitor->closed) {
+    pthread_mutex_unlock(&monitor->lock);
+    monitor_check(monitor);
+    pthread_mutex_lock(&monitor->lock);
+
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += monitor->interval;
+    while(!monitor->closed && pthread_cond_timedwait(&monitor->stop, &monitor->lock, &deadline) == 0);
+  }
+  pthread_mutex_unlock(&monitor->lock);
+  return NULL;
+}
+
+monitor_t* create_monitor(options_t* options, handler_t* handler) {
+  monitor_t* monitor = calloc(1, sizeof(monitor_t));
+  if(create_database_connection(&monitor->conn, *options) > 0) {
+    PQfinish(monitor->conn);
+    free(monitor);
+    return NULL;
+  }
+
+  monitor->slotname = options->slotname;
+  monitor->interval = options->lag_interval;
+  monitor->threshold = options->lag_threshold;
+  monitor->handler = handler;
+  atomic_init(&monitor->retained, 0);
+  atomic_init(&monitor->lag, 0);
+  atomic_init(&monitor->behind, false);
+  pthread_mutex_init(&monitor->lock, NULL);
+  pthread_cond_init(&monitor->stop, NULL);
+  pthread_create(&monitor->thread, NULL, run_monitor, monitor);
+  return monitor;
+}
+
+void delete_monitor(monitor_t* monitor) {
+  pthread_mutex_lock(&monitor->lock);
+  monitor->closed = true;
+  pthread_cond_signal(&monitor->stop);
+  pthread_mutex_unlock(&monitor->lock);
+  pthread_join(monitor->thread, NULL);
+
+  pthread_cond_destroy(&monitor->stop);
+  pthread_mutex_destroy(&monitor->lock);
+  PQfinish(monitor->conn);
+  free(monitor);
+}
+
+bool monitor_behind(monitor_t* monitor) {
+  return monitor != NULL && atomic_load(&monitor->behind);
+}
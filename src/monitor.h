@@ -0,0 +1,31 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <libpq-fe.h>
+#include "options.h"
+#include "handler.h"
+
+// Watches the retained WAL of the slot from a plain connection and switches
+// the handler to larger batches while the slot is behind.
+typedef struct {
+  PGconn* conn;
+  char* slotname;
+  int interval;
+  int64_t threshold;
+  handler_t* handler;
+  atomic_int_fast64_t retained;
+  atomic_int_fast64_t lag;
+  atomic_bool behind;
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t stop;
+  bool closed;
+} monitor_t;
+
+monitor_t* create_monitor(options_t* options, handler_t* handler);
+void delete_monitor(monitor_t* monitor);
+int monitor_check(monitor_t* monitor);
+bool monitor_behind(monitor_t* monitor);
@@ -0,0 +1,451 @@
+#include <errno.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include "logging.h"
+#include "decoder.h"
+#include "latency.h"
+#include "connection.h"
+#include "multiplex.h"
+
+#define MULTIPLEX_EVENTS 256
+
+const int MULTIPLEX_TICK_MS = 1000;
+const int TENANT_FEEDBACK_INTERVAL = 1;
+const int TENANT_STATUS_INTERVAL = 10;
+const int TENANT_RETRY_BASE_MS = 50;
+const int TENANT_RETRY_MAX_MS = 30000;
+
+static int64_t monotonic_ms() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000LL + now.tv_nsec / 1000000;
+}
+
+// Each line of the file is the database, slot, publication and output of a
+// tenant, separated by spaces. Empty lines and lines starting with # are
+// skipped.
+static int parse_tenants(multiplexer_t* multiplexer, char* path) {
+  FILE* file = fopen(path, "r");
+  if(file == NULL) {
+    ERROR("failed to open tenants %s", path);
+    return -1;
+  }
+
+  size_t size = 0;
+  multiplexer->lines = NULL;
+  if(getdelim(&multiplexer->lines, &size, '\0', file) < 0) {
+    multiplexer->lines = strdup("");
+  }
+  fclose(file);
+
+  int capacity = 0;
+  char* save_line;
+  for(char* line = strtok_r(multiplexer->lines, "\n", &save_line); line != NULL; line = strtok_r(NULL, "\n", &save_line)) {
+    char* fields[4];
+    char* save_field;
+    int number_fields = 0;
+    for(char* field = strtok_r(line, " \t\r", &save_field); field != NULL && number_fields < 5; field = strtok_r(NULL, " \t\r", &save_field)) {
+      if(number_fields == 0 && field[0] == '#') {
+        break;
+      }
+      if(number_fields < 4) {
+        fields[number_fields] = field;
+      }
+      number_fields++;
+    }
+    if(number_fields == 0) {
+      continue;
+    }
+    if(number_fields != 4) {
+      ERROR("tenants need a database, slot, publication and output: %s", line);
+      return -1;
+    }
+
+    if(multiplexer->number_tenants == capacity) {
+      capacity = capacity > 0 ? capacity * 2 : 64;
+      multiplexer->tenants = realloc(multiplexer->tenants, capacity * sizeof(tenant_t));
+    }
+    tenant_t* tenant = &multiplexer->tenants[multiplexer->number_tenants++];
+    memset(tenant, 0, sizeof(tenant_t));
+    tenant->dbname = fields[0];
+    tenant->slotname = fields[1];
+    tenant->publication = fields[2];
+    tenant->output = fields[3];
+    tenant->fd = -1;
+  }
+  return 0;
+}
+
+multiplexer_t* create_multiplexer(options_t* options, char* path) {
+  multiplexer_t* multiplexer = calloc(1, sizeof(multiplexer_t));
+  multiplexer->options = options;
+  multiplexer->epoll = -1;
+  if(parse_tenants(multiplexer, path) < 0) {
+    delete_multiplexer(multiplexer);
+    return NULL;
+  }
+
+  for(int i=0; i<multiplexer->number_tenants; i++) {
+    tenant_t* tenant = &multiplexer->tenants[i];
+    tenant->file = fopen(tenant->output, "a");
+    if(tenant->file == NULL) {
+      ERROR("failed to open output %s", tenant->output);
+      delete_multiplexer(multiplexer);
+      return NULL;
+    }
+    fputs("---\n", tenant->file);
+    fflush(tenant->file);
+    tenant->relations = create_relations();
+    tenant->changed_tables = options->changed_columns;
+    tenant->number_changed_tables = options->number_changed_columns;
+  }
+
+  multiplexer->epoll = epoll_create1(EPOLL_CLOEXEC);
+  if(multiplexer->epoll < 0) {
+    ERROR("failed to create epoll: %s", strerror(errno));
+    delete_multiplexer(multiplexer);
+    return NULL;
+  }
+  return multiplexer;
+}
+
+void delete_multiplexer(multiplexer_t* multiplexer) {
+  for(int i=0; i<multiplexer->number_tenants; i++) {
+    tenant_t* tenant = &multiplexer->tenants[i];
+    if(tenant->conn != NULL) {
+      PQfinish(tenant->conn);
+    }
+    if(tenant->file != NULL) {
+      fclose(tenant->file);
+    }
+    if(tenant->relations != NULL) {
+      delete_relations(tenant->relations);
+    }
+  }
+  if(multiplexer->epoll >= 0) {
+    close(multiplexer->epoll);
+  }
+  free(multiplexer->tenants);
+  free(multiplexer->lines);
+  free(multiplexer);
+}
+
+// Registers the current socket of the connection, which can change while
+// connecting, for the given events.
+static int watch_tenant(multiplexer_t* multiplexer, tenant_t* tenant, uint32_t events) {
+  int fd = PQsocket(tenant->conn);
+  struct epoll_event event = { .events = events, .data.ptr = tenant };
+  if(fd != tenant->fd) {
+    if(tenant->fd >= 0) {
+      epoll_ctl(multiplexer->epoll, EPOLL_CTL_DEL, tenant->fd, NULL);
+    }
+    tenant->fd = fd;
+    tenant->events = events;
+    return epoll_ctl(multiplexer->epoll, EPOLL_CTL_ADD, fd, &event);
+  }
+
+  if(events != tenant->events) {
+    tenant->events = events;
+    if(epoll_ctl(multiplexer->epoll, EPOLL_CTL_MOD, fd, &event) < 0 && errno == ENOENT) {
+      return epoll_ctl(multiplexer->epoll, EPOLL_CTL_ADD, fd, &event);
+    }
+  }
+  return 0;
+}
+
+// Drops the connection and retries with jittered exponential backoff. Rows
+// of an interrupted transaction are written again when it is resent.
+static void fail_tenant(multiplexer_t* multiplexer, tenant_t* tenant) {
+  ERROR("tenant %s: %s", tenant->slotname, tenant->conn != NULL ? PQerrorMessage(tenant->conn) : "connection failed");
+  if(tenant->fd >= 0) {
+    epoll_ctl(multiplexer->epoll, EPOLL_CTL_DEL, tenant->fd, NULL);
+    tenant->fd = -1;
+  }
+  if(tenant->conn != NULL) {
+    PQfinish(tenant->conn);
+    tenant->conn = NULL;
+  }
+
+  int delay = TENANT_RETRY_MAX_MS;
+  if(tenant->attempts < 20) {
+    delay = TENANT_RETRY_BASE_MS << tenant->attempts;
+    if(delay > TENANT_RETRY_MAX_MS) {
+      delay = TENANT_RETRY_MAX_MS;
+    }
+  }
+  tenant->attempts++;
+  tenant->retry_at = monotonic_ms() + random() % (delay + 1);
+  tenant->state = TENANT_WAITING;
+  tenant->in_transaction = false;
+}
+
+static void connect_tenant(multiplexer_t* multiplexer, tenant_t* tenant) {
+  options_t* options = multiplexer->options;
+  const char* keywords[] = { "replication", "dbname", "user", "password", "host", "port", NULL };
+  const char* values[] = { "database", tenant->dbname, options->user, options->password, options->host, options->port, NULL };
+  tenant->conn = PQconnectStartParams(keywords, values, 0);
+  if(tenant->conn == NULL || PQstatus(tenant->conn) == CONNECTION_BAD) {
+    fail_tenant(multiplexer, tenant);
+    return;
+  }
+
+  tenant->state = TENANT_CONNECTING;
+  if(watch_tenant(multiplexer, tenant, EPOLLOUT) < 0) {
+    fail_tenant(multiplexer, tenant);
+  }
+}
+
+static int flush_tenant(multiplexer_t* multiplexer, tenant_t* tenant) {
+  int pending = PQflush(tenant->conn);
+  if(pending < 0) {
+    return -1;
+  }
+  return watch_tenant(multiplexer, tenant, pending > 0 ? EPOLLIN | EPOLLOUT : EPOLLIN);
+}
+
+static int start_tenant(multiplexer_t* multiplexer, tenant_t* tenant) {
+  char query[1024];
+  int64_t start_lsn = tenant->received_lsn > 0 ? tenant->received_lsn + 1 : 0;
+  snprintf(query, sizeof(query), START_REPLICATION_COMMAND, tenant->slotname,
+    (uint32_t)(start_lsn >> 32), (uint32_t)start_lsn, tenant->publication);
+  if(PQsetnonblocking(tenant->conn, 1) < 0 || PQsendQuery(tenant->conn, query) == 0) {
+    return -1;
+  }
+
+  tenant->state = TENANT_STARTING;
+  return flush_tenant(multiplexer, tenant);
+}
+
+// Position safe to confirm: the last commit written, or the server position
+// when no transaction is open, since every received row was written then.
+int64_t tenant_feedback_lsn(tenant_t* tenant) {
+  if(!tenant->in_transaction && tenant->server_lsn > tenant->received_lsn) {
+    return tenant->server_lsn;
+  }
+  return tenant->received_lsn;
+}
+
+static int send_tenant_feedback(multiplexer_t* multiplexer, tenant_t* tenant, bool force) {
+  int64_t lsn = tenant_feedback_lsn(tenant);
+  time_t now = time(NULL);
+  bool advanced = lsn > tenant->reported && now - tenant->reported_at >= TENANT_FEEDBACK_INTERVAL;
+  if(!force && !advanced && now - tenant->reported_at < TENANT_STATUS_INTERVAL) {
+    return 0;
+  }
+
+  char buffer[STANDBY_STATUS_SIZE];
+  write_standby_status(buffer, lsn, postgres_now());
+  if(PQputCopyData(tenant->conn, buffer, sizeof(buffer)) != 1) {
+    return -1;
+  }
+
+  tenant->reported = lsn;
+  tenant->reported_at = now;
+  return flush_tenant(multiplexer, tenant);
+}
+
+// Decodes a message of the tenant and writes it to its output. Only rows and
+// relations are written, and the output is flushed at commit.
+int handle_tenant_wal(tenant_t* tenant, stream_t* stream) {
+  if(!check_bytes(stream, 8+8+8) || !validate_message(stream, false)) {
+    ERROR("malformed wal message");
+    return FAILED;
+  }
+
+  relation_t* relation;
+  char operation = read_char(stream);
+  switch(operation) {
+    case 'B':
+      delete_begin(parse_begin(stream));
+      tenant->in_transaction = true;
+      break;
+    case 'C': {
+      commit_t* commit = parse_commit(stream);
+      if(commit == NULL) {
+        return FAILED;
+      }
+      if(fflush(tenant->file) != 0) {
+        delete_commit(commit);
+        return FAILED;
+      }
+      tenant->received_lsn = commit->lsn;
+      tenant->in_transaction = false;
+      delete_commit(commit);
+      break;
+    }
+    case 'R':
+      relation = parse_relation(stream);
+      if(relation == NULL) {
+        return FAILED;
+      }
+      relation->changed_columns = relation_selected(relation, tenant->changed_tables, tenant->number_changed_tables);
+      print_relation(relation, tenant->file);
+      put_relation(tenant->relations, relation);
+      break;
+    case 'I': {
+      insert_t* insert = parse_insert(stream);
+      if(insert == NULL) {
+        return FAILED;
+      }
+      print_insert(insert, tenant->file);
+      delete_insert(insert);
+      break;
+    }
+    case 'U': {
+      update_t* update = parse_update(stream);
+      if(update == NULL) {
+        return FAILED;
+      }
+      relation = get_relation(tenant->relations, update->relation_id);
+      if(relation != NULL && relation->changed_columns) {
+        print_changed_update(update, relation, tenant->file);
+      } else {
+        print_update(update, tenant->file);
+      }
+      delete_update(update);
+      break;
+    }
+    case 'D': {
+      delete_t* delete = parse_delete(stream);
+      if(delete == NULL) {
+        return FAILED;
+      }
+      print_delete(delete, tenant->file);
+      delete_delete(delete);
+      break;
+    }
+    default:
+      DEBUG("unknown operation: %c", operation);
+  }
+  return OK;
+}
+
+static int receive_tenant(multiplexer_t* multiplexer, tenant_t* tenant) {
+  char* buffer;
+  int size;
+  while((size = PQgetCopyData(tenant->conn, &buffer, 1)) > 0) {
+    stream_t stream;
+    init_stream(&stream, buffer, size);
+    int err = OK;
+    switch(read_char(&stream)) {
+      case 'w':
+        err = handle_tenant_wal(tenant, &stream);
+        break;
+      case 'k':
+        if(stream_remaining(&stream) >= 8+8+1) {
+          tenant->server_lsn = read_int64(&stream);
+          read_int64(&stream);
+          err = send_tenant_feedback(multiplexer, tenant, read_char(&stream) == 1) < 0 ? FAILED : OK;
+        }
+        break;
+    }
+    PQfreemem(buffer);
+    if(err != OK) {
+      return -1;
+    }
+  }
+
+  if(size < 0) {
+    return -1;
+  }
+  tenant->attempts = 0;
+  return 0;
+}
+
+// Moves the tenant forward on readiness of its socket.
+static void advance_tenant(multiplexer_t* multiplexer, tenant_t* tenant, uint32_t events) {
+  PGresult* result;
+  int err = 0;
+  switch(tenant->state) {
+    case TENANT_CONNECTING:
+      switch(PQconnectPoll(tenant->conn)) {
+        case PGRES_POLLING_READING:
+          err = watch_tenant(multiplexer, tenant, EPOLLIN);
+          break;
+        case PGRES_POLLING_WRITING:
+          err = watch_tenant(multiplexer, tenant, EPOLLOUT);
+          break;
+        case PGRES_POLLING_OK:
+          INFO("tenant %s connected", tenant->slotname);
+          err = start_tenant(multiplexer, tenant);
+          break;
+        default:
+          err = -1;
+      }
+      break;
+    case TENANT_STARTING:
+      if((events & EPOLLOUT) && flush_tenant(multiplexer, tenant) < 0) {
+        err = -1;
+        break;
+      }
+      if(PQconsumeInput(tenant->conn) == 0) {
+        err = -1;
+        break;
+      }
+      if(PQisBusy(tenant->conn)) {
+        break;
+      }
+      result = PQgetResult(tenant->conn);
+      if(PQresultStatus(result) != PGRES_COPY_BOTH) {
+        PQclear(result);
+        err = -1;
+        break;
+      }
+      PQclear(result);
+      tenant->state = TENANT_STREAMING;
+      err = receive_tenant(multiplexer, tenant);
+      break;
+    case TENANT_STREAMING:
+      if((events & EPOLLOUT) && flush_tenant(multiplexer, tenant) < 0) {
+        err = -1;
+        break;
+      }
+      if((events & (EPOLLIN | EPOLLHUP | EPOLLERR)) && PQconsumeInput(tenant->conn) == 0) {
+        err = -1;
+        break;
+      }
+      err = receive_tenant(multiplexer, tenant);
+      break;
+    default:
+      break;
+  }
+
+  if(err < 0) {
+    fail_tenant(multiplexer, tenant);
+  }
+}
+
+// Connects waiting tenants that are due and sends feedback of the others.
+static void tick(multiplexer_t* multiplexer) {
+  int64_t now = monotonic_ms();
+  for(int i=0; i<multiplexer->number_tenants; i++) {
+    tenant_t* tenant = &multiplexer->tenants[i];
+    if(tenant->state == TENANT_WAITING && tenant->retry_at <= now) {
+      connect_tenant(multiplexer, tenant);
+    } else if(tenant->state == TENANT_STREAMING && send_tenant_feedback(multiplexer, tenant, false) < 0) {
+      fail_tenant(multiplexer, tenant);
+    }
+  }
+}
+
+int run_multiplexer(multiplexer_t* multiplexer) {
+  INFO("watching changes of %d tenants", multiplexer->number_tenants);
+  struct epoll_event events[MULTIPLEX_EVENTS];
+  int64_t ticked_at = 0;
+  while(1) {
+    int64_t now = monotonic_ms();
+    if(now - ticked_at >= MULTIPLEX_TICK_MS) {
+      tick(multiplexer);
+      ticked_at = now;
+    }
+
+    int count = epoll_wait(multiplexer->epoll, events, MULTIPLEX_EVENTS, MULTIPLEX_TICK_MS);
+    if(count < 0 && errno != EINTR) {
+      ERROR("failed to wait for tenants: %s", strerror(errno));
+      return -1;
+    }
+    for(int i=0; i<count; i++) {
+      advance_tenant(multiplexer, events[i].data.ptr, events[i].events);
+    }
+  }
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <time.h>
+#include <libpq-fe.h>
+#include "stream.h"
+#include "relations.h"
+#include "options.h"
+
+typedef enum { TENANT_WAITING, TENANT_CONNECTING, TENANT_STARTING, TENANT_STREAMING } tenant_state_t;
+
+// One slot served by the multiplexer, with only its connection, relations
+// and positions kept between messages. Rows are written to the output as
+// they arrive and flushed at each commit.
+typedef struct {
+  char* dbname;
+  char* slotname;
+  char* publication;
+  char* output;
+  FILE* file;
+  PGconn* conn;
+  int fd;
+  uint32_t events;
+  tenant_state_t state;
+  relations_t* relations;
+  char** changed_tables;
+  int number_changed_tables;
+  bool in_transaction;
+  int64_t received_lsn;
+  int64_t server_lsn;
+  int64_t reported;
+  time_t reported_at;
+  int64_t retry_at;
+  int attempts;
+} tenant_t;
+
+// Replication connections of many slots driven as non-blocking state
+// machines by one thread waiting on epoll.
+typedef struct {
+  options_t* options;
+  tenant_t* tenants;
+  int number_tenants;
+  int epoll;
+  char* lines;
+} multiplexer_t;
+
+multiplexer_t* create_multiplexer(options_t* options, char* path);
+void delete_multiplexer(multiplexer_t* multiplexer);
+int run_multiplexer(multiplexer_t* multiplexer);
+int handle_tenant_wal(tenant_t* tenant, stream_t* stream);
+int64_t tenant_feedback_lsn(tenant_t* tenant);
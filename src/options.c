@@ -1,5 +1,6 @@
 #include <string.h>
 #include <stdbool.h>
+#include <stdlib.h>
 #include "options.h"
 
 int parse_option(const char* name, char** value, char argi, char *argv[]) {
@@ -21,6 +22,39 @@ int parse_has_option(const char* name, bool* value, char argi, char *argv[]) {
 
 }
 
+int parse_int_option(const char* name, int* value, char argi, char *argv[]) {
+  if(strcmp(argv[argi], name) == 0 && argv[argi + 1] != NULL) {
+    *value = atoi(argv[argi + 1]);
+    return 1;
+  }
+
+  return 0;
+}
+
+int parse_size_option(const char* name, size_t* value, char argi, char *argv[]) {
+  if(strcmp(argv[argi], name) == 0 && argv[argi + 1] != NULL) {
+    char* suffix;
+    *value = strtoull(argv[argi + 1], &suffix, 10);
+    switch(suffix[0]) {
+      case 'G': *value *= 1024; /* fallthrough */
+      case 'M': *value *= 1024; /* fallthrough */
+      case 'K': *value *= 1024;
+    }
+    return 1;
+  }
+
+  return 0;
+}
+
+int parse_list_option(const char* name, char** values, int* size, int max, char argi, char *argv[]) {
+  if(strcmp(argv[argi], name) == 0 && *size < max) {
+    values[(*size)++] = argv[argi + 1];
+    return 1;
+  }
+
+  return 0;
+}
+
 options_t parse_options(int argc, char *argv[]) {
   options_t options;
 
@@ -34,6 +68,39 @@ options_t parse_options(int argc, char *argv[]) {
   options.publication = "cdc";
   options.install = false;
   options.uninstall = false;
+  options.toast_cache = 0;
+  options.queue_size = 64*1024*1024;
+  options.receive_buffer = 0;
+  options.queue_full = "block";
+  options.spill_dir = NULL;
+  options.reconnect = false;
+  options.number_sinks = 0;
+  options.history_size = 64*1024*1024;
+  options.segment_size = 64*1024*1024;
+  options.shm_size = 64*1024*1024;
+  options.compact_window = 0;
+  options.compact_lsn = 0;
+  options.snapshot = 0;
+  options.latency_report = 0;
+  options.stamp_latency = false;
+  options.counters_report = 0;
+  options.lag_interval = 0;
+  options.lag_threshold = 64*1024*1024;
+  options.partitions = 0;
+  options.durable = false;
+  options.sync_interval = 0;
+  options.checksum = false;
+  options.verify = NULL;
+  options.streaming = NULL;
+  options.number_mirrors = 0;
+  options.mirror_dump = "mirror.yaml";
+  options.mirror_interval = 0;
+  options.number_changed_columns = 0;
+  options.stats = NULL;
+  options.tenants = NULL;
+  options.arrow_dir = NULL;
+  options.arrow_batch_rows = 65536;
+  options.arrow_batch_ms = 0;
 
   for(int i=0; i < argc; i++){
     if(parse_option("--file", &options.file, i, argv)){ continue; }
@@ -46,6 +113,43 @@ options_t parse_options(int argc, char *argv[]) {
     if(parse_option("--publication", &options.publication, i, argv)){ continue; }
     if(parse_has_option("--install", &options.install, i, argv)) { continue; }
     if(parse_has_option("--uninstall", &options.uninstall, i, argv)) { continue; }
+    if(parse_size_option("--toast-cache", &options.toast_cache, i, argv)) { continue; }
+    if(parse_size_option("--queue-size", &options.queue_size, i, argv)) { continue; }
+    if(parse_size_option("--receive-buffer", &options.receive_buffer, i, argv)) { continue; }
+    if(parse_option("--queue-full", &options.queue_full, i, argv)) { continue; }
+    if(parse_option("--spill-dir", &options.spill_dir, i, argv)) { continue; }
+    if(parse_has_option("--reconnect", &options.reconnect, i, argv)) { continue; }
+    if(parse_list_option("--sink", options.sinks, &options.number_sinks, MAX_SINKS, i, argv)) { continue; }
+    if(parse_size_option("--history-size", &options.history_size, i, argv)) { continue; }
+    if(parse_size_option("--segment-size", &options.segment_size, i, argv)) { continue; }
+    if(parse_size_option("--shm-size", &options.shm_size, i, argv)) { continue; }
+    if(parse_int_option("--compact-window", &options.compact_window, i, argv)) { continue; }
+    if(parse_size_option("--compact-lsn", &options.compact_lsn, i, argv)) { continue; }
+    if(parse_int_option("--snapshot", &options.snapshot, i, argv)) { continue; }
+    if(parse_int_option("--latency-report", &options.latency_report, i, argv)) { continue; }
+    if(parse_has_option("--stamp-latency", &options.stamp_latency, i, argv)) { continue; }
+    if(parse_int_option("--counters-report", &options.counters_report, i, argv)) { continue; }
+    if(parse_int_option("--lag-interval", &options.lag_interval, i, argv)) { continue; }
+    if(parse_size_option("--lag-threshold", &options.lag_threshold, i, argv)) { continue; }
+    if(parse_int_option("--partitions", &options.partitions, i, argv)) { continue; }
+    if(parse_has_option("--durable", &options.durable, i, argv)) { continue; }
+    if(parse_int_option("--sync-interval", &options.sync_interval, i, argv)) { continue; }
+    if(parse_has_option("--checksum", &options.checksum, i, argv)) { continue; }
+    if(parse_option("--verify", &options.verify, i, argv)) { continue; }
+    if(parse_option("--streaming", &options.streaming, i, argv)) { continue; }
+    if(parse_list_option("--mirror", options.mirrors, &options.number_mirrors, MAX_TABLES, i, argv)) { continue; }
+    if(parse_option("--mirror-dump", &options.mirror_dump, i, argv)) { continue; }
+    if(parse_int_option("--mirror-interval", &options.mirror_interval, i, argv)) { continue; }
+    if(parse_option("--stats", &options.stats, i, argv)) { continue; }
+    if(parse_option("--tenants", &options.tenants, i, argv)) { continue; }
+    if(parse_option("--arrow-dir", &options.arrow_dir, i, argv)) { continue; }
+    if(parse_int_option("--arrow-batch-rows", &options.arrow_batch_rows, i, argv)) { continue; }
+    if(parse_int_option("--arrow-batch-ms", &options.arrow_batch_ms, i, argv)) { continue; }
+    if(parse_list_option("--changed-columns", options.changed_columns, &options.number_changed_columns, MAX_TABLES, i, argv)) { continue; }
+  }
+
+  if(options.number_sinks == 0) {
+    options.sinks[options.number_sinks++] = "file:-";
   }
 
   return options;
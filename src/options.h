@@ -1,5 +1,9 @@
 #pragma once
 #include <stdbool.h>
+#include <stddef.h>
+
+#define MAX_SINKS 64
+#define MAX_TABLES 64
 
 typedef struct {
   char* file;
@@ -12,6 +16,42 @@ typedef struct {
   char* publication;
   bool install;
   bool uninstall;
+  size_t toast_cache;
+  size_t queue_size;
+  size_t receive_buffer;
+  char* queue_full;
+  char* spill_dir;
+  bool reconnect;
+  char* sinks[MAX_SINKS];
+  int number_sinks;
+  size_t history_size;
+  size_t segment_size;
+  size_t shm_size;
+  int compact_window;
+  size_t compact_lsn;
+  int snapshot;
+  int latency_report;
+  bool stamp_latency;
+  int counters_report;
+  int lag_interval;
+  size_t lag_threshold;
+  int partitions;
+  bool durable;
+  int sync_interval;
+  bool checksum;
+  char* verify;
+  char* streaming;
+  char* mirrors[MAX_TABLES];
+  int number_mirrors;
+  char* mirror_dump;
+  int mirror_interval;
+  char* changed_columns[MAX_TABLES];
+  int number_changed_columns;
+  char* stats;
+  char* tenants;
+  char* arrow_dir;
+  int arrow_batch_rows;
+  int arrow_batch_ms;
 } options_t;
 
 
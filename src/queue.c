@@ -0,0 +1,201 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include "logging.h"
+#include "queue.h"
+
+queue_t* create_queue(size_t capacity, queue_policy_t policy, char* spill_dir) {
+  queue_t* queue = calloc(1, sizeof(queue_t));
+  pthread_mutex_init(&queue->lock, NULL);
+  pthread_cond_init(&queue->not_empty, NULL);
+  pthread_cond_init(&queue->not_full, NULL);
+  queue->capacity = capacity;
+  queue->policy = policy;
+  queue->spill_dir = spill_dir;
+  queue->spill_fd = -1;
+  return queue;
+}
+
+void delete_queue(queue_t* queue) {
+  frame_t* frame = queue->head;
+  while(frame != NULL) {
+    frame_t* next = frame->next;
+    delete_frame(frame);
+    frame = next;
+  }
+
+  if(queue->spill_fd >= 0) {
+    close(queue->spill_fd);
+  }
+
+  pthread_cond_destroy(&queue->not_full);
+  pthread_cond_destroy(&queue->not_empty);
+  pthread_mutex_destroy(&queue->lock);
+  free(queue);
+}
+
+void delete_frame(frame_t* frame) {
+  frame->release(frame->data);
+  free(frame);
+}
+
+static int open_spill(queue_t* queue) {
+  char path[1024];
+  snprintf(path, sizeof(path), "%s/pgoutput2yml-spill-XXXXXX", queue->spill_dir != NULL ? queue->spill_dir : "/tmp");
+  queue->spill_fd = mkstemp(path);
+  if(queue->spill_fd < 0) {
+    ERROR("failed to create spill file %s", path);
+    return -1;
+  }
+
+  unlink(path);
+  return 0;
+}
+
+static int spill(queue_t* queue, char* data, size_t size) {
+  if(queue->spill_fd < 0 && open_spill(queue) < 0) {
+    return -1;
+  }
+
+  if(pwrite(queue->spill_fd, &size, sizeof(size), queue->spill_write) != sizeof(size)
+      || pwrite(queue->spill_fd, data, size, queue->spill_write + sizeof(size)) != (ssize_t)size) {
+    ERROR("failed to write spill file");
+    return -1;
+  }
+
+  queue->spill_write += sizeof(size) + size;
+  return 0;
+}
+
+static frame_t* unspill(queue_t* queue) {
+  size_t size;
+  if(pread(queue->spill_fd, &size, sizeof(size), queue->spill_read) != sizeof(size)) {
+    ERROR("failed to read spill file");
+    queue->failed = true;
+    return NULL;
+  }
+
+  frame_t* frame = malloc(sizeof(frame_t));
+  frame->next = NULL;
+  frame->size = size;
+  frame->data = malloc(size);
+  frame->release = free;
+  if(pread(queue->spill_fd, frame->data, size, queue->spill_read + sizeof(size)) != (ssize_t)size) {
+    ERROR("failed to read spill file");
+    queue->failed = true;
+    delete_frame(frame);
+    return NULL;
+  }
+
+  queue->spill_read += sizeof(size) + size;
+  if(queue->spill_read == queue->spill_write) {
+    if(ftruncate(queue->spill_fd, 0) < 0) {
+      ERROR("failed to truncate spill file");
+    }
+    queue->spill_read = 0;
+    queue->spill_write = 0;
+  }
+
+  return frame;
+}
+
+int queue_push(queue_t* queue, char* data, size_t size, void (*release)(void*)) {
+  pthread_mutex_lock(&queue->lock);
+
+  bool spilling = queue->spill_write > 0;
+  bool full = queue->head != NULL && queue->bytes + size > queue->capacity;
+  if(queue->policy == QUEUE_SPILL && (spilling || full)) {
+    int err = spill(queue, data, size);
+    pthread_cond_signal(&queue->not_empty);
+    pthread_mutex_unlock(&queue->lock);
+    release(data);
+    return err;
+  }
+
+  while(queue->head != NULL && queue->bytes + size > queue->capacity && !queue->closed) {
+    pthread_cond_wait(&queue->not_full, &queue->lock);
+  }
+
+  frame_t* frame = malloc(sizeof(frame_t));
+  frame->next = NULL;
+  frame->data = data;
+  frame->size = size;
+  frame->release = release;
+
+  if(queue->tail != NULL) {
+    queue->tail->next = frame;
+  } else {
+    queue->head = frame;
+  }
+  queue->tail = frame;
+  queue->bytes += size;
+
+  pthread_cond_signal(&queue->not_empty);
+  pthread_mutex_unlock(&queue->lock);
+  return 0;
+}
+
+// Returns NULL once the queue is closed and drained, or when a spilled frame
+// could not be read back, which queue_failed tells apart.
+frame_t* queue_pop(queue_t* queue) {
+  frame_t* frame = NULL;
+  pthread_mutex_lock(&queue->lock);
+
+  while(queue->head == NULL && queue->spill_write == 0 && !queue->closed) {
+    pthread_cond_wait(&queue->not_empty, &queue->lock);
+  }
+
+  if(queue->head != NULL) {
+    frame = queue->head;
+    queue->head = frame->next;
+    if(queue->head == NULL) {
+      queue->tail = NULL;
+    }
+    queue->bytes -= frame->size;
+    frame->next = NULL;
+    pthread_cond_signal(&queue->not_full);
+  } else if(queue->spill_write > 0) {
+    frame = unspill(queue);
+  }
+
+  pthread_mutex_unlock(&queue->lock);
+  return frame;
+}
+
+// Waits up to timeout_ms for a frame. Returns false on timeout.
+bool queue_wait(queue_t* queue, int timeout_ms) {
+  struct timespec deadline;
+  clock_gettime(CLOCK_REALTIME, &deadline);
+  deadline.tv_sec += timeout_ms / 1000;
+  deadline.tv_nsec += (timeout_ms % 1000) * 1000000L;
+  if(deadline.tv_nsec >= 1000000000L) {
+    deadline.tv_sec++;
+    deadline.tv_nsec -= 1000000000L;
+  }
+
+  pthread_mutex_lock(&queue->lock);
+  int err = 0;
+  while(queue->head == NULL && queue->spill_write == 0 && !queue->closed && err == 0) {
+    err = pthread_cond_timedwait(&queue->not_empty, &queue->lock, &deadline);
+  }
+  bool ready = queue->head != NULL || queue->spill_write > 0 || queue->closed;
+  pthread_mutex_unlock(&queue->lock);
+  return ready;
+}
+
+void queue_close(queue_t* queue) {
+  pthread_mutex_lock(&queue->lock);
+  queue->closed = true;
+  pthread_cond_broadcast(&queue->not_empty);
+  pthread_cond_broadcast(&queue->not_full);
+  pthread_mutex_unlock(&queue->lock);
+}
+
+bool queue_failed(queue_t* queue) {
+  pthread_mutex_lock(&queue->lock);
+  bool failed = queue->failed;
+  pthread_mutex_unlock(&queue->lock);
+  return failed;
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <pthread.h>
+
+typedef enum { QUEUE_BLOCK, QUEUE_SPILL } queue_policy_t;
+
+typedef struct frame_s {
+  struct frame_s* next;
+  char* data;
+  size_t size;
+  void (*release)(void*);
+} frame_t;
+
+// Bounded queue of received frames. When capacity bytes are queued, pushes
+// either block or go to a spill file that is drained before memory is used
+// again, so frames always come out in the order they were pushed.
+typedef struct {
+  pthread_mutex_t lock;
+  pthread_cond_t not_empty;
+  pthread_cond_t not_full;
+  frame_t* head;
+  frame_t* tail;
+  size_t bytes;
+  size_t capacity;
+  queue_policy_t policy;
+  char* spill_dir;
+  int spill_fd;
+  off_t spill_read;
+  off_t spill_write;
+  bool closed;
+  bool failed;
+} queue_t;
+
+queue_t* create_queue(size_t capacity, queue_policy_t policy, char* spill_dir);
+void delete_queue(queue_t* queue);
+int queue_push(queue_t* queue, char* data, size_t size, void (*release)(void*));
+frame_t* queue_pop(queue_t* queue);
+bool queue_wait(queue_t* queue, int timeout_ms);
+void queue_close(queue_t* queue);
+bool queue_failed(queue_t* queue);
+void delete_frame(frame_t* frame);
@@ -0,0 +1,284 @@
+#include <errno.h>
+#include <poll.h>
+#include <endian.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include "logging.h"
+#include "receiver.h"
+
+#define MESSAGE_HEADER_SIZE (1+4)
+
+static const size_t BLOCK_CAPACITY = RECEIVE_BLOCK_SIZE - offsetof(receive_block_t, data);
+
+receiver_t* create_receiver(size_t capacity) {
+  receiver_t* receiver = calloc(1, sizeof(receiver_t));
+  receiver->fd = -1;
+  receiver->max_blocks = capacity / RECEIVE_BLOCK_SIZE;
+  if(receiver->max_blocks < 2) {
+    receiver->max_blocks = 2;
+  }
+  pthread_mutex_init(&receiver->lock, NULL);
+  pthread_cond_init(&receiver->released, NULL);
+  return receiver;
+}
+
+static void release_block(receive_block_t* block) {
+  if(atomic_fetch_sub(&block->references, 1) != 1) {
+    return;
+  }
+
+  if(block->large) {
+    free(block);
+    return;
+  }
+
+  receiver_t* receiver = block->receiver;
+  pthread_mutex_lock(&receiver->lock);
+  block->next = receiver->free_blocks;
+  receiver->free_blocks = block;
+  pthread_cond_signal(&receiver->released);
+  pthread_mutex_unlock(&receiver->lock);
+}
+
+// Blocks for frames that do not fit RECEIVE_BLOCK_SIZE are allocated for
+// them alone. The others wait for a release once max_blocks are in use.
+static receive_block_t* acquire_block(receiver_t* receiver, size_t needed) {
+  receive_block_t* block;
+  if(needed >= BLOCK_CAPACITY) {
+    size_t size = (offsetof(receive_block_t, data) + needed + RECEIVE_BLOCK_SIZE) / RECEIVE_BLOCK_SIZE * RECEIVE_BLOCK_SIZE;
+    block = aligned_alloc(RECEIVE_BLOCK_SIZE, size);
+    block->large = true;
+    block->capacity = size - offsetof(receive_block_t, data);
+  } else {
+    pthread_mutex_lock(&receiver->lock);
+    while(receiver->free_blocks == NULL && receiver->number_blocks >= receiver->max_blocks) {
+      pthread_cond_wait(&receiver->released, &receiver->lock);
+    }
+    if(receiver->free_blocks != NULL) {
+      block = receiver->free_blocks;
+      receiver->free_blocks = block->next;
+    } else {
+      block = aligned_alloc(RECEIVE_BLOCK_SIZE, RECEIVE_BLOCK_SIZE);
+      receiver->number_blocks++;
+    }
+    pthread_mutex_unlock(&receiver->lock);
+    block->large = false;
+    block->capacity = BLOCK_CAPACITY;
+  }
+
+  block->receiver = receiver;
+  block->next = NULL;
+  atomic_init(&block->references, 1);
+  return block;
+}
+
+// Frames handed out must be released before the receiver is deleted.
+void delete_receiver(receiver_t* receiver) {
+  if(receiver->block != NULL) {
+    release_block(receiver->block);
+  }
+  while(receiver->free_blocks != NULL) {
+    receive_block_t* block = receiver->free_blocks;
+    receiver->free_blocks = block->next;
+    free(block);
+  }
+  pthread_cond_destroy(&receiver->released);
+  pthread_mutex_destroy(&receiver->lock);
+  free(receiver);
+}
+
+void release_received(void* data) {
+  release_block((receive_block_t*)((uintptr_t)data & ~(uintptr_t)(RECEIVE_BLOCK_SIZE - 1)));
+}
+
+// Moves the unparsed bytes to a block with room for the whole message. The
+// current block is reused in place when no frame of it is still held.
+static void make_room(receiver_t* receiver, size_t needed) {
+  receive_block_t* block = receiver->block;
+  size_t available = receiver->end - receiver->start;
+  if(block != NULL && !block->large && needed < block->capacity && atomic_load(&block->references) == 1) {
+    memmove(block->data, block->data + receiver->start, available);
+  } else {
+    receiver->block = acquire_block(receiver, needed);
+    if(block != NULL) {
+      memcpy(receiver->block->data, block->data + receiver->start, available);
+      release_block(block);
+    }
+  }
+  receiver->start = 0;
+  receiver->end = available;
+}
+
+static char* error_message(char* body, size_t size) {
+  char* end = body + size;
+  while(body < end && *body != 0) {
+    char field = *body++;
+    if(field == 'M') {
+      return body;
+    }
+    body += strnlen(body, end - body) + 1;
+  }
+  return "unknown error";
+}
+
+// Reads until a whole message is in the current block. Returns 1 with its
+// type and body, 0 when nothing arrived in time or -1 when the connection
+// failed.
+static int next_message(receiver_t* receiver, char* type, char** body, size_t* size, int timeout_ms) {
+  while(1) {
+    receive_block_t* block = receiver->block;
+    size_t available = block != NULL ? receiver->end - receiver->start : 0;
+    size_t needed = MESSAGE_HEADER_SIZE;
+    if(available >= MESSAGE_HEADER_SIZE) {
+      char* message = block->data + receiver->start;
+      uint32_t length;
+      memcpy(&length, message + 1, sizeof(length));
+      length = be32toh(length);
+      if(length < 4) {
+        ERROR("malformed replication message");
+        return -1;
+      }
+
+      needed = 1 + (size_t)length;
+      if(available >= needed) {
+        receiver->start += needed;
+        *type = message[0];
+        *body = message + MESSAGE_HEADER_SIZE;
+        *size = length - 4;
+        return 1;
+      }
+    }
+
+    // A frame keeps one byte after it, so its data never ends on the next
+    // block boundary, and frames of large blocks always start at the front.
+    if(block == NULL || receiver->start + needed >= block->capacity || (block->large && receiver->start > 0)) {
+      make_room(receiver, needed);
+      block = receiver->block;
+    }
+
+    ssize_t count = recv(receiver->fd, block->data + receiver->end, block->capacity - receiver->end, MSG_DONTWAIT);
+    if(count > 0) {
+      receiver->end += count;
+      continue;
+    }
+    if(count == 0) {
+      ERROR("connection closed");
+      return -1;
+    }
+    if(errno == EINTR) {
+      continue;
+    }
+    if(errno != EAGAIN && errno != EWOULDBLOCK) {
+      ERROR("failed to read connection: %s", strerror(errno));
+      return -1;
+    }
+
+    struct pollfd fd = { .fd = receiver->fd, .events = POLLIN };
+    if(poll(&fd, 1, timeout_ms) == 0) {
+      return 0;
+    }
+  }
+}
+
+static int send_all(receiver_t* receiver, struct iovec* iov, int count) {
+  while(count > 0) {
+    ssize_t written = writev(receiver->fd, iov, count);
+    if(written < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+      struct pollfd fd = { .fd = receiver->fd, .events = POLLOUT };
+      poll(&fd, 1, -1);
+      continue;
+    }
+    if(written < 0 && errno != EINTR) {
+      ERROR("failed to write connection: %s", strerror(errno));
+      return -1;
+    }
+    if(written < 0) {
+      continue;
+    }
+
+    while(count > 0 && (size_t)written >= iov->iov_len) {
+      written -= iov->iov_len;
+      iov++;
+      count--;
+    }
+    if(count > 0) {
+      iov->iov_base = (char*)iov->iov_base + written;
+      iov->iov_len -= written;
+    }
+  }
+  return 0;
+}
+
+static int send_message(receiver_t* receiver, char type, char* body, size_t size) {
+  char header[MESSAGE_HEADER_SIZE];
+  uint32_t length = htobe32(size + 4);
+  header[0] = type;
+  memcpy(header + 1, &length, sizeof(length));
+  struct iovec iov[2] = { { header, sizeof(header) }, { body, size } };
+  return send_all(receiver, iov, 2);
+}
+
+// Sends the replication command on the socket of a connection libpq set
+// up, and waits for the server to start copying. Bytes left from a previous
+// connection are dropped.
+int receiver_start(receiver_t* receiver, int fd, char* query) {
+  receiver->fd = fd;
+  if(receiver->block != NULL) {
+    release_block(receiver->block);
+    receiver->block = NULL;
+  }
+  receiver->start = 0;
+  receiver->end = 0;
+
+  if(send_message(receiver, 'Q', query, strlen(query) + 1) < 0) {
+    return -1;
+  }
+
+  while(1) {
+    char type;
+    char* body;
+    size_t size;
+    int err = next_message(receiver, &type, &body, &size, -1);
+    if(err < 0) {
+      return -1;
+    }
+    if(err > 0 && type == 'W') {
+      return 0;
+    }
+    if(err > 0 && type == 'E') {
+      ERROR("fatal error: %s", error_message(body, size));
+      return -1;
+    }
+  }
+}
+
+// Points data at the next CopyData frame, held until release_received.
+// Returns its size, 0 when nothing arrived in time or -1 when the stream
+// ended or failed.
+ssize_t receiver_next(receiver_t* receiver, char** data, int timeout_ms) {
+  while(1) {
+    char type;
+    size_t size;
+    int err = next_message(receiver, &type, data, &size, timeout_ms);
+    if(err <= 0) {
+      return err;
+    }
+
+    switch(type) {
+      case 'd':
+        atomic_fetch_add(&receiver->block->references, 1);
+        return size;
+      case 'E':
+        ERROR("fatal error: %s", error_message(*data, size));
+        return -1;
+      case 'c':
+        INFO("replication stream ended");
+        return -1;
+    }
+  }
+}
+
+int receiver_send(receiver_t* receiver, char* data, size_t size) {
+  return send_message(receiver, 'd', data, size);
+}
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <sys/types.h>
+
+#define RECEIVE_BLOCK_SIZE (1024*1024)
+
+// Bytes read from the connection. Blocks are aligned to their size, so the
+// block of any frame handed out is found from the frame itself. Blocks of
+// frames larger than RECEIVE_BLOCK_SIZE are freed once released, the others
+// are reused.
+typedef struct receive_block_s {
+  struct receiver_s* receiver;
+  struct receive_block_s* next;
+  atomic_int references;
+  bool large;
+  size_t capacity;
+  char data[];
+} receive_block_t;
+
+// Replication stream read straight from the socket of a connection, once
+// libpq sent the query. CopyData frames are parsed in place and handed out
+// as views into the blocks, which are reused once every frame read from them
+// was released. The receiver waits for a release when capacity bytes of
+// blocks are in use.
+typedef struct receiver_s {
+  int fd;
+  pthread_mutex_t lock;
+  pthread_cond_t released;
+  receive_block_t* free_blocks;
+  int number_blocks;
+  int max_blocks;
+  receive_block_t* block;
+  size_t start;
+  size_t end;
+} receiver_t;
+
+receiver_t* create_receiver(size_t capacity);
+void delete_receiver(receiver_t* receiver);
+int receiver_start(receiver_t* receiver, int fd, char* query);
+ssize_t receiver_next(receiver_t* receiver, char** data, int timeout_ms);
+int receiver_send(receiver_t* receiver, char* data, size_t size);
+void release_received(void* data);
@@ -0,0 +1,101 @@
+#include "relations.h"
+
+relations_t* create_relations() {
+  return calloc(1, sizeof(relations_t));
+}
+
+void delete_relations(relations_t* relations) {
+  for(int i=0; i<RELATIONS_BUCKETS; i++) {
+    relation_entry_t* entry = relations->buckets[i];
+    while(entry != NULL) {
+      relation_entry_t* next = entry->next;
+      delete_relation(entry->relation);
+      free(entry);
+      entry = next;
+    }
+  }
+  free(relations);
+}
+
+void put_relation(relations_t* relations, relation_t* relation) {
+  relation_entry_t** bucket = &relations->buckets[(uint64_t)relation->id % RELATIONS_BUCKETS];
+  for(relation_entry_t* entry = *bucket; entry != NULL; entry = entry->next) {
+    if(entry->relation->id == relation->id) {
+      delete_relation(entry->relation);
+      entry->relation = relation;
+      return;
+    }
+  }
+
+  relation_entry_t* entry = malloc(sizeof(relation_entry_t));
+  entry->relation = relation;
+  entry->next = *bucket;
+  *bucket = entry;
+}
+
+relation_t* get_relation(relations_t* relations, int64_t id) {
+  relation_entry_t* entry = relations->buckets[(uint64_t)id % RELATIONS_BUCKETS];
+  for(; entry != NULL; entry = entry->next) {
+    if(entry->relation->id == id) {
+      return entry->relation;
+    }
+  }
+  return NULL;
+}
+
+// Whether namespace.name of the relation, or *, is one of tables.
+bool relation_selected(relation_t* relation, char** tables, int number_tables) {
+  size_t namespace_size = strlen(relation->namespace);
+  for(int i=0; i<number_tables; i++) {
+    char* table = tables[i];
+    if(strcmp(table, "*") == 0 || (strncmp(table, relation->namespace, namespace_size) == 0
+        && table[namespace_size] == '.' && strcmp(table + namespace_size + 1, relation->name) == 0)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Builds a key from the replica identity columns. Returns NULL when the
+// relation has no key columns or a key value is not known.
+char* relation_key(relation_t* relation, tuples_t* tuples, size_t* key_size) {
+  if(tuples->size != relation->number_columns) {
+    return NULL;
+  }
+
+  size_t size = 0;
+  for(int i=0; i<tuples->size; i++) {
+    if(relation->column_flags[i] & COLUMN_FLAG_KEY) {
+      if(tuples->values[i] == UNCHANGED_STR) {
+        return NULL;
+      }
+      size += strlen(tuples->values[i])+1;
+    }
+  }
+
+  if(size == 0) {
+    return NULL;
+  }
+
+  char* key = malloc(size);
+  char* current = key;
+  for(int i=0; i<tuples->size; i++) {
+    if(relation->column_flags[i] & COLUMN_FLAG_KEY) {
+      size_t length = strlen(tuples->values[i])+1;
+      memcpy(current, tuples->values[i], length);
+      current += length;
+    }
+  }
+
+  *key_size = size;
+  return key;
+}
+
+uint64_t hash_relation_key(int64_t relation_id, char* key, size_t key_size) {
+  uint64_t hash = 14695981039346656037ULL ^ (uint64_t)relation_id;
+  for(size_t i=0; i<key_size; i++) {
+    hash ^= (unsigned char)key[i];
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
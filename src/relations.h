@@ -0,0 +1,24 @@
+#pragma once
+
+#include <stdint.h>
+#include "decoder.h"
+
+#define RELATIONS_BUCKETS 256
+
+typedef struct relation_entry_s {
+  relation_t* relation;
+  struct relation_entry_s* next;
+} relation_entry_t;
+
+typedef struct {
+  relation_entry_t* buckets[RELATIONS_BUCKETS];
+} relations_t;
+
+relations_t* create_relations();
+void delete_relations(relations_t* relations);
+void put_relation(relations_t* relations, relation_t* relation);
+relation_t* get_relation(relations_t* relations, int64_t id);
+
+bool relation_selected(relation_t* relation, char** tables, int number_tables);
+char* relation_key(relation_t* relation, tuples_t* tuples, size_t* key_size);
+uint64_t hash_relation_key(int64_t relation_id, char* key, size_t key_size);
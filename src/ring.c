@@ -0,0 +1,316 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include "logging.h"
+#include "ring.h"
+
+const int RING_WAIT_MS = 100;
+const size_t RING_RECORD_HEADER = 16;
+
+static void futex_wait(atomic_uint* word, unsigned int value, int timeout_ms) {
+  struct timespec timeout = { timeout_ms / 1000, (timeout_ms % 1000) * 1000000L };
+  syscall(SYS_futex, (unsigned int*)word, FUTEX_WAIT, value, &timeout, NULL, 0);
+}
+
+static void futex_wake(atomic_uint* word) {
+  syscall(SYS_futex, (unsigned int*)word, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+static ring_t* map_ring(char* name, int fd, size_t size, bool producer) {
+  void* address = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  if(address == MAP_FAILED) {
+    ERROR("failed to map ring %s: %s", name, strerror(errno));
+    close(fd);
+    return NULL;
+  }
+
+  ring_t* ring = calloc(1, sizeof(ring_t));
+  ring->name = name;
+  ring->fd = fd;
+  ring->header = address;
+  ring->data = (char*)address + RING_DATA_OFFSET;
+  ring->size = size;
+  ring->producer = producer;
+  ring->acknowledged_lsn = -1;
+  atomic_init(&ring->stopped, false);
+  return ring;
+}
+
+ring_t* create_ring(char* name, size_t capacity) {
+  capacity = (capacity + 7) / 8 * 8;
+  int fd = shm_open(name, O_RDWR | O_CREAT | O_TRUNC, 0600);
+  if(fd < 0 || ftruncate(fd, RING_DATA_OFFSET + capacity) < 0) {
+    ERROR("failed to create ring %s: %s", name, strerror(errno));
+    if(fd >= 0) {
+      close(fd);
+    }
+    return NULL;
+  }
+
+  ring_t* ring = map_ring(name, fd, RING_DATA_OFFSET + capacity, true);
+  if(ring == NULL) {
+    return NULL;
+  }
+
+  ring_header_t* header = ring->header;
+  header->version = RING_VERSION;
+  header->max_consumers = RING_MAX_CONSUMERS;
+  header->capacity = capacity;
+  atomic_store(&header->write, 0);
+  atomic_store(&header->tail, 0);
+  atomic_thread_fence(memory_order_release);
+  header->magic = RING_MAGIC;
+  return ring;
+}
+
+ring_t* open_ring(char* name) {
+  int fd = shm_open(name, O_RDWR, 0);
+  off_t size = fd >= 0 ? lseek(fd, 0, SEEK_END) : -1;
+  if(size < RING_DATA_OFFSET) {
+    ERROR("failed to open ring %s", name);
+    if(fd >= 0) {
+      close(fd);
+    }
+    return NULL;
+  }
+
+  ring_t* ring = map_ring(name, fd, size, false);
+  if(ring != NULL && (ring->header->magic != RING_MAGIC || ring->header->version != RING_VERSION)) {
+    ERROR("not a ring: %s", name);
+    delete_ring(ring);
+    return NULL;
+  }
+  return ring;
+}
+
+// Consumers see closed once they read everything published. The name is
+// removed, mappings stay valid until every consumer unmaps them.
+void delete_ring(ring_t* ring) {
+  if(ring->producer) {
+    atomic_store(&ring->header->closed, 1);
+    atomic_fetch_add(&ring->header->data_futex, 1);
+    futex_wake(&ring->header->data_futex);
+    shm_unlink(ring->name);
+  }
+  munmap(ring->header, ring->size);
+  close(ring->fd);
+  free(ring);
+}
+
+// Lowest position of the registered consumers, UINT64_MAX without any.
+// Consumers that exited without unregistering are dropped.
+static uint64_t lowest_position(ring_t* ring) {
+  ring_header_t* header = ring->header;
+  uint64_t tail = UINT64_MAX;
+  for(int i=0; i<RING_MAX_CONSUMERS; i++) {
+    ring_consumer_t* consumer = &header->consumers[i];
+    int pid = atomic_load(&consumer->pid);
+    if(pid == 0) {
+      continue;
+    }
+
+    if(kill(pid, 0) < 0 && errno == ESRCH) {
+      INFO("ring %s consumer %d exited", ring->name, pid);
+      atomic_compare_exchange_strong(&consumer->pid, &pid, 0);
+      continue;
+    }
+
+    uint64_t position = atomic_load_explicit(&consumer->position, memory_order_acquire);
+    if(position < tail) {
+      tail = position;
+    }
+  }
+
+  return tail;
+}
+
+// Moves the tail to the lowest consumer position. Without consumers nothing
+// is read, so the tail stays where it is. A consumer registering meanwhile
+// either sees the new tail and starts there, or is seen by the second look
+// and holds the tail back.
+static uint64_t update_tail(ring_t* ring) {
+  ring_header_t* header = ring->header;
+  uint64_t tail = lowest_position(ring);
+  if(tail == UINT64_MAX) {
+    return atomic_load(&header->tail);
+  }
+  atomic_store(&header->tail, tail);
+
+  uint64_t registered = lowest_position(ring);
+  if(registered < tail) {
+    atomic_store(&header->tail, registered);
+    tail = registered;
+  }
+  return tail;
+}
+
+static size_t record_size(size_t size) {
+  return (RING_RECORD_HEADER + size + 7) / 8 * 8;
+}
+
+static void write_record(ring_t* ring, uint64_t position, uint32_t size, int64_t lsn, char* data) {
+  char* record = ring->data + position % ring->header->capacity;
+  memcpy(record, &size, sizeof(size));
+  memcpy(record + 8, &lsn, sizeof(lsn));
+  if(data != NULL) {
+    memcpy(record + RING_RECORD_HEADER, data, size);
+  }
+}
+
+// Walks the records every consumer read, before the producer reuses them.
+static void advance_acknowledged(ring_t* ring, uint64_t tail) {
+  ring_header_t* header = ring->header;
+  while(ring->acknowledged < tail) {
+    char* record = ring->data + ring->acknowledged % header->capacity;
+    uint32_t size;
+    memcpy(&size, record, sizeof(size));
+    if(size == RING_WRAP) {
+      ring->acknowledged += header->capacity - ring->acknowledged % header->capacity;
+      continue;
+    }
+
+    memcpy(&ring->acknowledged_lsn, record + 8, sizeof(int64_t));
+    ring->acknowledged += record_size(size);
+  }
+}
+
+// Waits until the slowest consumer leaves room for the record, then makes
+// it visible to the consumers.
+int ring_publish(ring_t* ring, char* data, size_t size, int64_t lsn) {
+  ring_header_t* header = ring->header;
+  uint64_t capacity = header->capacity;
+  size_t needed = record_size(size);
+  if(needed > capacity) {
+    ERROR("record of %zu bytes does not fit ring %s", size, ring->name);
+    return -1;
+  }
+
+  uint64_t write = atomic_load(&header->write);
+  uint64_t tail;
+  size_t wrap = capacity - write % capacity < needed ? capacity - write % capacity : 0;
+  while(1) {
+    unsigned int seen = atomic_load(&header->space_futex);
+    tail = update_tail(ring);
+    if(write + wrap + needed - tail <= capacity) {
+      break;
+    }
+    if(atomic_load(&ring->stopped)) {
+      ERROR("ring %s stopped while full", ring->name);
+      return -1;
+    }
+    futex_wait(&header->space_futex, seen, RING_WAIT_MS);
+  }
+  advance_acknowledged(ring, tail);
+
+  if(wrap > 0) {
+    write_record(ring, write, RING_WRAP, 0, NULL);
+    write += wrap;
+  }
+  write_record(ring, write, size, lsn, data);
+  atomic_store_explicit(&header->write, write + needed, memory_order_release);
+
+  atomic_fetch_add(&header->data_futex, 1);
+  if(atomic_load(&header->sleepers) > 0) {
+    futex_wake(&header->data_futex);
+  }
+  return 0;
+}
+
+// Makes a publish waiting for space, now or later, give up.
+void ring_stop(ring_t* ring) {
+  atomic_store(&ring->stopped, true);
+  atomic_fetch_add(&ring->header->space_futex, 1);
+  futex_wake(&ring->header->space_futex);
+}
+
+// Lsn of the newest record read by every registered consumer, -1 before any.
+int64_t ring_acknowledge(ring_t* ring) {
+  advance_acknowledged(ring, update_tail(ring));
+  return ring->acknowledged_lsn;
+}
+
+bool ring_pending(ring_t* ring) {
+  return ring->acknowledged < atomic_load(&ring->header->write);
+}
+
+// Registers a consumer at the oldest record still in the ring and returns
+// its index, or -1 when every slot is taken.
+int ring_register(ring_t* ring) {
+  ring_header_t* header = ring->header;
+  for(int i=0; i<RING_MAX_CONSUMERS; i++) {
+    ring_consumer_t* consumer = &header->consumers[i];
+    int free_pid = 0;
+    if(atomic_compare_exchange_strong(&consumer->pid, &free_pid, getpid())) {
+      uint64_t tail = atomic_load(&header->tail);
+      do {
+        atomic_store(&consumer->position, tail);
+      } while((tail = atomic_load(&header->tail)) > atomic_load(&consumer->position));
+      return i;
+    }
+  }
+  return -1;
+}
+
+void ring_unregister(ring_t* ring, int consumer) {
+  atomic_store(&ring->header->consumers[consumer].pid, 0);
+  atomic_fetch_add(&ring->header->space_futex, 1);
+  futex_wake(&ring->header->space_futex);
+}
+
+// Points data at the next record, in place. Returns its size, 0 once the
+// ring is closed and read to the end, or -1 when nothing arrived in time.
+ssize_t ring_read(ring_t* ring, int consumer, char** data, int64_t* lsn, int timeout_ms) {
+  ring_header_t* header = ring->header;
+  ring_consumer_t* slot = &header->consumers[consumer];
+  uint64_t position = atomic_load(&slot->position);
+  while(1) {
+    unsigned int seen = atomic_load(&header->data_futex);
+    if(position < atomic_load_explicit(&header->write, memory_order_acquire)) {
+      break;
+    }
+    if(atomic_load(&header->closed)) {
+      return 0;
+    }
+    if(timeout_ms <= 0) {
+      return -1;
+    }
+
+    atomic_fetch_add(&header->sleepers, 1);
+    futex_wait(&header->data_futex, seen, timeout_ms);
+    atomic_fetch_sub(&header->sleepers, 1);
+    timeout_ms = 0;
+  }
+
+  char* record = ring->data + position % header->capacity;
+  uint32_t size;
+  memcpy(&size, record, sizeof(size));
+  if(size == RING_WRAP) {
+    position += header->capacity - position % header->capacity;
+    atomic_store(&slot->position, position);
+    return ring_read(ring, consumer, data, lsn, timeout_ms);
+  }
+
+  memcpy(lsn, record + 8, sizeof(*lsn));
+  *data = record + RING_RECORD_HEADER;
+  return size;
+}
+
+// Releases the record returned by the last read.
+void ring_consume(ring_t* ring, int consumer) {
+  ring_header_t* header = ring->header;
+  ring_consumer_t* slot = &header->consumers[consumer];
+  uint64_t position = atomic_load(&slot->position);
+  uint32_t size;
+  memcpy(&size, ring->data + position % header->capacity, sizeof(size));
+  atomic_store_explicit(&slot->position, position + record_size(size), memory_order_release);
+  atomic_fetch_add(&header->space_futex, 1);
+  futex_wake(&header->space_futex);
+}
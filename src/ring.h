@@ -0,0 +1,69 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdatomic.h>
+#include <sys/types.h>
+
+#define RING_MAGIC 0x6c6d793272676f70ULL
+#define RING_VERSION 1
+#define RING_MAX_CONSUMERS 16
+#define RING_DATA_OFFSET 4096
+
+// Position of a consumer, in bytes published, and its pid, 0 when the slot
+// is free. Each consumer has a cache line of its own.
+typedef struct {
+  atomic_uint_fast64_t position;
+  atomic_int pid;
+  char padding[64 - sizeof(atomic_uint_fast64_t) - sizeof(atomic_int)];
+} ring_consumer_t;
+
+// Header of the shared memory object, followed by the records at
+// RING_DATA_OFFSET. Each record is a 4 byte size, 4 bytes of padding, the
+// 8 byte lsn and the data, padded to 8 bytes. A size of RING_WRAP means
+// the next record starts at the beginning of the ring.
+typedef struct {
+  uint64_t magic;
+  uint32_t version;
+  uint32_t max_consumers;
+  uint64_t capacity;
+  atomic_uint_fast64_t write;
+  atomic_uint_fast64_t tail;
+  atomic_uint data_futex;
+  atomic_uint space_futex;
+  atomic_uint sleepers;
+  atomic_uint closed;
+  char padding[64 - 4*sizeof(atomic_uint) - 2*sizeof(atomic_uint_fast64_t) - 24];
+  ring_consumer_t consumers[RING_MAX_CONSUMERS];
+} ring_header_t;
+
+#define RING_WRAP 0xFFFFFFFFu
+
+// Single producer, multiple consumer ring of encoded output in a POSIX
+// shared memory object. Consumers read records in place and the producer
+// waits for the slowest registered one before reusing space.
+typedef struct {
+  char* name;
+  int fd;
+  ring_header_t* header;
+  char* data;
+  size_t size;
+  bool producer;
+  uint64_t acknowledged;
+  int64_t acknowledged_lsn;
+  atomic_bool stopped;
+} ring_t;
+
+ring_t* create_ring(char* name, size_t capacity);
+ring_t* open_ring(char* name);
+void delete_ring(ring_t* ring);
+int ring_publish(ring_t* ring, char* data, size_t size, int64_t lsn);
+int64_t ring_acknowledge(ring_t* ring);
+bool ring_pending(ring_t* ring);
+void ring_stop(ring_t* ring);
+
+int ring_register(ring_t* ring);
+void ring_unregister(ring_t* ring, int consumer);
+ssize_t ring_read(ring_t* ring, int consumer, char** data, int64_t* lsn, int timeout_ms);
+void ring_consume(ring_t* ring, int consumer);
@@ -0,0 +1,211 @@
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "logging.h"
+#include "segment.h"
+
+#define SEGMENT_SUFFIX ".yaml"
+
+static const char* SEGMENT_HEADER = "---\n";
+
+static char* segment_path(segments_t* segments, uint64_t index) {
+  char* path = malloc(strlen(segments->directory) + 32);
+  sprintf(path, "%s/%020lu" SEGMENT_SUFFIX, segments->directory, index);
+  return path;
+}
+
+static int sync_directory(segments_t* segments) {
+  int fd = open(segments->directory, O_RDONLY | O_DIRECTORY);
+  if(fd < 0) {
+    return -1;
+  }
+  int err = fsync(fd);
+  close(fd);
+  return err;
+}
+
+// Cuts the zeros left after the content of a segment that was not sealed.
+static int trim_segment(segments_t* segments, uint64_t index) {
+  char* path = segment_path(segments, index);
+  int fd = open(path, O_RDWR);
+  free(path);
+  if(fd < 0) {
+    return -1;
+  }
+
+  struct stat status;
+  off_t end = 0;
+  if(fstat(fd, &status) == 0 && status.st_size > 0) {
+    char* data = mmap(NULL, status.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    if(data != MAP_FAILED) {
+      end = status.st_size;
+      while(end > 0 && data[end-1] == '\0') {
+        end--;
+      }
+      munmap(data, status.st_size);
+    }
+  }
+
+  int err = ftruncate(fd, end);
+  if(err == 0) {
+    err = fsync(fd);
+  }
+  close(fd);
+  return err;
+}
+
+static int last_segment(segments_t* segments, uint64_t* index) {
+  DIR* directory = opendir(segments->directory);
+  if(directory == NULL) {
+    return -1;
+  }
+
+  int found = 0;
+  struct dirent* entry;
+  while((entry = readdir(directory)) != NULL) {
+    char* end;
+    uint64_t value = strtoull(entry->d_name, &end, 10);
+    if(end != entry->d_name && strcmp(end, SEGMENT_SUFFIX) == 0 && (!found || value > *index)) {
+      *index = value;
+      found = 1;
+    }
+  }
+  closedir(directory);
+  return found;
+}
+
+static int open_segment(segments_t* segments, size_t size) {
+  char* path = segment_path(segments, segments->index);
+  segments->fd = open(path, O_RDWR | O_CREAT | O_EXCL, 0644);
+  if(segments->fd < 0) {
+    ERROR("failed to create segment %s: %s", path, strerror(errno));
+    free(path);
+    return -1;
+  }
+
+  size_t capacity = segments->segment_size;
+  if(size + strlen(SEGMENT_HEADER) > capacity) {
+    capacity = size + strlen(SEGMENT_HEADER);
+  }
+
+  if(fallocate(segments->fd, 0, 0, capacity) < 0 && ftruncate(segments->fd, capacity) < 0) {
+    ERROR("failed to allocate segment %s: %s", path, strerror(errno));
+    free(path);
+    return -1;
+  }
+  free(path);
+
+  segments->data = mmap(NULL, capacity, PROT_READ | PROT_WRITE, MAP_SHARED, segments->fd, 0);
+  if(segments->data == MAP_FAILED) {
+    segments->data = NULL;
+    ERROR("failed to map segment: %s", strerror(errno));
+    return -1;
+  }
+
+  if(fsync(segments->fd) < 0 || sync_directory(segments) < 0) {
+    ERROR("failed to sync segment: %s", strerror(errno));
+    return -1;
+  }
+
+  segments->capacity = capacity;
+  segments->used = strlen(SEGMENT_HEADER);
+  segments->synced = 0;
+  memcpy(segments->data, SEGMENT_HEADER, segments->used);
+  return 0;
+}
+
+// Syncs the rest of the segment and truncates it to its content.
+static int seal_segment(segments_t* segments) {
+  int err = segments_sync(segments);
+  munmap(segments->data, segments->capacity);
+  segments->data = NULL;
+  if(err == 0) {
+    err = ftruncate(segments->fd, segments->used);
+  }
+  if(err == 0) {
+    err = fsync(segments->fd);
+  }
+  close(segments->fd);
+  segments->fd = -1;
+  return err;
+}
+
+segments_t* create_segments(char* directory, size_t segment_size) {
+  segments_t* segments = calloc(1, sizeof(segments_t));
+  segments->directory = directory;
+  segments->segment_size = segment_size;
+  segments->fd = -1;
+
+  if(mkdir(directory, 0755) < 0 && errno != EEXIST) {
+    ERROR("failed to create %s: %s", directory, strerror(errno));
+    free(segments);
+    return NULL;
+  }
+
+  uint64_t index = 0;
+  int found = last_segment(segments, &index);
+  if(found > 0) {
+    if(trim_segment(segments, index) < 0) {
+      ERROR("failed to trim segment %lu: %s", index, strerror(errno));
+    }
+    segments->index = index + 1;
+  }
+
+  if(found < 0 || open_segment(segments, 0) < 0) {
+    delete_segments(segments);
+    return NULL;
+  }
+  return segments;
+}
+
+void delete_segments(segments_t* segments) {
+  if(segments->data != NULL) {
+    seal_segment(segments);
+  }
+  if(segments->fd >= 0) {
+    close(segments->fd);
+  }
+  free(segments);
+}
+
+// Copies the output into the mapping, starting a new segment when it does
+// not fit so records never span segments.
+int segments_write(segments_t* segments, char* data, size_t size) {
+  if(segments->used + size > segments->capacity) {
+    if(seal_segment(segments) < 0) {
+      ERROR("failed to seal segment: %s", strerror(errno));
+      return -1;
+    }
+    segments->index++;
+    if(open_segment(segments, size) < 0) {
+      return -1;
+    }
+  }
+
+  memcpy(segments->data + segments->used, data, size);
+  segments->used += size;
+  return 0;
+}
+
+// Flushes the pages written since the last sync.
+int segments_sync(segments_t* segments) {
+  if(segments->used == segments->synced) {
+    return 0;
+  }
+
+  long page = sysconf(_SC_PAGESIZE);
+  size_t start = segments->synced - segments->synced % page;
+  if(msync(segments->data + start, segments->used - start, MS_SYNC) < 0) {
+    ERROR("failed to sync segment: %s", strerror(errno));
+    return -1;
+  }
+  segments->synced = segments->used;
+  return 0;
+}
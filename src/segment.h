@@ -0,0 +1,24 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+// Output mapped into preallocated segment files of a directory. The active
+// segment is zero past its end, segments are truncated to their content
+// when they are sealed.
+typedef struct {
+  char* directory;
+  size_t segment_size;
+  uint64_t index;
+  int fd;
+  char* data;
+  size_t capacity;
+  size_t used;
+  size_t synced;
+} segments_t;
+
+segments_t* create_segments(char* directory, size_t segment_size);
+void delete_segments(segments_t* segments);
+int segments_write(segments_t* segments, char* data, size_t size);
+int segments_sync(segments_t* segments);
@@ -0,0 +1,292 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include "logging.h"
+#include "server.h"
+
+#define HISTORY_SLOTS 65536
+
+extern const char* OUTPUT_HEADER;
+
+static int listen_unix(char* path) {
+  struct sockaddr_un address = { .sun_family = AF_UNIX };
+  if(strlen(path) >= sizeof(address.sun_path)) {
+    ERROR("unix socket path too long: %s", path);
+    return -1;
+  }
+  strcpy(address.sun_path, path);
+  unlink(path);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if(fd < 0) {
+    ERROR("failed to create unix socket: %s", strerror(errno));
+    return -1;
+  }
+  if(bind(fd, (struct sockaddr*)&address, sizeof(address)) < 0) {
+    ERROR("failed to bind unix socket %s: %s", path, strerror(errno));
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+static int listen_tcp(char* address) {
+  struct sockaddr_in bind_address = { .sin_family = AF_INET, .sin_addr.s_addr = htonl(INADDR_ANY) };
+  char* port = strrchr(address, ':');
+  if(port != NULL) {
+    *port = '\0';
+    if(inet_pton(AF_INET, address, &bind_address.sin_addr) != 1) {
+      ERROR("invalid listen address %s", address);
+      return -1;
+    }
+    port++;
+  } else {
+    port = address;
+  }
+  bind_address.sin_port = htons(atoi(port));
+
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if(fd < 0) {
+    ERROR("failed to create tcp socket: %s", strerror(errno));
+    return -1;
+  }
+
+  int reuse = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+  if(bind(fd, (struct sockaddr*)&bind_address, sizeof(bind_address)) < 0) {
+    ERROR("failed to bind tcp port %s: %s", port, strerror(errno));
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+static void set_nonblocking(int fd) {
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+}
+
+static void remove_subscriber(server_t* server, int index) {
+  close(server->subscribers[index].fd);
+  server->subscribers[index] = server->subscribers[--server->number_subscribers];
+}
+
+static void accept_subscribers(server_t* server) {
+  int fd;
+  while((fd = accept(server->listen_fd, NULL, NULL)) >= 0) {
+    if(server->number_subscribers == MAX_SUBSCRIBERS) {
+      ERROR("too many subscribers");
+      close(fd);
+      continue;
+    }
+
+    set_nonblocking(fd);
+    pthread_mutex_lock(&server->lock);
+    subscriber_t* subscriber = &server->subscribers[server->number_subscribers++];
+    subscriber->fd = fd;
+    subscriber->sequence = server->first_sequence;
+    subscriber->offset = 0;
+    subscriber->header = false;
+    pthread_mutex_unlock(&server->lock);
+    INFO("subscriber connected");
+  }
+}
+
+// Writes as much history as the socket takes. Returns false when the
+// subscriber must be disconnected.
+static bool write_subscriber(server_t* server, subscriber_t* subscriber) {
+  if(!subscriber->header) {
+    size_t size = strlen(OUTPUT_HEADER);
+    if(send(subscriber->fd, OUTPUT_HEADER, size, MSG_NOSIGNAL) != (ssize_t)size) {
+      return false;
+    }
+    subscriber->header = true;
+  }
+
+  while(1) {
+    pthread_mutex_lock(&server->lock);
+    if(subscriber->sequence < server->first_sequence) {
+      pthread_mutex_unlock(&server->lock);
+      INFO("subscriber fell behind the history");
+      return false;
+    }
+    if(subscriber->sequence == server->next_sequence) {
+      pthread_mutex_unlock(&server->lock);
+      return true;
+    }
+    buffer_t* buffer = retain_buffer(server->history[subscriber->sequence % server->history_slots]);
+    pthread_mutex_unlock(&server->lock);
+
+    ssize_t written = 0;
+    if(buffer->size > subscriber->offset) {
+      written = send(subscriber->fd, buffer->data + subscriber->offset, buffer->size - subscriber->offset, MSG_NOSIGNAL);
+    }
+    size_t size = buffer->size;
+    release_buffer(buffer);
+
+    if(written < 0) {
+      return errno == EAGAIN || errno == EWOULDBLOCK;
+    }
+
+    subscriber->offset += written;
+    if(subscriber->offset < size) {
+      return true;
+    }
+    subscriber->sequence++;
+    subscriber->offset = 0;
+  }
+}
+
+static bool pending(server_t* server, subscriber_t* subscriber) {
+  pthread_mutex_lock(&server->lock);
+  bool result = !subscriber->header || subscriber->sequence != server->next_sequence;
+  pthread_mutex_unlock(&server->lock);
+  return result;
+}
+
+static void* run_server(void* arg) {
+  server_t* server = arg;
+  struct pollfd fds[MAX_SUBSCRIBERS + 2];
+  char discard[256];
+
+  while(!atomic_load(&server->closed)) {
+    fds[0] = (struct pollfd){ .fd = server->listen_fd, .events = POLLIN };
+    fds[1] = (struct pollfd){ .fd = server->wake_fd[0], .events = POLLIN };
+    int number_subscribers = server->number_subscribers;
+    for(int i=0; i<number_subscribers; i++) {
+      short events = POLLIN;
+      if(pending(server, &server->subscribers[i])) {
+        events |= POLLOUT;
+      }
+      fds[i+2] = (struct pollfd){ .fd = server->subscribers[i].fd, .events = events };
+    }
+
+    if(poll(fds, number_subscribers + 2, 1000) < 0 && errno != EINTR) {
+      ERROR("server poll failed: %s", strerror(errno));
+      break;
+    }
+
+    if(fds[1].revents & POLLIN) {
+      while(read(server->wake_fd[0], discard, sizeof(discard)) > 0);
+    }
+
+    for(int i=number_subscribers-1; i>=0; i--) {
+      subscriber_t* subscriber = &server->subscribers[i];
+      bool connected = true;
+      if(fds[i+2].revents & (POLLHUP | POLLERR)) {
+        connected = false;
+      } else if(fds[i+2].revents & POLLIN) {
+        ssize_t size = read(subscriber->fd, discard, sizeof(discard));
+        connected = size > 0 || (size < 0 && errno == EAGAIN);
+      }
+
+      if(connected && pending(server, subscriber)) {
+        connected = write_subscriber(server, subscriber);
+      }
+
+      if(!connected) {
+        remove_subscriber(server, i);
+      }
+    }
+
+    if(fds[0].revents & POLLIN) {
+      accept_subscribers(server);
+    }
+  }
+
+  return NULL;
+}
+
+server_t* create_server(char* address, size_t history_limit) {
+  int fd;
+  if(strncmp(address, "unix:", 5) == 0) {
+    fd = listen_unix(address + 5);
+  } else if(strncmp(address, "tcp:", 4) == 0) {
+    char* tcp_address = strdup(address + 4);
+    fd = listen_tcp(tcp_address);
+    free(tcp_address);
+  } else {
+    ERROR("unknown server address: %s", address);
+    return NULL;
+  }
+
+  if(fd < 0) {
+    return NULL;
+  }
+  if(listen(fd, 128) < 0) {
+    ERROR("failed to listen on %s: %s", address, strerror(errno));
+    close(fd);
+    return NULL;
+  }
+
+  server_t* server = calloc(1, sizeof(server_t));
+  server->listen_fd = fd;
+  set_nonblocking(fd);
+  if(pipe(server->wake_fd) < 0) {
+    close(fd);
+    free(server);
+    return NULL;
+  }
+  set_nonblocking(server->wake_fd[0]);
+  set_nonblocking(server->wake_fd[1]);
+
+  server->history_slots = HISTORY_SLOTS;
+  server->history = calloc(server->history_slots, sizeof(buffer_t*));
+  server->history_limit = history_limit;
+  atomic_init(&server->closed, false);
+  pthread_mutex_init(&server->lock, NULL);
+  pthread_create(&server->thread, NULL, run_server, server);
+  INFO("serving changes on %s", address);
+  return server;
+}
+
+void server_publish(server_t* server, buffer_t* buffer) {
+  if(buffer->size == 0) {
+    return;
+  }
+
+  pthread_mutex_lock(&server->lock);
+  server->history[server->next_sequence % server->history_slots] = retain_buffer(buffer);
+  server->next_sequence++;
+  server->history_bytes += buffer->size;
+
+  while(server->first_sequence < server->next_sequence
+      && (server->history_bytes > server->history_limit || server->next_sequence - server->first_sequence > server->history_slots - 1)) {
+    buffer_t* oldest = server->history[server->first_sequence % server->history_slots];
+    server->history_bytes -= oldest->size;
+    release_buffer(oldest);
+    server->first_sequence++;
+  }
+  pthread_mutex_unlock(&server->lock);
+
+  if(write(server->wake_fd[1], "", 1) < 0 && errno != EAGAIN) {
+    ERROR("failed to wake server");
+  }
+}
+
+void close_server(server_t* server) {
+  atomic_store(&server->closed, true);
+  if(write(server->wake_fd[1], "", 1) < 0 && errno != EAGAIN) {
+    ERROR("failed to wake server");
+  }
+  pthread_join(server->thread, NULL);
+}
+
+void delete_server(server_t* server) {
+  while(server->number_subscribers > 0) {
+    remove_subscriber(server, server->number_subscribers - 1);
+  }
+  for(uint64_t sequence = server->first_sequence; sequence < server->next_sequence; sequence++) {
+    release_buffer(server->history[sequence % server->history_slots]);
+  }
+  close(server->listen_fd);
+  close(server->wake_fd[0]);
+  close(server->wake_fd[1]);
+  pthread_mutex_destroy(&server->lock);
+  free(server->history);
+  free(server);
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "sink.h"
+
+#define MAX_SUBSCRIBERS 1024
+
+typedef struct {
+  int fd;
+  uint64_t sequence;
+  size_t offset;
+  bool header;
+} subscriber_t;
+
+// Serves the encoded stream to subscribers on a unix or tcp socket. Buffers are
+// kept in a history bounded in bytes, each subscriber has its own cursor into
+// it and is disconnected when it falls behind the oldest buffer kept.
+typedef struct server_s {
+  int listen_fd;
+  int wake_fd[2];
+  pthread_t thread;
+  pthread_mutex_t lock;
+  buffer_t** history;
+  size_t history_slots;
+  uint64_t first_sequence;
+  uint64_t next_sequence;
+  size_t history_bytes;
+  size_t history_limit;
+  subscriber_t subscribers[MAX_SUBSCRIBERS];
+  int number_subscribers;
+  atomic_bool closed;
+} server_t;
+
+server_t* create_server(char* address, size_t history_limit);
+void delete_server(server_t* server);
+void server_publish(server_t* server, buffer_t* buffer);
+void close_server(server_t* server);
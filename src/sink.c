@@ -0,0 +1,612 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include "logging.h"
+#include "sink.h"
+#include "server.h"
+
+#define SINK_BATCH 64
+#define RING_POLL_MS 10
+
+const char* OUTPUT_HEADER = "---\n";
+
+buffer_t* create_buffer(char* data, size_t size, int64_t lsn) {
+  buffer_t* buffer = malloc(sizeof(buffer_t));
+  atomic_init(&buffer->references, 1);
+  buffer->data = data;
+  buffer->size = size;
+  buffer->lsn = lsn;
+  buffer->timestamp = 0;
+  return buffer;
+}
+
+buffer_t* retain_buffer(buffer_t* buffer) {
+  atomic_fetch_add(&buffer->references, 1);
+  return buffer;
+}
+
+void release_buffer(buffer_t* buffer) {
+  if(atomic_fetch_sub(&buffer->references, 1) == 1) {
+    free(buffer->data);
+    free(buffer);
+  }
+}
+
+static void record_latency(histogram_t* histogram, buffer_t** buffers, int count) {
+  int64_t now = postgres_now();
+  for(int i=0; i<count; i++) {
+    if(buffers[i]->timestamp > 0) {
+      histogram_record(histogram, now - buffers[i]->timestamp);
+    }
+  }
+}
+
+static void record_slot_latency(histogram_t* histogram, uring_slot_t* slot) {
+  int64_t now = postgres_now();
+  for(int i=0; i<slot->number_timestamps; i++) {
+    histogram_record(histogram, now - slot->timestamps[i]);
+  }
+}
+
+static void complete_slot(void* arg, uring_slot_t* slot, bool synced) {
+  sink_t* sink = arg;
+  if(slot->failed) {
+    atomic_store(&sink->failed, true);
+    return;
+  }
+
+  if(sink->latency != NULL) {
+    record_slot_latency(synced ? sink->latency->flushed : sink->latency->written, slot);
+  }
+  if(synced) {
+    atomic_store(&sink->durable_lsn, slot->lsn);
+  }
+}
+
+// Writes and syncs stay in flight while the next buffers are taken, the
+// durable position moves as the syncs complete.
+static void write_uring(sink_t* sink, buffer_t** buffers, int count) {
+  for(int i=0; i<count && !atomic_load(&sink->failed); i++) {
+    buffer_t* buffer = buffers[i];
+    if(uring_append(sink->uring, buffer->data, buffer->size, buffer->lsn, buffer->timestamp) < 0) {
+      atomic_store(&sink->failed, true);
+    }
+  }
+
+  if(!atomic_load(&sink->failed) && (uring_submit(sink->uring) < 0 || uring_reap(sink->uring, false) < 0)) {
+    atomic_store(&sink->failed, true);
+  }
+}
+
+// The buffers taken together form a commit group, synced with one msync.
+static void write_segments(sink_t* sink, buffer_t** buffers, int count) {
+  for(int i=0; i<count && !atomic_load(&sink->failed); i++) {
+    if(segments_write(sink->segments, buffers[i]->data, buffers[i]->size) < 0) {
+      atomic_store(&sink->failed, true);
+    }
+  }
+  if(atomic_load(&sink->failed)) {
+    return;
+  }
+
+  if(sink->latency != NULL) {
+    record_latency(sink->latency->written, buffers, count);
+  }
+  if(segments_sync(sink->segments) < 0) {
+    atomic_store(&sink->failed, true);
+    return;
+  }
+
+  atomic_store(&sink->durable_lsn, buffers[count-1]->lsn);
+  if(sink->latency != NULL) {
+    record_latency(sink->latency->flushed, buffers, count);
+  }
+}
+
+// Moves the durable position to the newest record every consumer read.
+static void acknowledge_ring(sink_t* sink) {
+  int64_t lsn = ring_acknowledge(sink->ring);
+  if(lsn > 0) {
+    atomic_store(&sink->durable_lsn, lsn);
+  }
+}
+
+static void write_ring(sink_t* sink, buffer_t** buffers, int count) {
+  for(int i=0; i<count && !atomic_load(&sink->failed); i++) {
+    if(ring_publish(sink->ring, buffers[i]->data, buffers[i]->size, buffers[i]->lsn) < 0) {
+      atomic_store(&sink->failed, true);
+    }
+  }
+  if(atomic_load(&sink->failed)) {
+    return;
+  }
+
+  if(sink->latency != NULL) {
+    record_latency(sink->latency->written, buffers, count);
+  }
+  acknowledge_ring(sink);
+}
+
+static bool ring_busy(sink_t* sink) {
+  return sink->ring != NULL && !atomic_load(&sink->failed) && ring_pending(sink->ring);
+}
+
+static int64_t monotonic_ms() {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec * 1000LL + now.tv_nsec / 1000000;
+}
+
+static void track_unsynced(sink_t* sink, buffer_t** buffers, int count) {
+  for(int i=0; i<count; i++) {
+    if(buffers[i]->timestamp > 0) {
+      if(sink->number_unsynced == sink->capacity_unsynced) {
+        sink->capacity_unsynced = sink->capacity_unsynced > 0 ? sink->capacity_unsynced * 2 : 64;
+        sink->unsynced_timestamps = realloc(sink->unsynced_timestamps, sink->capacity_unsynced * sizeof(int64_t));
+      }
+      sink->unsynced_timestamps[sink->number_unsynced++] = buffers[i]->timestamp;
+    }
+  }
+  sink->unsynced_lsn = buffers[count-1]->lsn;
+  sink->unsynced = true;
+}
+
+// One fdatasync covers every commit written since the last one. Outputs that
+// can not be synced, like pipes, count as synced once written.
+static void sync_file(sink_t* sink) {
+  if(fdatasync(sink->fd) < 0 && errno != EINVAL && errno != EROFS) {
+    ERROR("failed to sync sink %s: %s", sink->target, strerror(errno));
+    atomic_store(&sink->failed, true);
+  } else {
+    atomic_store(&sink->durable_lsn, sink->unsynced_lsn);
+    if(sink->latency != NULL) {
+      int64_t now = postgres_now();
+      for(int i=0; i<sink->number_unsynced; i++) {
+        histogram_record(sink->latency->flushed, now - sink->unsynced_timestamps[i]);
+      }
+    }
+  }
+
+  sink->unsynced = false;
+  sink->number_unsynced = 0;
+  sink->synced_at = monotonic_ms();
+}
+
+static int sync_remaining_ms(sink_t* sink) {
+  return sink->synced_at + sink->sync_interval - monotonic_ms();
+}
+
+static bool uring_busy(sink_t* sink) {
+  return sink->uring != NULL && !atomic_load(&sink->failed) && uring_pending(sink->uring);
+}
+
+static void wait_uring(sink_t* sink) {
+  if(uring_submit(sink->uring) < 0 || uring_reap(sink->uring, true) < 0) {
+    atomic_store(&sink->failed, true);
+  }
+}
+
+static int open_unix(char* path) {
+  struct sockaddr_un address = { .sun_family = AF_UNIX };
+  if(strlen(path) >= sizeof(address.sun_path)) {
+    ERROR("unix socket path too long: %s", path);
+    return -1;
+  }
+  strcpy(address.sun_path, path);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if(fd < 0 || connect(fd, (struct sockaddr*)&address, sizeof(address)) < 0) {
+    ERROR("failed to connect unix socket %s", path);
+    if(fd >= 0) {
+      close(fd);
+    }
+    return -1;
+  }
+  return fd;
+}
+
+static int open_sink(sink_t* sink, char* spec, options_t* options) {
+  if(strncmp(spec, "file:", 5) == 0) {
+    sink->type = SINK_FILE;
+    sink->target = spec + 5;
+    if(strcmp(sink->target, "-") == 0) {
+      sink->fd = STDOUT_FILENO;
+    } else {
+      sink->fd = open(sink->target, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    }
+  } else if(strncmp(spec, "pipe:", 5) == 0) {
+    sink->type = SINK_PIPE;
+    sink->target = spec + 5;
+    sink->pipe = popen(sink->target, "w");
+    sink->fd = sink->pipe != NULL ? fileno(sink->pipe) : -1;
+  } else if(strncmp(spec, "unix:", 5) == 0) {
+    sink->type = SINK_UNIX;
+    sink->target = spec + 5;
+    sink->fd = open_unix(sink->target);
+  } else if(strncmp(spec, "uring:", 6) == 0) {
+    sink->type = SINK_URING;
+    sink->target = spec + 6;
+    sink->fd = open(sink->target, O_WRONLY | O_CREAT, 0644);
+    if(sink->fd >= 0) {
+      sink->uring = create_uring(sink->fd, complete_slot, sink);
+    }
+    if(sink->fd >= 0 && sink->uring == NULL) {
+      INFO("writing %s without io_uring", sink->target);
+      sink->type = SINK_FILE;
+      sink->sync = true;
+    }
+  } else if(strncmp(spec, "segment:", 8) == 0) {
+    sink->type = SINK_SEGMENT;
+    sink->target = spec + 8;
+    sink->segments = create_segments(sink->target, options->segment_size);
+    return sink->segments != NULL ? 0 : -1;
+  } else if(strncmp(spec, "shm:", 4) == 0) {
+    sink->type = SINK_SHM;
+    sink->target = spec + 4;
+    sink->ring = create_ring(sink->target, options->shm_size);
+    return sink->ring != NULL ? 0 : -1;
+  } else if(strncmp(spec, "server:", 7) == 0) {
+    sink->type = SINK_SERVER;
+    sink->target = spec + 7;
+    sink->server = create_server(sink->target, options->history_size);
+    return sink->server != NULL ? 0 : -1;
+  } else {
+    ERROR("unknown sink: %s", spec);
+    return -1;
+  }
+
+  if(sink->fd < 0) {
+    ERROR("failed to open sink: %s", spec);
+    return -1;
+  }
+  return 0;
+}
+
+static int write_all(sink_t* sink, struct iovec* iov, int count) {
+  while(count > 0) {
+    ssize_t written = writev(sink->fd, iov, count);
+    if(written < 0) {
+      if(errno == EINTR) {
+        continue;
+      }
+      ERROR("failed to write sink %s: %s", sink->target, strerror(errno));
+      return -1;
+    }
+
+    while(count > 0 && (size_t)written >= iov->iov_len) {
+      written -= iov->iov_len;
+      iov++;
+      count--;
+    }
+    if(count > 0) {
+      iov->iov_base = (char*)iov->iov_base + written;
+      iov->iov_len -= written;
+    }
+  }
+  return 0;
+}
+
+static void* run_sink(void* arg) {
+  sink_t* sink = arg;
+  struct iovec iov[SINK_BATCH];
+  buffer_t* buffers[SINK_BATCH];
+
+  char* header = (char*)OUTPUT_HEADER;
+  iov[0].iov_base = header;
+  iov[0].iov_len = strlen(header);
+  if(sink->type == SINK_SHM) {
+    if(ring_publish(sink->ring, header, strlen(header), 0) < 0) {
+      atomic_store(&sink->failed, true);
+    }
+  } else if(sink->type == SINK_URING) {
+    if(uring_append(sink->uring, header, strlen(header), 0, 0) < 0) {
+      atomic_store(&sink->failed, true);
+    }
+  } else if(sink->type != SINK_SERVER && sink->type != SINK_SEGMENT && write_all(sink, iov, 1) < 0) {
+    atomic_store(&sink->failed, true);
+  }
+
+  while(1) {
+    pthread_mutex_lock(&sink->lock);
+    sink->writing = uring_busy(sink) || ring_busy(sink) || sink->unsynced;
+    while(sink->head == NULL && !sink->closed) {
+      if(ring_busy(sink)) {
+        pthread_mutex_unlock(&sink->lock);
+        acknowledge_ring(sink);
+        pthread_mutex_lock(&sink->lock);
+        sink->writing = ring_busy(sink);
+        if(sink->writing && sink->head == NULL && !sink->closed) {
+          struct timespec deadline;
+          clock_gettime(CLOCK_REALTIME, &deadline);
+          deadline.tv_nsec += RING_POLL_MS * 1000000L;
+          deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+          deadline.tv_nsec %= 1000000000L;
+          pthread_cond_timedwait(&sink->ready, &sink->lock, &deadline);
+        }
+        continue;
+      }
+      if(uring_busy(sink)) {
+        pthread_mutex_unlock(&sink->lock);
+        wait_uring(sink);
+        pthread_mutex_lock(&sink->lock);
+        sink->writing = uring_busy(sink);
+        continue;
+      }
+      if(sink->unsynced) {
+        int remaining = sync_remaining_ms(sink);
+        if(remaining <= 0) {
+          pthread_mutex_unlock(&sink->lock);
+          sync_file(sink);
+          pthread_mutex_lock(&sink->lock);
+          sink->writing = false;
+          continue;
+        }
+        struct timespec deadline;
+        clock_gettime(CLOCK_REALTIME, &deadline);
+        deadline.tv_nsec += remaining * 1000000L;
+        deadline.tv_sec += deadline.tv_nsec / 1000000000L;
+        deadline.tv_nsec %= 1000000000L;
+        pthread_cond_timedwait(&sink->ready, &sink->lock, &deadline);
+        continue;
+      }
+      pthread_cond_wait(&sink->ready, &sink->lock);
+    }
+    if(sink->head == NULL) {
+      pthread_mutex_unlock(&sink->lock);
+      while(uring_busy(sink)) {
+        wait_uring(sink);
+      }
+      if(sink->unsynced) {
+        sync_file(sink);
+      }
+      if(sink->ring != NULL) {
+        acknowledge_ring(sink);
+      }
+      break;
+    }
+
+    int count = 0;
+    while(sink->head != NULL && count < SINK_BATCH) {
+      sink_entry_t* entry = sink->head;
+      sink->head = entry->next;
+      buffers[count++] = entry->buffer;
+      sink->pending -= entry->buffer->size;
+      free(entry);
+    }
+    if(sink->head == NULL) {
+      sink->tail = NULL;
+    }
+    sink->writing = true;
+    pthread_cond_broadcast(&sink->space);
+    pthread_mutex_unlock(&sink->lock);
+
+    if(sink->type == SINK_SEGMENT) {
+      write_segments(sink, buffers, count);
+      for(int i=0; i<count; i++) {
+        release_buffer(buffers[i]);
+      }
+      continue;
+    }
+
+    if(sink->type == SINK_SHM) {
+      write_ring(sink, buffers, count);
+      for(int i=0; i<count; i++) {
+        release_buffer(buffers[i]);
+      }
+      continue;
+    }
+
+    if(sink->type == SINK_URING) {
+      write_uring(sink, buffers, count);
+      for(int i=0; i<count; i++) {
+        release_buffer(buffers[i]);
+      }
+      continue;
+    }
+
+    int iov_count = 0;
+    for(int i=0; i<count; i++) {
+      if(sink->type == SINK_SERVER) {
+        server_publish(sink->server, buffers[i]);
+      } else if(buffers[i]->size > 0) {
+        iov[iov_count].iov_base = buffers[i]->data;
+        iov[iov_count].iov_len = buffers[i]->size;
+        iov_count++;
+      }
+    }
+
+    if(!atomic_load(&sink->failed) && iov_count > 0 && write_all(sink, iov, iov_count) < 0) {
+      atomic_store(&sink->failed, true);
+    }
+
+    if(!atomic_load(&sink->failed) && sink->latency != NULL) {
+      record_latency(sink->latency->written, buffers, count);
+    }
+
+    if(!atomic_load(&sink->failed) && sink->sync) {
+      track_unsynced(sink, buffers, count);
+      if(sync_remaining_ms(sink) <= 0) {
+        sync_file(sink);
+      }
+    } else if(!atomic_load(&sink->failed)) {
+      atomic_store(&sink->durable_lsn, buffers[count-1]->lsn);
+      if(sink->latency != NULL) {
+        record_latency(sink->latency->flushed, buffers, count);
+      }
+    }
+
+    for(int i=0; i<count; i++) {
+      release_buffer(buffers[i]);
+    }
+  }
+
+  return NULL;
+}
+
+sink_t* create_sink(char* spec, options_t* options) {
+  sink_t* sink = calloc(1, sizeof(sink_t));
+  if(open_sink(sink, spec, options) < 0) {
+    free(sink);
+    return NULL;
+  }
+
+  sink->capacity = options->queue_size;
+  sink->sync = sink->sync || (options->durable && sink->type == SINK_FILE);
+  sink->sync_interval = options->sync_interval;
+  atomic_init(&sink->failed, false);
+  atomic_init(&sink->durable_lsn, 0);
+  pthread_mutex_init(&sink->lock, NULL);
+  pthread_cond_init(&sink->ready, NULL);
+  pthread_cond_init(&sink->space, NULL);
+  pthread_create(&sink->thread, NULL, run_sink, sink);
+  return sink;
+}
+
+void close_sink(sink_t* sink) {
+  pthread_mutex_lock(&sink->lock);
+  sink->closed = true;
+  pthread_cond_signal(&sink->ready);
+  pthread_mutex_unlock(&sink->lock);
+  if(sink->type == SINK_SHM) {
+    ring_stop(sink->ring);
+  }
+  pthread_join(sink->thread, NULL);
+  if(sink->type == SINK_SERVER) {
+    close_server(sink->server);
+  }
+}
+
+void delete_sink(sink_t* sink) {
+  switch(sink->type) {
+    case SINK_PIPE:
+      pclose(sink->pipe);
+      break;
+    case SINK_SERVER:
+      delete_server(sink->server);
+      break;
+    case SINK_SEGMENT:
+      delete_segments(sink->segments);
+      break;
+    case SINK_SHM:
+      delete_ring(sink->ring);
+      break;
+    case SINK_URING:
+      delete_uring(sink->uring);
+      close(sink->fd);
+      break;
+    default:
+      if(sink->fd != STDOUT_FILENO) {
+        close(sink->fd);
+      }
+  }
+
+  pthread_cond_destroy(&sink->space);
+  pthread_cond_destroy(&sink->ready);
+  pthread_mutex_destroy(&sink->lock);
+  free(sink->unsynced_timestamps);
+  free(sink);
+}
+
+void sink_push(sink_t* sink, buffer_t* buffer) {
+  sink_entry_t* entry = malloc(sizeof(sink_entry_t));
+  entry->buffer = retain_buffer(buffer);
+  entry->next = NULL;
+
+  pthread_mutex_lock(&sink->lock);
+  while(sink->head != NULL && sink->pending + buffer->size > sink->capacity && !atomic_load(&sink->failed)) {
+    pthread_cond_wait(&sink->space, &sink->lock);
+  }
+
+  if(sink->tail != NULL) {
+    sink->tail->next = entry;
+  } else {
+    sink->head = entry;
+  }
+  sink->tail = entry;
+  sink->pending += buffer->size;
+  pthread_cond_signal(&sink->ready);
+  pthread_mutex_unlock(&sink->lock);
+}
+
+bool sink_idle(sink_t* sink) {
+  pthread_mutex_lock(&sink->lock);
+  bool idle = sink->head == NULL && !sink->writing;
+  pthread_mutex_unlock(&sink->lock);
+  return idle;
+}
+
+sinks_t* create_sinks(char** specs, int size, options_t* options) {
+  sinks_t* sinks = calloc(1, sizeof(sinks_t));
+  for(int i=0; i<size && i<MAX_SINKS; i++) {
+    sink_t* sink = create_sink(specs[i], options);
+    if(sink == NULL) {
+      close_sinks(sinks);
+      delete_sinks(sinks);
+      return NULL;
+    }
+    sinks->sinks[sinks->size++] = sink;
+  }
+  return sinks;
+}
+
+void delete_sinks(sinks_t* sinks) {
+  for(int i=0; i<sinks->size; i++) {
+    delete_sink(sinks->sinks[i]);
+  }
+  free(sinks);
+}
+
+// Hands the buffer to every sink and drops the reference of the caller.
+void sinks_push(sinks_t* sinks, buffer_t* buffer) {
+  for(int i=0; i<sinks->size; i++) {
+    sink_push(sinks->sinks[i], buffer);
+  }
+  release_buffer(buffer);
+}
+
+int64_t sinks_durable_lsn(sinks_t* sinks) {
+  int64_t lsn = INT64_MAX;
+  for(int i=0; i<sinks->size; i++) {
+    int64_t durable = atomic_load(&sinks->sinks[i]->durable_lsn);
+    if(durable < lsn) {
+      lsn = durable;
+    }
+  }
+  return sinks->size > 0 ? lsn : 0;
+}
+
+bool sinks_idle(sinks_t* sinks) {
+  for(int i=0; i<sinks->size; i++) {
+    if(!sink_idle(sinks->sinks[i])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool sinks_failed(sinks_t* sinks) {
+  for(int i=0; i<sinks->size; i++) {
+    if(atomic_load(&sinks->sinks[i]->failed)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void close_sinks(sinks_t* sinks) {
+  for(int i=0; i<sinks->size; i++) {
+    close_sink(sinks->sinks[i]);
+  }
+}
+
+// Records the commit delay of every buffer each sink writes, in histograms of
+// its own. Call it before the first buffer is pushed.
+void sinks_track_latency(sinks_t* sinks, latency_t* latency) {
+  for(int i=0; i<sinks->size; i++) {
+    sinks->sinks[i]->latency = latency_add_sink(latency, sinks->sinks[i]->target);
+  }
+}
@@ -0,0 +1,92 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include "options.h"
+#include "latency.h"
+#include "uring.h"
+#include "segment.h"
+#include "ring.h"
+
+// Encoded output shared by every sink. It is immutable once created and freed
+// when the last sink releases it. The timestamp is the commit time of the
+// oldest transaction it completes, zero when it completes none.
+typedef struct {
+  atomic_int references;
+  char* data;
+  size_t size;
+  int64_t lsn;
+  int64_t timestamp;
+} buffer_t;
+
+buffer_t* create_buffer(char* data, size_t size, int64_t lsn);
+buffer_t* retain_buffer(buffer_t* buffer);
+void release_buffer(buffer_t* buffer);
+
+typedef enum { SINK_FILE, SINK_PIPE, SINK_UNIX, SINK_SERVER, SINK_URING, SINK_SEGMENT, SINK_SHM } sink_type_t;
+
+struct server_s;
+
+typedef struct sink_entry_s {
+  buffer_t* buffer;
+  struct sink_entry_s* next;
+} sink_entry_t;
+
+// Output written by its own thread from a queue of buffers. The durable
+// position is the lsn of the last buffer handed to the destination, or
+// synced to it for io_uring, segment and durable file sinks, or read by
+// every registered consumer for shared memory sinks.
+typedef struct {
+  char* target;
+  sink_type_t type;
+  int fd;
+  FILE* pipe;
+  struct server_s* server;
+  uring_t* uring;
+  segments_t* segments;
+  ring_t* ring;
+  pthread_t thread;
+  pthread_mutex_t lock;
+  pthread_cond_t ready;
+  pthread_cond_t space;
+  sink_entry_t* head;
+  sink_entry_t* tail;
+  size_t pending;
+  size_t capacity;
+  bool closed;
+  bool writing;
+  atomic_bool failed;
+  atomic_int_fast64_t durable_lsn;
+  sink_latency_t* latency;
+  bool sync;
+  int sync_interval;
+  bool unsynced;
+  int64_t unsynced_lsn;
+  int64_t synced_at;
+  int64_t* unsynced_timestamps;
+  int number_unsynced;
+  int capacity_unsynced;
+} sink_t;
+
+sink_t* create_sink(char* spec, options_t* options);
+void delete_sink(sink_t* sink);
+void sink_push(sink_t* sink, buffer_t* buffer);
+bool sink_idle(sink_t* sink);
+void close_sink(sink_t* sink);
+
+typedef struct {
+  sink_t* sinks[MAX_SINKS];
+  int size;
+} sinks_t;
+
+sinks_t* create_sinks(char** specs, int size, options_t* options);
+void delete_sinks(sinks_t* sinks);
+void sinks_push(sinks_t* sinks, buffer_t* buffer);
+int64_t sinks_durable_lsn(sinks_t* sinks);
+bool sinks_idle(sinks_t* sinks);
+bool sinks_failed(sinks_t* sinks);
+void sinks_track_latency(sinks_t* sinks, latency_t* latency);
+void close_sinks(sinks_t* sinks);
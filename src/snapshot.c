@@ -0,0 +1,408 @@
+#include <stdio.h>
+#include <ctype.h>
+#include <pthread.h>
+#include "logging.h"
+#include "connection.h"
+#include "snapshot.h"
+#include "checksum.h"
+
+const int SNAPSHOT_SPLIT_PAGES = 16384;
+const long SNAPSHOT_BATCH_LIMIT = 1024*1024;
+
+const char* CREATE_SNAPSHOT_SLOT_COMMAND = "CREATE_REPLICATION_SLOT \"%s\" LOGICAL pgoutput EXPORT_SNAPSHOT";
+const char* PUBLICATION_TABLES_QUERY =
+  "SELECT c.oid, n.nspname, c.relname, c.relreplident, c.relkind, "
+  "pg_relation_size(c.oid) / current_setting('block_size')::int "
+  "FROM pg_publication_tables p "
+  "JOIN pg_namespace n ON n.nspname = p.schemaname "
+  "JOIN pg_class c ON c.relnamespace = n.oid AND c.relname = p.tablename "
+  "WHERE p.pubname = $1";
+const char* TABLE_COLUMNS_QUERY =
+  "SELECT a.attname, COALESCE(a.attnum = ANY(i.indkey), false) OR c.relreplident = 'f', a.atttypid "
+  "FROM pg_attribute a "
+  "JOIN pg_class c ON c.oid = a.attrelid "
+  "LEFT JOIN pg_index i ON i.indrelid = c.oid "
+  "AND ((c.relreplident = 'd' AND i.indisprimary) OR (c.relreplident = 'i' AND i.indisreplident)) "
+  "WHERE a.attrelid = $1 AND a.attnum > 0 AND NOT a.attisdropped AND a.attgenerated = '' "
+  "ORDER BY a.attnum";
+
+static int begin_snapshot(PGconn *conn, char* snapshot_name) {
+  PGresult* result = PQexec(conn, "BEGIN ISOLATION LEVEL REPEATABLE READ READ ONLY");
+  int status = PQresultStatus(result);
+  PQclear(result);
+  if(status != PGRES_COMMAND_OK) {
+    ERROR("failed to begin snapshot: %s", PQerrorMessage(conn));
+    return ERR_QUERY;
+  }
+
+  char* literal = PQescapeLiteral(conn, snapshot_name, strlen(snapshot_name));
+  char command[256];
+  snprintf(command, sizeof(command), "SET TRANSACTION SNAPSHOT %s", literal);
+  PQfreemem(literal);
+
+  result = PQexec(conn, command);
+  status = PQresultStatus(result);
+  PQclear(result);
+  if(status != PGRES_COMMAND_OK) {
+    ERROR("failed to set snapshot: %s", PQerrorMessage(conn));
+    return ERR_QUERY;
+  }
+  return 0;
+}
+
+static char unescape(char** current, char* end) {
+  char value = **current;
+  switch(value) {
+    case 'b': return '\b';
+    case 'f': return '\f';
+    case 'n': return '\n';
+    case 'r': return '\r';
+    case 't': return '\t';
+    case 'v': return '\v';
+    case 'x':
+      value = 0;
+      for(int i=0; i<2 && *current + 1 < end && isxdigit((unsigned char)(*current)[1]); i++) {
+        (*current)++;
+        char digit = **current;
+        value = value * 16 + (isdigit((unsigned char)digit) ? digit - '0' : tolower(digit) - 'a' + 10);
+      }
+      return value;
+    default:
+      if(value >= '0' && value <= '7') {
+        value -= '0';
+        for(int i=0; i<2 && *current + 1 < end && (*current)[1] >= '0' && (*current)[1] <= '7'; i++) {
+          (*current)++;
+          value = value * 8 + (**current - '0');
+        }
+      }
+      return value;
+  }
+}
+
+// Parses a row of COPY text format into the tuples printed for inserts.
+tuples_t* parse_copy_row(char* line, size_t size) {
+  char* end = line + size;
+  if(size > 0 && end[-1] == '\n') {
+    end--;
+  }
+
+  tuples_t* tuples = malloc(sizeof(tuples_t));
+  tuples->size = 1;
+  for(char* current = line; current < end; current++) {
+    if(*current == '\t') {
+      tuples->size++;
+    }
+  }
+  tuples->values = calloc(tuples->size, sizeof(char*));
+
+  char* current = line;
+  for(int i=0; i<tuples->size; i++) {
+    char* field_end = memchr(current, '\t', end - current);
+    if(field_end == NULL) {
+      field_end = end;
+    }
+
+    if(field_end - current == 2 && current[0] == '\\' && current[1] == 'N') {
+      tuples->values[i] = (char*)NULL_STR;
+    } else {
+      char* value = malloc(field_end - current + 1);
+      size_t length = 0;
+      for(; current < field_end; current++) {
+        if(*current == '\\' && current + 1 < field_end) {
+          current++;
+          value[length++] = unescape(&current, field_end);
+        } else {
+          value[length++] = *current;
+        }
+      }
+      value[length] = '\0';
+      tuples->values[i] = value;
+    }
+    current = field_end + 1;
+  }
+
+  return tuples;
+}
+
+static relation_t* load_relation(PGconn *conn, PGresult* tables, int row) {
+  const char* oid = PQgetvalue(tables, row, 0);
+  const char* params[] = { oid };
+  PGresult* result = PQexecParams(conn, TABLE_COLUMNS_QUERY, 1, NULL, params, NULL, NULL, 0);
+  if(PQresultStatus(result) != PGRES_TUPLES_OK) {
+    ERROR("failed to load columns: %s", PQerrorMessage(conn));
+    PQclear(result);
+    return NULL;
+  }
+
+  relation_t* relation = malloc(sizeof(relation_t));
+  relation->id = atoll(oid);
+  relation->namespace = strdup(PQgetvalue(tables, row, 1));
+  relation->name = strdup(PQgetvalue(tables, row, 2));
+  relation->replicate_identity_settings = PQgetvalue(tables, row, 3)[0];
+  relation->number_columns = PQntuples(result);
+  relation->changed_columns = false;
+  relation->columns = malloc(sizeof(char*)*relation->number_columns);
+  relation->column_flags = malloc(sizeof(int8_t)*relation->number_columns);
+  relation->column_types = malloc(sizeof(int32_t)*relation->number_columns);
+  for(int i=0; i<relation->number_columns; i++) {
+    relation->column_types[i] = atoi(PQgetvalue(result, i, 2));
+    relation->columns[i] = strdup(PQgetvalue(result, i, 0));
+    relation->column_flags[i] = PQgetvalue(result, i, 1)[0] == 't' ? COLUMN_FLAG_KEY : 0;
+  }
+
+  PQclear(result);
+  return relation;
+}
+
+// Adds a task copying with the query written to file, and closes it.
+static int add_task(snapshot_t* snapshot, int32_t relation_id, FILE* file, char** query) {
+  if(fclose(file) != 0) {
+    ERROR("failed to build copy query");
+    free(*query);
+    return ERR_QUERY;
+  }
+
+  snapshot->tasks = realloc(snapshot->tasks, sizeof(copy_task_t)*(snapshot->number_tasks+1));
+  snapshot->tasks[snapshot->number_tasks].relation_id = relation_id;
+  snapshot->tasks[snapshot->number_tasks].query = *query;
+  snapshot->number_tasks++;
+  return 0;
+}
+
+// Prints the relation of every published table and splits the copy of the
+// tables into tasks.
+static int plan_snapshot(PGconn *conn, snapshot_t* snapshot, FILE* file) {
+  const char* params[] = { snapshot->options->publication };
+  PGresult* tables = PQexecParams(conn, PUBLICATION_TABLES_QUERY, 1, NULL, params, NULL, NULL, 0);
+  if(PQresultStatus(tables) != PGRES_TUPLES_OK) {
+    ERROR("failed to load publication tables: %s", PQerrorMessage(conn));
+    PQclear(tables);
+    return ERR_QUERY;
+  }
+
+  int err = 0;
+  for(int row=0; row<PQntuples(tables); row++) {
+    relation_t* relation = load_relation(conn, tables, row);
+    if(relation == NULL) {
+      PQclear(tables);
+      return ERR_QUERY;
+    }
+    print_relation(relation, file);
+
+    char* columns = NULL;
+    size_t columns_size = 0;
+    FILE* columns_file = open_memstream(&columns, &columns_size);
+    for(int i=0; i<relation->number_columns; i++) {
+      char* column = PQescapeIdentifier(conn, relation->columns[i], strlen(relation->columns[i]));
+      fprintf(columns_file, "%s%s", i > 0 ? ", " : "", column);
+      PQfreemem(column);
+    }
+    if(fclose(columns_file) != 0) {
+      ERROR("failed to build copy query");
+      free(columns);
+      delete_relation(relation);
+      PQclear(tables);
+      return ERR_QUERY;
+    }
+
+    char* namespace = PQescapeIdentifier(conn, relation->namespace, strlen(relation->namespace));
+    char* name = PQescapeIdentifier(conn, relation->name, strlen(relation->name));
+    // Inheritance children are published on their own, so plain tables are
+    // copied without them. A partitioned root has no rows but its partitions'.
+    bool plain = PQgetvalue(tables, row, 4)[0] == 'r';
+    int64_t pages = atoll(PQgetvalue(tables, row, 5));
+
+    char* query = NULL;
+    size_t query_size = 0;
+    if(!plain || pages <= SNAPSHOT_SPLIT_PAGES) {
+      FILE* query_file = open_memstream(&query, &query_size);
+      fprintf(query_file, "COPY (SELECT %s FROM %s%s.%s) TO STDOUT", columns, plain ? "ONLY " : "", namespace, name);
+      err = add_task(snapshot, relation->id, query_file, &query);
+    } else {
+      for(int64_t page = 0; page < pages && err == 0; page += SNAPSHOT_SPLIT_PAGES) {
+        FILE* query_file = open_memstream(&query, &query_size);
+        if(page + SNAPSHOT_SPLIT_PAGES < pages) {
+          fprintf(query_file, "COPY (SELECT %s FROM ONLY %s.%s WHERE ctid >= '(%ld,0)'::tid AND ctid < '(%ld,0)'::tid) TO STDOUT",
+            columns, namespace, name, page, page + SNAPSHOT_SPLIT_PAGES);
+        } else {
+          fprintf(query_file, "COPY (SELECT %s FROM ONLY %s.%s WHERE ctid >= '(%ld,0)'::tid) TO STDOUT",
+            columns, namespace, name, page);
+        }
+        err = add_task(snapshot, relation->id, query_file, &query);
+      }
+    }
+
+    PQfreemem(namespace);
+    PQfreemem(name);
+    free(columns);
+    if(snapshot->mirror != NULL) {
+      mirror_relation(snapshot->mirror, relation);
+      put_relation(snapshot->relations, relation);
+    } else {
+      delete_relation(relation);
+    }
+    if(err != 0) {
+      break;
+    }
+  }
+
+  PQclear(tables);
+  return err;
+}
+
+static int copy_task(PGconn *conn, snapshot_t* snapshot, copy_task_t* task) {
+  PGresult* result = PQexec(conn, task->query);
+  if(PQresultStatus(result) != PGRES_COPY_OUT) {
+    ERROR("failed to copy: %s", PQerrorMessage(conn));
+    PQclear(result);
+    return ERR_QUERY;
+  }
+  PQclear(result);
+
+  char* data = NULL;
+  size_t size = 0;
+  FILE* file = open_memstream(&data, &size);
+  relation_t* relation = snapshot->mirror != NULL ? get_relation(snapshot->relations, task->relation_id) : NULL;
+  char* line;
+  int line_size;
+  while((line_size = PQgetCopyData(conn, &line, 0)) > 0) {
+    insert_t insert = { .relation_id = task->relation_id, .data = parse_copy_row(line, line_size) };
+    print_insert(&insert, file);
+    if(relation != NULL) {
+      pthread_mutex_lock(&snapshot->mirror_lock);
+      mirror_insert(snapshot->mirror, relation, insert.data);
+      pthread_mutex_unlock(&snapshot->mirror_lock);
+    }
+    delete_tuples(insert.data);
+    PQfreemem(line);
+    atomic_fetch_add(&snapshot->rows, 1);
+
+    if(ftell(file) > SNAPSHOT_BATCH_LIMIT) {
+      if(snapshot->options->checksum) {
+        print_checksum(file, &data, &size);
+      }
+      fclose(file);
+      sinks_push(snapshot->sinks, create_buffer(data, size, 0));
+      file = open_memstream(&data, &size);
+    }
+  }
+  if(snapshot->options->checksum) {
+    print_checksum(file, &data, &size);
+  }
+  fclose(file);
+  sinks_push(snapshot->sinks, create_buffer(data, size, 0));
+
+  result = PQgetResult(conn);
+  int status = PQresultStatus(result);
+  PQclear(result);
+  if(line_size == -2 || status != PGRES_COMMAND_OK) {
+    ERROR("failed to copy: %s", PQerrorMessage(conn));
+    return ERR_QUERY;
+  }
+  return 0;
+}
+
+static void* run_snapshot_worker(void* arg) {
+  snapshot_t* snapshot = arg;
+  PGconn* conn = NULL;
+
+  if(create_database_connection(&conn, *snapshot->options) > 0 || begin_snapshot(conn, snapshot->snapshot_name) > 0) {
+    atomic_store(&snapshot->failed, true);
+    PQfinish(conn);
+    return NULL;
+  }
+
+  int task;
+  while(!atomic_load(&snapshot->failed) && (task = atomic_fetch_add(&snapshot->next_task, 1)) < snapshot->number_tasks) {
+    if(copy_task(conn, snapshot, &snapshot->tasks[task]) > 0) {
+      atomic_store(&snapshot->failed, true);
+    }
+  }
+
+  PGresult* result = PQexec(conn, "COMMIT");
+  PQclear(result);
+  PQfinish(conn);
+  return NULL;
+}
+
+static int create_snapshot_slot(PGconn *conn, char* slotname, char** snapshot_name) {
+  char command[1024];
+  snprintf(command, sizeof(command), CREATE_SNAPSHOT_SLOT_COMMAND, slotname);
+
+  PGresult* result = PQexec(conn, command);
+  if(PQresultStatus(result) != PGRES_TUPLES_OK) {
+    ERROR("failed to create slot: %s", PQerrorMessage(conn));
+    PQclear(result);
+    return ERR_QUERY;
+  }
+
+  INFO("slot created at %s with snapshot %s", PQgetvalue(result, 0, 1), PQgetvalue(result, 0, 2));
+  *snapshot_name = strdup(PQgetvalue(result, 0, 2));
+  PQclear(result);
+  return 0;
+}
+
+// Creates the slot and copies every published table with the snapshot of the
+// slot. The replication connection must stay idle until the copy is done,
+// streaming then starts at the consistent point of the slot. Copied rows of
+// mirrored tables are also added to the mirror, and their relations to
+// relations.
+int install_snapshot(PGconn *conn, options_t* options, sinks_t* sinks, mirror_t* mirror, relations_t* relations) {
+  INFO("starting install with snapshot");
+  snapshot_t snapshot = { .options = options, .sinks = sinks, .mirror = mirror, .relations = relations };
+  pthread_mutex_init(&snapshot.mirror_lock, NULL);
+  atomic_init(&snapshot.next_task, 0);
+  atomic_init(&snapshot.failed, false);
+  atomic_init(&snapshot.rows, 0);
+
+  int err = create_snapshot_slot(conn, options->slotname, &snapshot.snapshot_name);
+  if(err > 0) {
+    return err;
+  }
+
+  PGconn* planner = NULL;
+  err = create_database_connection(&planner, *options);
+  if(err == 0) {
+    err = begin_snapshot(planner, snapshot.snapshot_name);
+  }
+  if(err == 0) {
+    char* data = NULL;
+    size_t size = 0;
+    FILE* file = open_memstream(&data, &size);
+    err = plan_snapshot(planner, &snapshot, file);
+    if(options->checksum) {
+      print_checksum(file, &data, &size);
+    }
+    fclose(file);
+    sinks_push(sinks, create_buffer(data, size, 0));
+  }
+  PQfinish(planner);
+
+  if(err == 0) {
+    int number_workers = options->snapshot;
+    pthread_t* workers = malloc(sizeof(pthread_t)*number_workers);
+    for(int i=0; i<number_workers; i++) {
+      pthread_create(&workers[i], NULL, run_snapshot_worker, &snapshot);
+    }
+    for(int i=0; i<number_workers; i++) {
+      pthread_join(workers[i], NULL);
+    }
+    free(workers);
+
+    if(atomic_load(&snapshot.failed)) {
+      err = ERR_QUERY;
+    }
+  }
+
+  for(int i=0; i<snapshot.number_tasks; i++) {
+    free(snapshot.tasks[i].query);
+  }
+  free(snapshot.tasks);
+  free(snapshot.snapshot_name);
+  pthread_mutex_destroy(&snapshot.mirror_lock);
+
+  if(err == 0) {
+    INFO("install with snapshot completed, %ld rows copied", atomic_load(&snapshot.rows));
+  }
+  return err;
+}
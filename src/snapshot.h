@@ -0,0 +1,35 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdatomic.h>
+#include <pthread.h>
+#include <libpq-fe.h>
+#include "options.h"
+#include "decoder.h"
+#include "sink.h"
+#include "mirror.h"
+
+typedef struct {
+  int32_t relation_id;
+  char* query;
+} copy_task_t;
+
+// Initial copy of the published tables, done by parallel connections on the
+// snapshot exported when the slot was created. Large tables are split into
+// ctid ranges so their parts are copied in parallel.
+typedef struct {
+  options_t* options;
+  char* snapshot_name;
+  sinks_t* sinks;
+  mirror_t* mirror;
+  relations_t* relations;
+  pthread_mutex_t mirror_lock;
+  copy_task_t* tasks;
+  int number_tasks;
+  atomic_int next_task;
+  atomic_bool failed;
+  atomic_int_fast64_t rows;
+} snapshot_t;
+
+int install_snapshot(PGconn *conn, options_t* options, sinks_t* sinks, mirror_t* mirror, relations_t* relations);
+tuples_t* parse_copy_row(char* line, size_t size);
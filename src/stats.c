@@ -0,0 +1,251 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "logging.h"
+#include "stats.h"
+
+const int STATS_POLL_MS = 1000;
+
+stats_t* create_stats(char* path) {
+  stats_t* stats = calloc(1, sizeof(stats_t));
+  stats->capacity_tables = 64;
+  stats->tables = calloc(stats->capacity_tables, sizeof(table_stats_t));
+  stats->path = path;
+  atomic_init(&stats->requested, false);
+  return stats;
+}
+
+void delete_stats(stats_t* stats) {
+  free(stats->tables);
+  free(stats);
+}
+
+static table_stats_t* find_table(stats_t* stats, int64_t relation_id) {
+  size_t mask = stats->capacity_tables - 1;
+  size_t i = (uint64_t)relation_id * 11400714819323198485ULL >> 32 & mask;
+  while(stats->tables[i].relation_id != 0 && stats->tables[i].relation_id != relation_id) {
+    i = (i + 1) & mask;
+  }
+  return &stats->tables[i];
+}
+
+static table_stats_t* get_table(stats_t* stats, int64_t relation_id) {
+  if(stats->last != NULL && stats->last->relation_id == relation_id) {
+    return stats->last;
+  }
+
+  table_stats_t* table = find_table(stats, relation_id);
+  if(table->relation_id == 0 && (stats->number_tables + 1) * 2 > stats->capacity_tables) {
+    table_stats_t* tables = stats->tables;
+    size_t capacity = stats->capacity_tables;
+    stats->capacity_tables *= 2;
+    stats->tables = calloc(stats->capacity_tables, sizeof(table_stats_t));
+    for(size_t i=0; i<capacity; i++) {
+      if(tables[i].relation_id != 0) {
+        *find_table(stats, tables[i].relation_id) = tables[i];
+      }
+    }
+    free(tables);
+    table = find_table(stats, relation_id);
+  }
+
+  if(table->relation_id == 0) {
+    table->relation_id = relation_id;
+    stats->number_tables++;
+  }
+  stats->last = table;
+  return table;
+}
+
+// Same hash as hash_relation_key over the key relation_key would build,
+// without building it. Returns false when the tuples have no whole key.
+static bool hash_key(relation_t* relation, tuples_t* tuples, uint64_t* hash) {
+  if(relation == NULL || tuples == NULL || tuples->size != relation->number_columns) {
+    return false;
+  }
+
+  bool found = false;
+  *hash = 14695981039346656037ULL ^ (uint64_t)relation->id;
+  for(int i=0; i<tuples->size; i++) {
+    if(relation->column_flags[i] & COLUMN_FLAG_KEY) {
+      if(tuples->values[i] == UNCHANGED_STR) {
+        return false;
+      }
+      char* value = tuples->values[i];
+      do {
+        *hash ^= (unsigned char)*value;
+        *hash *= 1099511628211ULL;
+      } while(*value++ != 0);
+      found = true;
+    }
+  }
+  return found;
+}
+
+static void copy_key(relation_t* relation, tuples_t* tuples, char* key) {
+  size_t size = 0;
+  memset(key, 0, STATS_KEY_SIZE);
+  for(int i=0; i<tuples->size && size < STATS_KEY_SIZE - 1; i++) {
+    if(relation->column_flags[i] & COLUMN_FLAG_KEY) {
+      size_t length = strnlen(tuples->values[i], STATS_KEY_SIZE - 1 - size);
+      memcpy(key + size, tuples->values[i], length);
+      size += length + 1;
+    }
+  }
+}
+
+// Counts the key in the sketch, and keeps it among the hot keys while its
+// estimate is above the lowest one kept.
+static void count_key(stats_t* stats, relation_t* relation, tuples_t* tuples) {
+  uint64_t hash;
+  if(!hash_key(relation, tuples, &hash)) {
+    return;
+  }
+
+  uint32_t estimate = UINT32_MAX;
+  uint32_t first = (uint32_t)hash;
+  uint32_t second = (uint32_t)(hash >> 32) | 1;
+  for(int i=0; i<STATS_SKETCH_DEPTH; i++) {
+    uint32_t* counter = &stats->sketch[i][(first + i * second) % STATS_SKETCH_WIDTH];
+    if(*counter < UINT32_MAX) {
+      (*counter)++;
+    }
+    if(*counter < estimate) {
+      estimate = *counter;
+    }
+  }
+
+  hot_key_t* lowest = NULL;
+  for(int i=0; i<stats->number_hot_keys; i++) {
+    hot_key_t* hot_key = &stats->hot_keys[i];
+    if(hot_key->hash == hash && hot_key->relation_id == relation->id) {
+      hot_key->count = estimate;
+      return;
+    }
+    if(lowest == NULL || hot_key->count < lowest->count) {
+      lowest = hot_key;
+    }
+  }
+
+  if(stats->number_hot_keys < STATS_HOT_KEYS) {
+    lowest = &stats->hot_keys[stats->number_hot_keys++];
+  } else if(estimate <= lowest->count) {
+    return;
+  }
+  lowest->relation_id = relation->id;
+  lowest->hash = hash;
+  lowest->count = estimate;
+  copy_key(relation, tuples, lowest->key);
+}
+
+// Counts a change of bytes in the stream. The key is the old key of updates
+// and deletes when one was sent, the new row otherwise.
+void stats_change(stats_t* stats, int64_t relation_id, relation_t* relation, char operation, size_t bytes, tuples_t* key) {
+  table_stats_t* table = get_table(stats, relation_id);
+  switch(operation) {
+    case 'I':
+      table->inserts++;
+      break;
+    case 'U':
+      table->updates++;
+      break;
+    case 'D':
+      table->deletes++;
+      break;
+  }
+  table->bytes += bytes;
+  count_key(stats, relation, key);
+}
+
+// Safe to call from a signal handler.
+void stats_request_dump(stats_t* stats) {
+  atomic_store(&stats->requested, true);
+}
+
+int stats_remaining_ms(stats_t* stats) {
+  return atomic_load(&stats->requested) ? 0 : STATS_POLL_MS;
+}
+
+static int compare_tables(const void* a, const void* b) {
+  const table_stats_t* first = a;
+  const table_stats_t* second = b;
+  return first->bytes < second->bytes ? 1 : first->bytes > second->bytes ? -1 : 0;
+}
+
+static int compare_hot_keys(const void* a, const void* b) {
+  const hot_key_t* first = a;
+  const hot_key_t* second = b;
+  return first->count < second->count ? 1 : first->count > second->count ? -1 : 0;
+}
+
+static void print_name(relations_t* relations, int64_t relation_id, FILE* file) {
+  relation_t* relation = get_relation(relations, relation_id);
+  if(relation != NULL) {
+    fprintf(file, "    name: %s.%s\n", relation->namespace, relation->name);
+  }
+}
+
+// Writes the tables by bytes changed and the hot keys by count.
+int write_stats(stats_t* stats, relations_t* relations, int64_t lsn, FILE* file) {
+  table_stats_t* tables = malloc((stats->number_tables + 1) * sizeof(table_stats_t));
+  size_t number_tables = 0;
+  for(size_t i=0; i<stats->capacity_tables; i++) {
+    if(stats->tables[i].relation_id != 0) {
+      tables[number_tables++] = stats->tables[i];
+    }
+  }
+  qsort(tables, number_tables, sizeof(table_stats_t), compare_tables);
+
+  fprintf(file, "---\nstats_lsn: %X/%X\n", (uint32_t)(lsn >> 32), (uint32_t)lsn);
+  fprintf(file, "tables:\n");
+  for(size_t i=0; i<number_tables; i++) {
+    table_stats_t* table = &tables[i];
+    int64_t changes = table->inserts + table->updates + table->deletes;
+    fprintf(file, "  - relation_id: %ld\n", table->relation_id);
+    print_name(relations, table->relation_id, file);
+    fprintf(file, "    inserts: %ld\n", table->inserts);
+    fprintf(file, "    updates: %ld\n", table->updates);
+    fprintf(file, "    deletes: %ld\n", table->deletes);
+    fprintf(file, "    bytes: %ld\n", table->bytes);
+    fprintf(file, "    average_width: %ld\n", changes > 0 ? table->bytes / changes : 0);
+  }
+  free(tables);
+
+  hot_key_t hot_keys[STATS_HOT_KEYS];
+  memcpy(hot_keys, stats->hot_keys, stats->number_hot_keys * sizeof(hot_key_t));
+  qsort(hot_keys, stats->number_hot_keys, sizeof(hot_key_t), compare_hot_keys);
+  fprintf(file, "hot_keys:\n");
+  for(int i=0; i<stats->number_hot_keys; i++) {
+    hot_key_t* hot_key = &hot_keys[i];
+    fprintf(file, "  - relation_id: %ld\n", hot_key->relation_id);
+    print_name(relations, hot_key->relation_id, file);
+    fprintf(file, "    count: %u\n", hot_key->count);
+    fprintf(file, "    key:\n");
+    relation_t* relation = get_relation(relations, hot_key->relation_id);
+    char* value = hot_key->key;
+    for(int j=0; relation != NULL && j<relation->number_columns; j++) {
+      if((relation->column_flags[j] & COLUMN_FLAG_KEY) && value < hot_key->key + STATS_KEY_SIZE) {
+        fprintf(file, "      - %s\n", value);
+        value += strlen(value) + 1;
+      }
+    }
+  }
+  return ferror(file) ? FAILED : OK;
+}
+
+void stats_dump(stats_t* stats, relations_t* relations, int64_t lsn) {
+  atomic_store(&stats->requested, false);
+
+  char path[4096];
+  snprintf(path, sizeof(path), "%s.tmp", stats->path);
+  FILE* file = fopen(path, "w");
+  if(file == NULL) {
+    ERROR("failed to write stats to %s", stats->path);
+    return;
+  }
+
+  int err = write_stats(stats, relations, lsn, file);
+  if(fclose(file) != 0 || err != OK || rename(path, stats->path) != 0) {
+    ERROR("failed to write stats to %s", stats->path);
+  }
+}
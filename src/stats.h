@@ -0,0 +1,53 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdatomic.h>
+#include "decoder.h"
+#include "relations.h"
+
+#define STATS_SKETCH_DEPTH 4
+#define STATS_SKETCH_WIDTH 4096
+#define STATS_HOT_KEYS 32
+#define STATS_KEY_SIZE 64
+
+typedef struct {
+  int64_t relation_id;
+  int64_t inserts;
+  int64_t updates;
+  int64_t deletes;
+  int64_t bytes;
+} table_stats_t;
+
+// Replica identity key of a relation, its values separated by NUL and cut
+// at STATS_KEY_SIZE bytes, with the count estimated by the sketch.
+typedef struct {
+  int64_t relation_id;
+  uint64_t hash;
+  uint32_t count;
+  char key[STATS_KEY_SIZE];
+} hot_key_t;
+
+// Changes by relation, and the keys changed most often, kept in fixed
+// memory with a count-min sketch of every key and the STATS_HOT_KEYS keys
+// of highest estimate.
+typedef struct {
+  table_stats_t* tables;
+  size_t number_tables;
+  size_t capacity_tables;
+  table_stats_t* last;
+  uint32_t sketch[STATS_SKETCH_DEPTH][STATS_SKETCH_WIDTH];
+  hot_key_t hot_keys[STATS_HOT_KEYS];
+  int number_hot_keys;
+  char* path;
+  atomic_bool requested;
+} stats_t;
+
+stats_t* create_stats(char* path);
+void delete_stats(stats_t* stats);
+void stats_change(stats_t* stats, int64_t relation_id, relation_t* relation, char operation, size_t bytes, tuples_t* key);
+void stats_request_dump(stats_t* stats);
+int stats_remaining_ms(stats_t* stats);
+void stats_dump(stats_t* stats, relations_t* relations, int64_t lsn);
+int write_stats(stats_t* stats, relations_t* relations, int64_t lsn, FILE* file);
@@ -1,28 +1,102 @@
 #pragma once
 
 #include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
 #include <string.h>
+#include <endian.h>
 
 typedef struct {
   char* current;
   char* start;
+  char* end;
 } stream_t;
 
 stream_t *create_stream(char* value, size_t size);
+void init_stream(stream_t* stream, char* value, size_t size);
 void delete_stream(stream_t* stream);
 size_t stream_pos(stream_t* stream);
+size_t stream_remaining(stream_t* stream);
 void skip_bytes(stream_t* stream, size_t size);
 
-int8_t read_int8(stream_t* stream);
-int16_t read_int16(stream_t* stream);
-int32_t read_int32(stream_t* stream);
-int64_t read_int64(stream_t* stream);
-char read_char(stream_t* stream);
-char* read_string(stream_t* stream);
-
-void write_int8(stream_t* stream, int8_t value);
-void write_int16(stream_t* stream, int16_t value);
-void write_int32(stream_t* stream, int32_t value);
-void write_int64(stream_t* stream, int64_t value);
-void write_char(stream_t* stream, char value);
-void write_string(stream_t* stream, char* value);
+// Checked cursor moves, used to validate a message once before decoding it
+bool check_bytes(stream_t* stream, size_t size);
+bool check_string(stream_t* stream);
+bool check_int8(stream_t* stream, int8_t* value);
+bool check_int16(stream_t* stream, int16_t* value);
+bool check_int32(stream_t* stream, int32_t* value);
+
+// Unchecked reads and writes, callers must know the bytes are in bounds
+static inline int8_t read_int8(stream_t* stream) {
+  int8_t value = stream->current[0];
+  stream->current += 1;
+  return value;
+}
+
+static inline int16_t read_int16(stream_t* stream) {
+  uint16_t value;
+  memcpy(&value, stream->current, sizeof(value));
+  stream->current += 2;
+  return (int16_t)be16toh(value);
+}
+
+static inline int32_t read_int32(stream_t* stream) {
+  uint32_t value;
+  memcpy(&value, stream->current, sizeof(value));
+  stream->current += 4;
+  return (int32_t)be32toh(value);
+}
+
+static inline int64_t read_int64(stream_t* stream) {
+  uint64_t value;
+  memcpy(&value, stream->current, sizeof(value));
+  stream->current += 8;
+  return (int64_t)be64toh(value);
+}
+
+static inline char read_char(stream_t* stream) {
+  char value = stream->current[0];
+  stream->current += 1;
+  return value;
+}
+
+static inline char* read_string(stream_t* stream) {
+  char* value = stream->current;
+  size_t size = strlen(stream->current)+1;
+  stream->current += size;
+  return value;
+}
+
+static inline void write_int8(stream_t* stream, int8_t value) {
+  stream->current[0] = value;
+  stream->current++;
+}
+
+static inline void write_int16(stream_t* stream, int16_t value) {
+  uint16_t be = htobe16((uint16_t)value);
+  memcpy(stream->current, &be, sizeof(be));
+  stream->current += 2;
+}
+
+static inline void write_int32(stream_t* stream, int32_t value) {
+  uint32_t be = htobe32((uint32_t)value);
+  memcpy(stream->current, &be, sizeof(be));
+  stream->current += 4;
+}
+
+static inline void write_int64(stream_t* stream, int64_t value) {
+  uint64_t be = htobe64((uint64_t)value);
+  memcpy(stream->current, &be, sizeof(be));
+  stream->current += 8;
+}
+
+static inline void write_char(stream_t* stream, char value) {
+  stream->current[0] = value;
+  stream->current++;
+}
+
+static inline void write_string(stream_t* stream, char* value) {
+  size_t size = strlen(value)+1;
+  memcpy(stream->current, value, size);
+  stream->current += size;
+}
@@ -0,0 +1,160 @@
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "logging.h"
+#include "streams.h"
+
+#define STREAM_COPY_SIZE (64*1024)
+
+streams_t* create_streams(char* spill_dir) {
+  streams_t* streams = calloc(1, sizeof(streams_t));
+  streams->spill_dir = spill_dir;
+  return streams;
+}
+
+static void delete_stream_transaction(stream_transaction_t* transaction) {
+  if(transaction->file != NULL) {
+    fclose(transaction->file);
+  }
+  free(transaction->spans);
+  free(transaction->aborted);
+  free(transaction);
+}
+
+void delete_streams(streams_t* streams) {
+  reset_streams(streams);
+  free(streams);
+}
+
+// Drops every open transaction, they are streamed again from the start
+// after a reconnect.
+void reset_streams(streams_t* streams) {
+  stream_transaction_t* transaction = streams->head;
+  while(transaction != NULL) {
+    stream_transaction_t* next = transaction->next;
+    delete_stream_transaction(transaction);
+    transaction = next;
+  }
+  streams->head = NULL;
+  streams->size = 0;
+}
+
+static stream_transaction_t* find_transaction(streams_t* streams, int32_t xid, stream_transaction_t*** link) {
+  *link = &streams->head;
+  while(**link != NULL && (**link)->transaction != xid) {
+    *link = &(**link)->next;
+  }
+  return **link;
+}
+
+static void remove_transaction(streams_t* streams, stream_transaction_t** link) {
+  stream_transaction_t* transaction = *link;
+  *link = transaction->next;
+  delete_stream_transaction(transaction);
+  streams->size--;
+}
+
+stream_transaction_t* open_stream_transaction(streams_t* streams, int32_t xid) {
+  stream_transaction_t** link;
+  stream_transaction_t* transaction = find_transaction(streams, xid, &link);
+  if(transaction != NULL) {
+    return transaction;
+  }
+
+  char path[4096];
+  snprintf(path, sizeof(path), "%s/pgoutput2yml-stream-XXXXXX", streams->spill_dir != NULL ? streams->spill_dir : "/tmp");
+  int fd = mkstemp(path);
+  if(fd < 0) {
+    ERROR("failed to create stream file %s", path);
+    return NULL;
+  }
+  unlink(path);
+
+  transaction = calloc(1, sizeof(stream_transaction_t));
+  transaction->transaction = xid;
+  transaction->file = fdopen(fd, "w+");
+  transaction->next = streams->head;
+  streams->head = transaction;
+  streams->size++;
+  return transaction;
+}
+
+// Records that the output from offset to the end of the file belongs to the
+// subtransaction, extending the last span when it is the same one.
+void stream_transaction_add(stream_transaction_t* transaction, int32_t subtransaction, long offset) {
+  long size = ftell(transaction->file) - offset;
+  if(transaction->number_spans > 0) {
+    stream_span_t* last = &transaction->spans[transaction->number_spans-1];
+    if(last->subtransaction == subtransaction && last->offset + last->size == offset) {
+      last->size += size;
+      return;
+    }
+  }
+
+  if(transaction->number_spans == transaction->capacity_spans) {
+    transaction->capacity_spans = transaction->capacity_spans > 0 ? transaction->capacity_spans * 2 : 8;
+    transaction->spans = realloc(transaction->spans, transaction->capacity_spans * sizeof(stream_span_t));
+  }
+  transaction->spans[transaction->number_spans++] = (stream_span_t){ subtransaction, offset, size };
+}
+
+// An abort of the transaction itself discards it, an abort of one of its
+// subtransactions only discards the output of that subtransaction.
+void abort_stream_transaction(streams_t* streams, int32_t xid, int32_t subxid) {
+  stream_transaction_t** link;
+  stream_transaction_t* transaction = find_transaction(streams, xid, &link);
+  if(transaction == NULL) {
+    return;
+  }
+
+  if(xid == subxid) {
+    remove_transaction(streams, link);
+    return;
+  }
+
+  transaction->aborted = realloc(transaction->aborted, (transaction->number_aborted + 1) * sizeof(int32_t));
+  transaction->aborted[transaction->number_aborted++] = subxid;
+}
+
+static bool is_aborted(stream_transaction_t* transaction, int32_t subxid) {
+  for(int i=0; i<transaction->number_aborted; i++) {
+    if(transaction->aborted[i] == subxid) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// Copies the output of the transaction that was not aborted to the file.
+int commit_stream_transaction(streams_t* streams, int32_t xid, FILE* file) {
+  stream_transaction_t** link;
+  stream_transaction_t* transaction = find_transaction(streams, xid, &link);
+  if(transaction == NULL) {
+    return 0;
+  }
+
+  int err = fflush(transaction->file);
+  int fd = fileno(transaction->file);
+  char* buffer = malloc(STREAM_COPY_SIZE);
+  for(int i=0; i<transaction->number_spans && err == 0; i++) {
+    stream_span_t* span = &transaction->spans[i];
+    if(is_aborted(transaction, span->subtransaction)) {
+      continue;
+    }
+
+    for(long copied = 0; copied < span->size && err == 0; ) {
+      long size = span->size - copied < STREAM_COPY_SIZE ? span->size - copied : STREAM_COPY_SIZE;
+      if(pread(fd, buffer, size, span->offset + copied) != size) {
+        ERROR("failed to read stream file");
+        err = -1;
+        break;
+      }
+      fwrite(buffer, 1, size, file);
+      copied += size;
+    }
+  }
+
+  free(buffer);
+  remove_transaction(streams, link);
+  return err;
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+// Output of a subtransaction inside the spill file of its transaction.
+typedef struct {
+  int32_t subtransaction;
+  long offset;
+  long size;
+} stream_span_t;
+
+// Streamed transaction whose records are spilled to an unlinked file until
+// its stream commit or abort arrives.
+typedef struct stream_transaction_s {
+  int32_t transaction;
+  FILE* file;
+  stream_span_t* spans;
+  int number_spans;
+  int capacity_spans;
+  int32_t* aborted;
+  int number_aborted;
+  struct stream_transaction_s* next;
+} stream_transaction_t;
+
+typedef struct {
+  stream_transaction_t* head;
+  char* spill_dir;
+  int size;
+} streams_t;
+
+streams_t* create_streams(char* spill_dir);
+void delete_streams(streams_t* streams);
+stream_transaction_t* open_stream_transaction(streams_t* streams, int32_t transaction);
+void stream_transaction_add(stream_transaction_t* transaction, int32_t subtransaction, long offset);
+void abort_stream_transaction(streams_t* streams, int32_t transaction, int32_t subtransaction);
+int commit_stream_transaction(streams_t* streams, int32_t transaction, FILE* file);
+void reset_streams(streams_t* streams);
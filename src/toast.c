@@ -0,0 +1,175 @@
+#include "toast.h"
+
+const size_t TOAST_ENTRY_OVERHEAD = sizeof(toast_entry_t);
+
+toast_cache_t* create_toast_cache(size_t capacity) {
+  toast_cache_t* cache = calloc(1, sizeof(toast_cache_t));
+  cache->capacity = capacity;
+  cache->number_buckets = 1024;
+  cache->buckets = calloc(cache->number_buckets, sizeof(toast_entry_t*));
+  return cache;
+}
+
+static void delete_entry(toast_entry_t* entry) {
+  for(int i=0; i<entry->size; i++) {
+    if(!is_static_tuple(entry->values[i])) {
+      free(entry->values[i]);
+    }
+  }
+  free(entry->values);
+  free(entry->key);
+  free(entry);
+}
+
+void delete_toast_cache(toast_cache_t* cache) {
+  toast_entry_t* entry = cache->head;
+  while(entry != NULL) {
+    toast_entry_t* next = entry->next;
+    delete_entry(entry);
+    entry = next;
+  }
+  free(cache->buckets);
+  free(cache);
+}
+
+static toast_entry_t** find_slot(toast_cache_t* cache, int64_t relation_id, uint64_t hash, char* key, size_t key_size) {
+  toast_entry_t** slot = &cache->buckets[hash % cache->number_buckets];
+  for(; *slot != NULL; slot = &(*slot)->bucket_next) {
+    toast_entry_t* entry = *slot;
+    if(entry->hash == hash && entry->relation_id == relation_id
+        && entry->key_size == key_size && memcmp(entry->key, key, key_size) == 0) {
+      return slot;
+    }
+  }
+  return slot;
+}
+
+static void unlink_entry(toast_cache_t* cache, toast_entry_t* entry) {
+  if(entry->prev != NULL) {
+    entry->prev->next = entry->next;
+  } else {
+    cache->head = entry->next;
+  }
+
+  if(entry->next != NULL) {
+    entry->next->prev = entry->prev;
+  } else {
+    cache->tail = entry->prev;
+  }
+
+  entry->prev = NULL;
+  entry->next = NULL;
+}
+
+static void push_front(toast_cache_t* cache, toast_entry_t* entry) {
+  entry->prev = NULL;
+  entry->next = cache->head;
+  if(cache->head != NULL) {
+    cache->head->prev = entry;
+  }
+  cache->head = entry;
+  if(cache->tail == NULL) {
+    cache->tail = entry;
+  }
+}
+
+static void remove_entry(toast_cache_t* cache, toast_entry_t* entry) {
+  toast_entry_t** slot = find_slot(cache, entry->relation_id, entry->hash, entry->key, entry->key_size);
+  *slot = entry->bucket_next;
+  unlink_entry(cache, entry);
+  cache->bytes -= entry->bytes;
+  delete_entry(entry);
+}
+
+static void store(toast_cache_t* cache, relation_t* relation, tuples_t* data, char* key, size_t key_size) {
+  size_t bytes = TOAST_ENTRY_OVERHEAD + key_size + sizeof(char*)*data->size;
+  for(int i=0; i<data->size; i++) {
+    if(!is_static_tuple(data->values[i])) {
+      bytes += strlen(data->values[i])+1;
+    }
+  }
+
+  uint64_t hash = hash_relation_key(relation->id, key, key_size);
+  toast_entry_t** slot = find_slot(cache, relation->id, hash, key, key_size);
+  if(*slot != NULL) {
+    remove_entry(cache, *slot);
+    slot = find_slot(cache, relation->id, hash, key, key_size);
+  }
+
+  if(bytes > cache->capacity) {
+    free(key);
+    return;
+  }
+
+  toast_entry_t* entry = malloc(sizeof(toast_entry_t));
+  entry->hash = hash;
+  entry->relation_id = relation->id;
+  entry->key = key;
+  entry->key_size = key_size;
+  entry->bytes = bytes;
+  entry->size = data->size;
+  entry->values = malloc(sizeof(char*)*data->size);
+  for(int i=0; i<data->size; i++) {
+    char* value = data->values[i];
+    entry->values[i] = is_static_tuple(value) ? value : strdup(value);
+  }
+
+  entry->bucket_next = NULL;
+  *slot = entry;
+  push_front(cache, entry);
+  cache->bytes += bytes;
+
+  while(cache->bytes > cache->capacity && cache->tail != NULL) {
+    remove_entry(cache, cache->tail);
+  }
+}
+
+void toast_cache_insert(toast_cache_t* cache, relation_t* relation, tuples_t* data) {
+  size_t key_size;
+  char* key = relation_key(relation, data, &key_size);
+  if(key != NULL) {
+    store(cache, relation, data, key, key_size);
+  }
+}
+
+void toast_cache_update(toast_cache_t* cache, relation_t* relation, tuples_t* from, tuples_t* to) {
+  size_t key_size;
+  char* key = relation_key(relation, from != NULL ? from : to, &key_size);
+  if(key == NULL) {
+    return;
+  }
+
+  uint64_t hash = hash_relation_key(relation->id, key, key_size);
+  toast_entry_t* entry = *find_slot(cache, relation->id, hash, key, key_size);
+  free(key);
+
+  if(entry != NULL && entry->size == to->size) {
+    for(int i=0; i<to->size; i++) {
+      if(to->values[i] == UNCHANGED_STR && !is_static_tuple(entry->values[i])) {
+        to->values[i] = strdup(entry->values[i]);
+      }
+    }
+  }
+
+  if(entry != NULL) {
+    remove_entry(cache, entry);
+  }
+
+  toast_cache_insert(cache, relation, to);
+}
+
+void toast_cache_delete(toast_cache_t* cache, relation_t* relation, tuples_t* data) {
+  size_t key_size;
+  char* key = relation_key(relation, data, &key_size);
+  if(key == NULL) {
+    return;
+  }
+
+  uint64_t hash = hash_relation_key(relation->id, key, key_size);
+  toast_entry_t* entry = *find_slot(cache, relation->id, hash, key, key_size);
+  free(key);
+
+  if(entry != NULL) {
+    remove_entry(cache, entry);
+  }
+}
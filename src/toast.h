@@ -0,0 +1,37 @@
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include "decoder.h"
+#include "relations.h"
+
+typedef struct toast_entry_s {
+  struct toast_entry_s* prev;
+  struct toast_entry_s* next;
+  struct toast_entry_s* bucket_next;
+  uint64_t hash;
+  int64_t relation_id;
+  char* key;
+  size_t key_size;
+  int16_t size;
+  char** values;
+  size_t bytes;
+} toast_entry_t;
+
+// Row images of the last seen tuples, keyed by relation and replica identity
+// key, bounded by capacity bytes and evicted in least recently used order.
+typedef struct {
+  toast_entry_t** buckets;
+  size_t number_buckets;
+  toast_entry_t* head;
+  toast_entry_t* tail;
+  size_t bytes;
+  size_t capacity;
+} toast_cache_t;
+
+toast_cache_t* create_toast_cache(size_t capacity);
+void delete_toast_cache(toast_cache_t* cache);
+
+void toast_cache_insert(toast_cache_t* cache, relation_t* relation, tuples_t* data);
+void toast_cache_update(toast_cache_t* cache, relation_t* relation, tuples_t* from, tuples_t* to);
+void toast_cache_delete(toast_cache_t* cache, relation_t* relation, tuples_t* key);
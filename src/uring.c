@@ -0,0 +1,303 @@
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include "logging.h"
+#include "uring.h"
+
+#define URING_ENTRIES (URING_SLOTS * 2)
+
+static int io_uring_setup(unsigned entries, struct io_uring_params* params) {
+  return syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int io_uring_enter(int fd, unsigned submit, unsigned complete, unsigned flags) {
+  return syscall(__NR_io_uring_enter, fd, submit, complete, flags, NULL, 0);
+}
+
+static int io_uring_register(int fd, unsigned opcode, void* arg, unsigned size) {
+  return syscall(__NR_io_uring_register, fd, opcode, arg, size);
+}
+
+static int map_rings(uring_t* uring, struct io_uring_params* params) {
+  uring->sq_ring_size = params->sq_off.array + params->sq_entries * sizeof(unsigned);
+  uring->cq_ring_size = params->cq_off.cqes + params->cq_entries * sizeof(struct io_uring_cqe);
+  if(params->features & IORING_FEAT_SINGLE_MMAP) {
+    if(uring->cq_ring_size > uring->sq_ring_size) {
+      uring->sq_ring_size = uring->cq_ring_size;
+    }
+    uring->cq_ring_size = uring->sq_ring_size;
+  }
+
+  uring->sq_ring = mmap(NULL, uring->sq_ring_size, PROT_READ | PROT_WRITE,
+    MAP_SHARED | MAP_POPULATE, uring->fd, IORING_OFF_SQ_RING);
+  if(uring->sq_ring == MAP_FAILED) {
+    return -1;
+  }
+
+  uring->cq_ring = uring->sq_ring;
+  if(!(params->features & IORING_FEAT_SINGLE_MMAP)) {
+    uring->cq_ring = mmap(NULL, uring->cq_ring_size, PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_POPULATE, uring->fd, IORING_OFF_CQ_RING);
+    if(uring->cq_ring == MAP_FAILED) {
+      return -1;
+    }
+  }
+
+  uring->sqes_size = params->sq_entries * sizeof(struct io_uring_sqe);
+  uring->sqes = mmap(NULL, uring->sqes_size, PROT_READ | PROT_WRITE,
+    MAP_SHARED | MAP_POPULATE, uring->fd, IORING_OFF_SQES);
+  if(uring->sqes == MAP_FAILED) {
+    return -1;
+  }
+
+  char* sq = uring->sq_ring;
+  uring->sq_head = (unsigned*)(sq + params->sq_off.head);
+  uring->sq_tail = (unsigned*)(sq + params->sq_off.tail);
+  uring->sq_mask = (unsigned*)(sq + params->sq_off.ring_mask);
+  uring->sq_array = (unsigned*)(sq + params->sq_off.array);
+
+  char* cq = uring->cq_ring;
+  uring->cq_head = (unsigned*)(cq + params->cq_off.head);
+  uring->cq_tail = (unsigned*)(cq + params->cq_off.tail);
+  uring->cq_mask = (unsigned*)(cq + params->cq_off.ring_mask);
+  uring->cqes = (struct io_uring_cqe*)(cq + params->cq_off.cqes);
+  return 0;
+}
+
+// Writes go to explicit offsets from the end of the target, so it must not
+// be opened with O_APPEND. Returns NULL when io_uring is not available.
+uring_t* create_uring(int target, uring_complete_t complete, void* arg) {
+  uring_t* uring = calloc(1, sizeof(uring_t));
+  uring->target = target;
+  uring->complete = complete;
+  uring->arg = arg;
+  uring->current = -1;
+  uring->sq_ring = MAP_FAILED;
+  uring->cq_ring = MAP_FAILED;
+  uring->sqes = MAP_FAILED;
+  uring->offset = lseek(target, 0, SEEK_END);
+
+  struct io_uring_params params;
+  memset(&params, 0, sizeof(params));
+  uring->fd = io_uring_setup(URING_ENTRIES, &params);
+  if(uring->fd < 0 || uring->offset < 0 || map_rings(uring, &params) < 0) {
+    ERROR("failed to set up io_uring: %s", strerror(errno));
+    delete_uring(uring);
+    return NULL;
+  }
+
+  struct iovec iov[URING_SLOTS];
+  for(int i=0; i<URING_SLOTS; i++) {
+    uring->slots[i].data = malloc(URING_SLOT_SIZE);
+    iov[i].iov_base = uring->slots[i].data;
+    iov[i].iov_len = URING_SLOT_SIZE;
+  }
+  uring->registered = io_uring_register(uring->fd, IORING_REGISTER_BUFFERS, iov, URING_SLOTS) == 0;
+  if(!uring->registered) {
+    INFO("io_uring buffers not registered: %s", strerror(errno));
+  }
+  return uring;
+}
+
+void delete_uring(uring_t* uring) {
+  if(uring->sqes != MAP_FAILED) {
+    munmap(uring->sqes, uring->sqes_size);
+  }
+  if(uring->cq_ring != MAP_FAILED && uring->cq_ring != uring->sq_ring) {
+    munmap(uring->cq_ring, uring->cq_ring_size);
+  }
+  if(uring->sq_ring != MAP_FAILED) {
+    munmap(uring->sq_ring, uring->sq_ring_size);
+  }
+  if(uring->fd >= 0) {
+    close(uring->fd);
+  }
+  for(int i=0; i<URING_SLOTS; i++) {
+    free(uring->slots[i].data);
+    free(uring->slots[i].timestamps);
+  }
+  free(uring);
+}
+
+static struct io_uring_sqe* next_sqe(uring_t* uring) {
+  unsigned tail = *uring->sq_tail;
+  unsigned index = tail & *uring->sq_mask;
+  struct io_uring_sqe* sqe = &uring->sqes[index];
+  memset(sqe, 0, sizeof(*sqe));
+  uring->sq_array[index] = index;
+  atomic_store_explicit((_Atomic unsigned*)uring->sq_tail, tail + 1, memory_order_release);
+  return sqe;
+}
+
+// Hands completed slots back in submission order, so a sync is only
+// reported once everything written before it is synced as well.
+static void retire_slots(uring_t* uring) {
+  bool progress = true;
+  while(progress) {
+    progress = false;
+    for(int i=0; i<URING_SLOTS; i++) {
+      uring_slot_t* slot = &uring->slots[i];
+      if(slot->busy && slot->synced && slot->sequence == uring->retired + 1) {
+        uring->complete(uring->arg, slot, true);
+        uring->retired++;
+        slot->busy = false;
+        slot->size = 0;
+        slot->number_timestamps = 0;
+        progress = true;
+      }
+    }
+  }
+}
+
+static void handle_cqe(uring_t* uring, struct io_uring_cqe* cqe) {
+  uring_slot_t* slot = &uring->slots[cqe->user_data >> 1];
+  bool sync = cqe->user_data & 1;
+  if(cqe->res < 0 || (!sync && (size_t)cqe->res != slot->size)) {
+    if(!slot->failed) {
+      ERROR("failed to %s output: %s", sync ? "sync" : "write", cqe->res < 0 ? strerror(-cqe->res) : "short write");
+    }
+    slot->failed = true;
+  }
+
+  if(sync) {
+    slot->synced = true;
+    uring->in_flight--;
+  } else {
+    slot->written = true;
+    if(!slot->failed) {
+      uring->complete(uring->arg, slot, false);
+    }
+  }
+}
+
+// Processes finished operations, waiting for at least one when asked to.
+int uring_reap(uring_t* uring, bool wait) {
+  if(wait && uring->in_flight > 0) {
+    if(io_uring_enter(uring->fd, 0, 1, IORING_ENTER_GETEVENTS) < 0 && errno != EINTR) {
+      ERROR("failed to wait io_uring: %s", strerror(errno));
+      return -1;
+    }
+  }
+
+  unsigned head = *uring->cq_head;
+  unsigned tail = atomic_load_explicit((_Atomic unsigned*)uring->cq_tail, memory_order_acquire);
+  while(head != tail) {
+    handle_cqe(uring, &uring->cqes[head & *uring->cq_mask]);
+    head++;
+  }
+  atomic_store_explicit((_Atomic unsigned*)uring->cq_head, head, memory_order_release);
+  retire_slots(uring);
+  return 0;
+}
+
+// Queues the write of the current slot and a linked fdatasync behind it.
+int uring_submit(uring_t* uring) {
+  if(uring->current < 0) {
+    return 0;
+  }
+
+  int index = uring->current;
+  uring_slot_t* slot = &uring->slots[index];
+  uring->current = -1;
+  slot->sequence = ++uring->submitted;
+
+  if(slot->size == 0) {
+    slot->written = true;
+    slot->synced = true;
+    retire_slots(uring);
+    return 0;
+  }
+
+  struct io_uring_sqe* sqe = next_sqe(uring);
+  sqe->opcode = uring->registered ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE;
+  sqe->fd = uring->target;
+  sqe->off = uring->offset;
+  sqe->addr = (uint64_t)(uintptr_t)slot->data;
+  sqe->len = slot->size;
+  sqe->buf_index = index;
+  sqe->flags = IOSQE_IO_LINK;
+  sqe->user_data = (uint64_t)index << 1;
+
+  sqe = next_sqe(uring);
+  sqe->opcode = IORING_OP_FSYNC;
+  sqe->fd = uring->target;
+  sqe->fsync_flags = IORING_FSYNC_DATASYNC;
+  sqe->user_data = ((uint64_t)index << 1) | 1;
+
+  uring->offset += slot->size;
+  uring->in_flight++;
+  while(io_uring_enter(uring->fd, 2, 0, 0) < 0) {
+    if(errno != EINTR) {
+      ERROR("failed to submit io_uring: %s", strerror(errno));
+      return -1;
+    }
+  }
+  return 0;
+}
+
+static int acquire_slot(uring_t* uring) {
+  while(1) {
+    for(int i=0; i<URING_SLOTS; i++) {
+      uring_slot_t* slot = &uring->slots[i];
+      if(!slot->busy) {
+        slot->busy = true;
+        slot->written = false;
+        slot->synced = false;
+        slot->failed = false;
+        slot->lsn = uring->lsn;
+        uring->current = i;
+        return 0;
+      }
+    }
+    if(uring_reap(uring, true) < 0) {
+      return -1;
+    }
+  }
+}
+
+// Copies the output into the current slot, submitting full slots and
+// waiting for a free one when all are in flight.
+int uring_append(uring_t* uring, char* data, size_t size, int64_t lsn, int64_t timestamp) {
+  do {
+    if(uring->current < 0 && acquire_slot(uring) < 0) {
+      return -1;
+    }
+
+    uring_slot_t* slot = &uring->slots[uring->current];
+    size_t length = URING_SLOT_SIZE - slot->size;
+    if(length > size) {
+      length = size;
+    }
+    memcpy(slot->data + slot->size, data, length);
+    slot->size += length;
+    data += length;
+    size -= length;
+
+    if(size == 0) {
+      slot->lsn = lsn;
+      uring->lsn = lsn;
+      if(timestamp > 0) {
+        if(slot->number_timestamps == slot->capacity_timestamps) {
+          slot->capacity_timestamps = slot->capacity_timestamps > 0 ? slot->capacity_timestamps * 2 : 16;
+          slot->timestamps = realloc(slot->timestamps, slot->capacity_timestamps * sizeof(int64_t));
+        }
+        slot->timestamps[slot->number_timestamps++] = timestamp;
+      }
+    }
+
+    if(slot->size == URING_SLOT_SIZE && uring_submit(uring) < 0) {
+      return -1;
+    }
+  } while(size > 0);
+  return 0;
+}
+
+bool uring_pending(uring_t* uring) {
+  return uring->in_flight > 0 || uring->current >= 0;
+}
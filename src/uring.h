@@ -0,0 +1,64 @@
+#pragma once
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <sys/types.h>
+
+#define URING_SLOTS 8
+#define URING_SLOT_SIZE (1024*1024)
+
+// Registered buffer that output is copied into and written at a fixed
+// offset, followed by a linked fdatasync.
+typedef struct {
+  char* data;
+  size_t size;
+  int64_t lsn;
+  int64_t* timestamps;
+  int number_timestamps;
+  int capacity_timestamps;
+  uint64_t sequence;
+  bool busy;
+  bool written;
+  bool synced;
+  bool failed;
+} uring_slot_t;
+
+// Called when a slot was written and, in order of submission, when its sync
+// completed. Failed slots are only reported as synced, with failed set.
+typedef void (*uring_complete_t)(void* arg, uring_slot_t* slot, bool synced);
+
+typedef struct {
+  int fd;
+  int target;
+  off_t offset;
+  bool registered;
+  void* sq_ring;
+  size_t sq_ring_size;
+  void* cq_ring;
+  size_t cq_ring_size;
+  struct io_uring_sqe* sqes;
+  size_t sqes_size;
+  unsigned* sq_head;
+  unsigned* sq_tail;
+  unsigned* sq_mask;
+  unsigned* sq_array;
+  unsigned* cq_head;
+  unsigned* cq_tail;
+  unsigned* cq_mask;
+  struct io_uring_cqe* cqes;
+  uring_slot_t slots[URING_SLOTS];
+  int current;
+  int in_flight;
+  int64_t lsn;
+  uint64_t submitted;
+  uint64_t retired;
+  uring_complete_t complete;
+  void* arg;
+} uring_t;
+
+uring_t* create_uring(int target, uring_complete_t complete, void* arg);
+void delete_uring(uring_t* uring);
+int uring_append(uring_t* uring, char* data, size_t size, int64_t lsn, int64_t timestamp);
+int uring_submit(uring_t* uring);
+int uring_reap(uring_t* uring, bool wait);
+bool uring_pending(uring_t* uring);
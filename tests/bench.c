@@ -0,0 +1,255 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include "../src/stream.h"
+#include "../src/options.h"
+#include "../src/queue.h"
+#include "../src/handler.h"
+#include "../src/sink.h"
+#include "../src/latency.h"
+
+// Drives the frame queue, the handler and the sinks with generated pgoutput
+// messages, one process per profile, and prints the results as JSON.
+
+typedef struct {
+  char* name;
+  int rows_per_transaction;
+  int columns;
+  int value_size;
+  int update_ratio;
+  bool toast;
+} profile_t;
+
+static profile_t PROFILES[] = {
+  { "tiny", 1, 3, 8, 0, false },
+  { "huge", 100000, 3, 16, 0, false },
+  { "wide", 10, 100, 16, 0, false },
+  { "toast", 10, 3, 8192, 50, true },
+  { "update", 10, 3, 16, 90, false },
+};
+
+#define NUMBER_PROFILES (int)(sizeof(PROFILES) / sizeof(profile_t))
+
+typedef struct {
+  char* data;
+  stream_t stream;
+} frame_writer_t;
+
+static void begin_frame(frame_writer_t* writer, size_t size) {
+  writer->data = malloc(size);
+  init_stream(&writer->stream, writer->data, size);
+  write_char(&writer->stream, 'w');
+  write_int64(&writer->stream, 0);
+  write_int64(&writer->stream, 0);
+  write_int64(&writer->stream, 0);
+}
+
+static size_t push_frame(queue_t* queue, frame_writer_t* writer) {
+  size_t size = stream_pos(&writer->stream);
+  queue_push(queue, writer->data, size, free);
+  return size;
+}
+
+static void write_value(stream_t* stream, char* value, int size) {
+  write_char(stream, 't');
+  write_int32(stream, size);
+  memcpy(stream->current, value, size);
+  stream->current += size;
+}
+
+static size_t push_relation(queue_t* queue, profile_t* profile) {
+  frame_writer_t writer;
+  begin_frame(&writer, 64 + profile->columns * 32);
+  stream_t* stream = &writer.stream;
+  write_char(stream, 'R');
+  write_int32(stream, 1);
+  write_string(stream, "public");
+  write_string(stream, profile->name);
+  write_int8(stream, 'd');
+  write_int16(stream, profile->columns);
+  for(int i=0; i<profile->columns; i++) {
+    char column[16];
+    sprintf(column, i == 0 ? "id" : "c%d", i);
+    write_int8(stream, i == 0 ? 1 : 0);
+    write_string(stream, column);
+    write_int32(stream, 25);
+    write_int32(stream, -1);
+  }
+  return push_frame(queue, &writer);
+}
+
+static size_t push_row(queue_t* queue, profile_t* profile, char* value, long row, bool update) {
+  frame_writer_t writer;
+  begin_frame(&writer, 64 + profile->columns * (profile->value_size + 8));
+  stream_t* stream = &writer.stream;
+  write_char(stream, update ? 'U' : 'I');
+  write_int32(stream, 1);
+  write_char(stream, 'N');
+  write_int16(stream, profile->columns);
+
+  char id[24];
+  int size = sprintf(id, "%ld", row);
+  write_value(stream, id, size);
+  for(int i=1; i<profile->columns; i++) {
+    if(update && profile->toast) {
+      write_char(stream, 'u');
+    } else {
+      write_value(stream, value, profile->value_size);
+    }
+  }
+  return push_frame(queue, &writer);
+}
+
+static size_t push_begin(queue_t* queue, int64_t timestamp) {
+  frame_writer_t writer;
+  begin_frame(&writer, 64);
+  write_char(&writer.stream, 'B');
+  write_int64(&writer.stream, 0);
+  write_int64(&writer.stream, timestamp);
+  write_int32(&writer.stream, 0);
+  return push_frame(queue, &writer);
+}
+
+static size_t push_commit(queue_t* queue, int64_t lsn, int64_t timestamp) {
+  frame_writer_t writer;
+  begin_frame(&writer, 64);
+  write_char(&writer.stream, 'C');
+  write_int8(&writer.stream, 0);
+  write_int64(&writer.stream, lsn);
+  write_int64(&writer.stream, lsn);
+  write_int64(&writer.stream, timestamp);
+  return push_frame(queue, &writer);
+}
+
+static double seconds_of(struct timeval time) {
+  return time.tv_sec + time.tv_usec / 1e6;
+}
+
+static double elapsed(struct timespec start) {
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+  return now.tv_sec - start.tv_sec + (now.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+static void run_profile(profile_t* profile, long rows, char* sink) {
+  options_t options = parse_options(0, NULL);
+  options.sinks[0] = sink;
+  options.number_sinks = 1;
+  if(profile->toast) {
+    options.toast_cache = 64*1024*1024;
+  }
+
+  FILE* report = fopen("/dev/null", "w");
+  sinks_t* sinks = create_sinks(options.sinks, options.number_sinks, &options);
+  if(sinks == NULL) {
+    exit(1);
+  }
+  latency_t* latency = create_latency(3600, report);
+  sinks_track_latency(sinks, latency);
+  queue_t* queue = create_queue(options.queue_size, QUEUE_BLOCK, NULL);
+  handler_t* handler = create_handler(sinks, queue, &options);
+
+  char* value = malloc(profile->value_size);
+  memset(value, 'v', profile->value_size);
+  srandom(42);
+
+  struct rusage before, after;
+  struct timespec start;
+  getrusage(RUSAGE_SELF, &before);
+  clock_gettime(CLOCK_MONOTONIC, &start);
+
+  pthread_t thread;
+  pthread_create(&thread, NULL, run_handler, handler);
+
+  size_t bytes = push_relation(queue, profile);
+  long transactions = 0;
+  for(long row=0; row<rows; transactions++) {
+    int64_t timestamp = postgres_now();
+    bytes += push_begin(queue, timestamp);
+    for(int i=0; i<profile->rows_per_transaction && row<rows; i++, row++) {
+      bool update = row > 0 && random() % 100 < profile->update_ratio;
+      long target = update ? row - 1 - random() % (row < 1000 ? row : 1000) : row;
+      bytes += push_row(queue, profile, value, target, update);
+    }
+    bytes += push_commit(queue, transactions + 1, timestamp);
+  }
+
+  queue_close(queue);
+  pthread_join(thread, NULL);
+  close_sinks(sinks);
+
+  double seconds = elapsed(start);
+  getrusage(RUSAGE_SELF, &after);
+  double cpu = seconds_of(after.ru_utime) - seconds_of(before.ru_utime)
+    + seconds_of(after.ru_stime) - seconds_of(before.ru_stime);
+
+  printf("  {\"profile\": \"%s\", \"rows\": %ld, \"transactions\": %ld, \"seconds\": %.3f, "
+    "\"rows_per_second\": %.0f, \"wal_mb_per_second\": %.2f, \"cpu_ns_per_row\": %.0f, "
+    "\"peak_rss_kb\": %ld, \"latency_us\": {\"p50\": %ld, \"p99\": %ld, \"p999\": %ld}}",
+    profile->name, rows, transactions, seconds,
+    rows / seconds, bytes / seconds / (1024*1024), cpu * 1e9 / rows,
+    after.ru_maxrss,
+    histogram_percentile(latency->sinks[0]->written, 50),
+    histogram_percentile(latency->sinks[0]->written, 99),
+    histogram_percentile(latency->sinks[0]->written, 99.9));
+  fflush(stdout);
+
+  delete_handler(handler);
+  delete_queue(queue);
+  delete_sinks(sinks);
+  delete_latency(latency);
+  fclose(report);
+  free(value);
+}
+
+int main(int argc, char* argv[]) {
+  char* name = NULL;
+  char* sink = "file:/dev/null";
+  long rows = 200000;
+  for(int i=1; i<argc; i++) {
+    if(strcmp(argv[i], "--profile") == 0 && i+1 < argc) {
+      name = argv[++i];
+    } else if(strcmp(argv[i], "--rows") == 0 && i+1 < argc) {
+      rows = atol(argv[++i]);
+    } else if(strcmp(argv[i], "--sink") == 0 && i+1 < argc) {
+      sink = argv[++i];
+    } else {
+      fprintf(stderr, "usage: %s [--profile name] [--rows count] [--sink spec]\n", argv[0]);
+      return 1;
+    }
+  }
+
+  printf("[\n");
+  bool first = true;
+  for(int i=0; i<NUMBER_PROFILES; i++) {
+    if(name != NULL && strcmp(name, PROFILES[i].name) != 0) {
+      continue;
+    }
+
+    if(!first) {
+      printf(",\n");
+    }
+    first = false;
+    fflush(stdout);
+
+    pid_t pid = fork();
+    if(pid == 0) {
+      run_profile(&PROFILES[i], rows, sink);
+      exit(0);
+    }
+
+    int status;
+    waitpid(pid, &status, 0);
+    if(!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+      fprintf(stderr, "profile %s failed\n", PROFILES[i].name);
+      return 1;
+    }
+  }
+  printf("\n]\n");
+  return 0;
+}
@@ -1,8 +1,27 @@
 #include <stdlib.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
 #include <check.h>
 #include "../src/stream.h"
 #include "../src/options.h"
 #include "../src/decoder.h"
+#include "../src/relations.h"
+#include "../src/toast.h"
+#include "../src/queue.h"
+#include "../src/handler.h"
+#include "../src/sink.h"
+#include "../src/server.h"
+#include "../src/compact.h"
+#include "../src/snapshot.h"
+#include "../src/latency.h"
+#include "../src/checksum.h"
+#include "../src/counters.h"
+#include "../src/mirror.h"
+#include "../src/columnar.h"
+#include "../src/ring.h"
+#include "../src/receiver.h"
+#include "../src/multiplex.h"
 
 START_TEST(read_char_test) 
 {
@@ -70,6 +89,29 @@ START_TEST(read_string_test)
 }
 END_TEST
 
+START_TEST(stream_remaining_test)
+{
+  char buffer[8];
+  stream_t* stream = create_stream(buffer, sizeof(buffer));
+  ck_assert_int_eq(stream_remaining(stream), 8);
+  ck_assert_int_eq(check_bytes(stream, 6), true);
+  ck_assert_int_eq(stream_remaining(stream), 2);
+  ck_assert_int_eq(check_bytes(stream, 4), false);
+  ck_assert_int_eq(stream_pos(stream), 6);
+  delete_stream(stream);
+}
+END_TEST
+
+START_TEST(check_string_unterminated_test)
+{
+  char buffer[] = { 'o', 'l', 'a' };
+  stream_t* stream = create_stream(buffer, sizeof(buffer));
+  ck_assert_int_eq(check_string(stream), false);
+  ck_assert_int_eq(stream_pos(stream), 0);
+  delete_stream(stream);
+}
+END_TEST
+
 START_TEST(test_parse_options)
 {
   int argc = 0;
@@ -86,6 +128,40 @@ START_TEST(test_parse_options)
   ck_assert_str_eq(options.publication, "cdc");
   ck_assert_int_eq(options.install, false);
   ck_assert_int_eq(options.uninstall, false);
+  ck_assert_int_eq(options.toast_cache, 0);
+  ck_assert_int_eq(options.queue_size, 64*1024*1024);
+  ck_assert_int_eq(options.receive_buffer, 0);
+  ck_assert_str_eq(options.queue_full, "block");
+  ck_assert_ptr_null(options.spill_dir);
+  ck_assert_int_eq(options.reconnect, false);
+  ck_assert_int_eq(options.number_sinks, 1);
+  ck_assert_str_eq(options.sinks[0], "file:-");
+  ck_assert_int_eq(options.history_size, 64*1024*1024);
+  ck_assert_int_eq(options.segment_size, 64*1024*1024);
+  ck_assert_int_eq(options.shm_size, 64*1024*1024);
+  ck_assert_int_eq(options.compact_window, 0);
+  ck_assert_int_eq(options.compact_lsn, 0);
+  ck_assert_int_eq(options.snapshot, 0);
+  ck_assert_int_eq(options.latency_report, 0);
+  ck_assert_int_eq(options.stamp_latency, false);
+  ck_assert_int_eq(options.counters_report, 0);
+  ck_assert_int_eq(options.lag_interval, 0);
+  ck_assert_int_eq(options.lag_threshold, 64*1024*1024);
+  ck_assert_int_eq(options.partitions, 0);
+  ck_assert_int_eq(options.durable, false);
+  ck_assert_int_eq(options.sync_interval, 0);
+  ck_assert_int_eq(options.checksum, false);
+  ck_assert_ptr_null(options.verify);
+  ck_assert_ptr_null(options.streaming);
+  ck_assert_int_eq(options.number_mirrors, 0);
+  ck_assert_str_eq(options.mirror_dump, "mirror.yaml");
+  ck_assert_int_eq(options.mirror_interval, 0);
+  ck_assert_int_eq(options.number_changed_columns, 0);
+  ck_assert_ptr_null(options.stats);
+  ck_assert_ptr_null(options.tenants);
+  ck_assert_ptr_null(options.arrow_dir);
+  ck_assert_int_eq(options.arrow_batch_rows, 65536);
+  ck_assert_int_eq(options.arrow_batch_ms, 0);
 }
 END_TEST
 
@@ -189,6 +265,94 @@ START_TEST(test_parse_options_uninstall)
 }
 END_TEST
 
+START_TEST(test_parse_options_toast_cache)
+{
+  int argc = 2;
+  char* argv[] = { "--toast-cache", "64M" };
+  options_t options = parse_options(argc, argv);
+
+  ck_assert_int_eq(options.toast_cache, 64*1024*1024);
+}
+END_TEST
+
+START_TEST(test_parse_options_queue)
+{
+  int argc = 6;
+  char* argv[] = { "--queue-size", "1K", "--queue-full", "spill", "--spill-dir", "/var/tmp" };
+  options_t options = parse_options(argc, argv);
+
+  ck_assert_int_eq(options.queue_size, 1024);
+  ck_assert_str_eq(options.queue_full, "spill");
+  ck_assert_str_eq(options.spill_dir, "/var/tmp");
+}
+END_TEST
+
+START_TEST(test_parse_options_reconnect)
+{
+  int argc = 1;
+  char* argv[] = { "--reconnect" };
+  options_t options = parse_options(argc, argv);
+
+  ck_assert_int_eq(options.reconnect, true);
+}
+END_TEST
+
+START_TEST(test_parse_options_sinks)
+{
+  int argc = 4;
+  char* argv[] = { "--sink", "file:cdc.yaml", "--sink", "pipe:gzip > cdc.yaml.gz" };
+  options_t options = parse_options(argc, argv);
+
+  ck_assert_int_eq(options.number_sinks, 2);
+  ck_assert_str_eq(options.sinks[0], "file:cdc.yaml");
+  ck_assert_str_eq(options.sinks[1], "pipe:gzip > cdc.yaml.gz");
+}
+END_TEST
+
+START_TEST(test_parse_options_compact)
+{
+  int argc = 4;
+  char* argv[] = { "--compact-window", "500", "--compact-lsn", "16M" };
+  options_t options = parse_options(argc, argv);
+
+  ck_assert_int_eq(options.compact_window, 500);
+  ck_assert_int_eq(options.compact_lsn, 16*1024*1024);
+}
+END_TEST
+
+START_TEST(test_parse_options_snapshot)
+{
+  int argc = 3;
+  char* argv[] = { "--install", "--snapshot", "4" };
+  options_t options = parse_options(argc, argv);
+
+  ck_assert_int_eq(options.install, true);
+  ck_assert_int_eq(options.snapshot, 4);
+}
+END_TEST
+
+START_TEST(test_parse_options_latency)
+{
+  int argc = 3;
+  char* argv[] = { "--latency-report", "10", "--stamp-latency" };
+  options_t options = parse_options(argc, argv);
+
+  ck_assert_int_eq(options.latency_report, 10);
+  ck_assert_int_eq(options.stamp_latency, true);
+}
+END_TEST
+
+START_TEST(test_parse_options_lag)
+{
+  int argc = 4;
+  char* argv[] = { "--lag-interval", "30", "--lag-threshold", "1G" };
+  options_t options = parse_options(argc, argv);
+
+  ck_assert_int_eq(options.lag_interval, 30);
+  ck_assert_int_eq(options.lag_threshold, 1024*1024*1024);
+}
+END_TEST
+
 START_TEST(test_parse_commit_success)
 {
   commit_t* commit;
@@ -313,6 +477,25 @@ START_TEST(parse_tuples_single_text_test)
 }
 END_TEST
 
+START_TEST(parse_tuples_unchanged_test)
+{
+  char buffer[1024];
+
+  stream_t* writer = create_stream(buffer, sizeof(buffer));
+  stream_t* reader = create_stream(buffer, sizeof(buffer));
+
+  write_int16(writer, 2);
+  write_char(writer, 'u');
+  write_char(writer, 'n');
+  tuples_t *tuples = parse_tuples(reader);
+
+  ck_assert_int_eq(tuples->size, 2);
+  ck_assert_str_eq(tuples->values[0], "UNCHANGED_TOAST");
+  ck_assert_str_eq(tuples->values[1], "NULL");
+  delete_tuples(tuples);
+}
+END_TEST
+
 START_TEST(parse_update_success_test)
 {
   char buffer[1024];
@@ -485,6 +668,1647 @@ START_TEST(parse_insert_test)
 }
 END_TEST
 
+START_TEST(parse_update_new_only_test)
+{
+  char buffer[1024];
+
+  stream_t* writer = create_stream(buffer, sizeof(buffer));
+  stream_t* reader = create_stream(buffer, sizeof(buffer));
+
+  write_int32(writer, 1);
+  write_char(writer, 'N');
+
+  //create tuple
+  write_int16(writer, 1);
+  write_char(writer, 't');
+  write_int32(writer, 10);
+  write_string(writer, "new tuple");
+
+  update_t* update = parse_update(reader);
+  ck_assert_int_eq(update->relation_id, 1);
+  ck_assert_ptr_null(update->from);
+  ck_assert_str_eq(update->to->values[0], "new tuple");
+}
+END_TEST
+
+START_TEST(validate_insert_test)
+{
+  char buffer[1024];
+
+  stream_t* writer = create_stream(buffer, sizeof(buffer));
+
+  write_char(writer, 'I');
+  write_int32(writer, 1);
+  write_char(writer, 'N');
+  write_int16(writer, 2);
+  write_char(writer, 'n');
+  write_char(writer, 't');
+  write_int32(writer, 5);
+  write_string(writer, "test");
+
+  stream_t* reader = create_stream(buffer, stream_pos(writer));
+  ck_assert_int_eq(validate_message(reader, false), true);
+  ck_assert_int_eq(stream_pos(reader), 0);
+}
+END_TEST
+
+START_TEST(validate_truncated_insert_test)
+{
+  char buffer[1024];
+
+  stream_t* writer = create_stream(buffer, sizeof(buffer));
+
+  write_char(writer, 'I');
+  write_int32(writer, 1);
+  write_char(writer, 'N');
+  write_int16(writer, 1);
+  write_char(writer, 't');
+  write_int32(writer, 100);
+  write_string(writer, "test");
+
+  stream_t* reader = create_stream(buffer, stream_pos(writer));
+  ck_assert_int_eq(validate_message(reader, false), false);
+}
+END_TEST
+
+START_TEST(validate_truncated_relation_test)
+{
+  char buffer[1024];
+
+  stream_t* writer = create_stream(buffer, sizeof(buffer));
+
+  write_char(writer, 'R');
+  write_int32(writer, 1);
+  write_string(writer, "test-namespace");
+  write_string(writer, "test-name");
+  write_int8(writer, 1);
+  write_int16(writer, 2);
+  write_int8(writer, 1);
+  write_string(writer, "column-a");
+  write_int32(writer, 1);
+  write_int32(writer, 1);
+
+  stream_t* reader = create_stream(buffer, stream_pos(writer));
+  ck_assert_int_eq(validate_message(reader, false), false);
+}
+END_TEST
+relation_t* create_test_relation(int64_t id) {
+  char buffer[1024];
+
+  stream_t* writer = create_stream(buffer, sizeof(buffer));
+  stream_t* reader = create_stream(buffer, sizeof(buffer));
+
+  write_int32(writer, id);
+  write_string(writer, "public");
+  write_string(writer, "documents");
+  write_int8(writer, 'd');
+  write_int16(writer, 2);
+
+  write_int8(writer, COLUMN_FLAG_KEY);
+  write_string(writer, "id");
+  write_int32(writer, 23);
+  write_int32(writer, -1);
+
+  write_int8(writer, 0);
+  write_string(writer, "body");
+  write_int32(writer, 3802);
+  write_int32(writer, -1);
+
+  relation_t* relation = parse_relation(reader);
+  delete_stream(writer);
+  delete_stream(reader);
+  return relation;
+}
+
+tuples_t* create_test_tuples(char* id, char* body) {
+  tuples_t* tuples = malloc(sizeof(tuples_t));
+  tuples->size = 2;
+  tuples->values = calloc(2, sizeof(char*));
+  tuples->values[0] = strdup(id);
+  tuples->values[1] = body == UNCHANGED_STR ? body : strdup(body);
+  return tuples;
+}
+
+START_TEST(relations_put_get_test)
+{
+  relations_t* relations = create_relations();
+  put_relation(relations, create_test_relation(10));
+  put_relation(relations, create_test_relation(266));
+  put_relation(relations, create_test_relation(10));
+
+  ck_assert_int_eq(get_relation(relations, 10)->id, 10);
+  ck_assert_str_eq(get_relation(relations, 266)->name, "documents");
+  ck_assert_ptr_null(get_relation(relations, 11));
+  delete_relations(relations);
+}
+END_TEST
+
+START_TEST(toast_cache_fill_test)
+{
+  relation_t* relation = create_test_relation(1);
+  toast_cache_t* cache = create_toast_cache(1024*1024);
+
+  tuples_t* inserted = create_test_tuples("1", "{\"large\": true}");
+  toast_cache_insert(cache, relation, inserted);
+
+  tuples_t* updated = create_test_tuples("1", (char*)UNCHANGED_STR);
+  toast_cache_update(cache, relation, NULL, updated);
+  ck_assert_str_eq(updated->values[1], "{\"large\": true}");
+
+  tuples_t* missing = create_test_tuples("2", (char*)UNCHANGED_STR);
+  toast_cache_update(cache, relation, NULL, missing);
+  ck_assert_ptr_eq(missing->values[1], UNCHANGED_STR);
+
+  toast_cache_delete(cache, relation, inserted);
+  tuples_t* deleted = create_test_tuples("1", (char*)UNCHANGED_STR);
+  toast_cache_update(cache, relation, NULL, deleted);
+  ck_assert_ptr_eq(deleted->values[1], UNCHANGED_STR);
+
+  delete_tuples(inserted);
+  delete_tuples(updated);
+  delete_tuples(missing);
+  delete_tuples(deleted);
+  delete_toast_cache(cache);
+  delete_relation(relation);
+}
+END_TEST
+
+START_TEST(toast_cache_eviction_test)
+{
+  relation_t* relation = create_test_relation(1);
+  toast_cache_t* cache = create_toast_cache(3*(sizeof(toast_entry_t)+64));
+
+  char id[16];
+  for(int i=0; i<10; i++) {
+    sprintf(id, "%d", i);
+    tuples_t* tuples = create_test_tuples(id, "body");
+    toast_cache_insert(cache, relation, tuples);
+    delete_tuples(tuples);
+  }
+
+  ck_assert_int_le(cache->bytes, cache->capacity);
+
+  tuples_t* oldest = create_test_tuples("0", (char*)UNCHANGED_STR);
+  toast_cache_update(cache, relation, NULL, oldest);
+  ck_assert_ptr_eq(oldest->values[1], UNCHANGED_STR);
+
+  tuples_t* newest = create_test_tuples("9", (char*)UNCHANGED_STR);
+  toast_cache_update(cache, relation, NULL, newest);
+  ck_assert_str_eq(newest->values[1], "body");
+
+  delete_tuples(oldest);
+  delete_tuples(newest);
+  delete_toast_cache(cache);
+  delete_relation(relation);
+}
+END_TEST
+
+void push_test_frame(queue_t* queue, int value) {
+  char* data = malloc(16);
+  sprintf(data, "frame-%d", value);
+  ck_assert_int_eq(queue_push(queue, data, 16, free), 0);
+}
+
+START_TEST(queue_order_test)
+{
+  queue_t* queue = create_queue(1024, QUEUE_BLOCK, NULL);
+  push_test_frame(queue, 1);
+  push_test_frame(queue, 2);
+  ck_assert_int_eq(queue->bytes, 32);
+
+  frame_t* frame = queue_pop(queue);
+  ck_assert_str_eq(frame->data, "frame-1");
+  delete_frame(frame);
+
+  queue_close(queue);
+  frame = queue_pop(queue);
+  ck_assert_str_eq(frame->data, "frame-2");
+  delete_frame(frame);
+
+  ck_assert_ptr_null(queue_pop(queue));
+  delete_queue(queue);
+}
+END_TEST
+
+START_TEST(queue_spill_test)
+{
+  char expected[16];
+  queue_t* queue = create_queue(32, QUEUE_SPILL, NULL);
+  for(int i=0; i<6; i++) {
+    push_test_frame(queue, i);
+  }
+
+  ck_assert_int_eq(queue->bytes, 32);
+  ck_assert_int_gt(queue->spill_write, 0);
+
+  for(int i=0; i<4; i++) {
+    frame_t* frame = queue_pop(queue);
+    sprintf(expected, "frame-%d", i);
+    ck_assert_str_eq(frame->data, expected);
+    delete_frame(frame);
+  }
+
+  // frames pushed while the spill file is not drained keep their order
+  push_test_frame(queue, 6);
+  for(int i=4; i<7; i++) {
+    frame_t* frame = queue_pop(queue);
+    sprintf(expected, "frame-%d", i);
+    ck_assert_str_eq(frame->data, expected);
+    delete_frame(frame);
+  }
+
+  ck_assert_int_eq(queue->spill_write, 0);
+  delete_queue(queue);
+}
+END_TEST
+
+START_TEST(queue_spill_failure_test)
+{
+  queue_t* queue = create_queue(32, QUEUE_SPILL, "/nonexistent");
+  push_test_frame(queue, 0);
+  push_test_frame(queue, 1);
+  ck_assert_int_ne(queue_push(queue, strdup("frame-2"), 16, free), 0);
+  delete_queue(queue);
+
+  queue = create_queue(32, QUEUE_SPILL, NULL);
+  for(int i=0; i<4; i++) {
+    push_test_frame(queue, i);
+  }
+  delete_frame(queue_pop(queue));
+  delete_frame(queue_pop(queue));
+  ck_assert(!queue_failed(queue));
+
+  // a spilled frame that can not be read back is not taken for a close
+  ck_assert_int_eq(ftruncate(queue->spill_fd, 0), 0);
+  ck_assert_ptr_null(queue_pop(queue));
+  ck_assert(queue_failed(queue));
+  delete_queue(queue);
+}
+END_TEST
+
+char* read_test_file(char* path) {
+  static char content[4096];
+  FILE* file = fopen(path, "r");
+  size_t size = fread(content, 1, sizeof(content)-1, file);
+  content[size] = '\0';
+  fclose(file);
+  return content;
+}
+
+void write_test_wal(handler_t* handler, char* buffer, stream_t* writer) {
+  stream_t reader;
+  init_stream(&reader, buffer, stream_pos(writer));
+  ck_assert_int_eq(handle_wal(handler, &reader), OK);
+}
+
+START_TEST(handler_fan_out_test)
+{
+  char buffer[1024];
+  char first[] = "/tmp/pgoutput2yml-check-first-XXXXXX";
+  char second[] = "/tmp/pgoutput2yml-check-second-XXXXXX";
+  close(mkstemp(first));
+  close(mkstemp(second));
+
+  char first_spec[64], second_spec[64];
+  sprintf(first_spec, "file:%s", first);
+  sprintf(second_spec, "file:%s", second);
+  char* specs[] = { first_spec, second_spec };
+
+  options_t options = parse_options(0, NULL);
+  sinks_t* sinks = create_sinks(specs, 2, &options);
+  ck_assert_ptr_nonnull(sinks);
+  handler_t* handler = create_handler(sinks, NULL, &options);
+
+  stream_t* writer = create_stream(buffer, sizeof(buffer));
+  write_int64(writer, 0);
+  write_int64(writer, 0);
+  write_int64(writer, 0);
+  write_char(writer, 'I');
+  write_int32(writer, 1);
+  write_char(writer, 'N');
+  write_int16(writer, 1);
+  write_char(writer, 't');
+  write_int32(writer, 5);
+  write_string(writer, "test");
+  write_test_wal(handler, buffer, writer);
+
+  writer->current = buffer;
+  write_int64(writer, 0);
+  write_int64(writer, 0);
+  write_int64(writer, 0);
+  write_char(writer, 'C');
+  write_int8(writer, 0);
+  write_int64(writer, 42);
+  write_int64(writer, 43);
+  write_int64(writer, 0);
+  write_test_wal(handler, buffer, writer);
+
+  close_sinks(sinks);
+  ck_assert_int_eq(sinks_durable_lsn(sinks), 42);
+
+  char* expected = "---\nrelation_id: 1\noperation: insert\ndata:\n  - test\n---\n";
+  ck_assert_str_eq(read_test_file(first), expected);
+  ck_assert_str_eq(read_test_file(second), expected);
+
+  delete_handler(handler);
+  delete_sinks(sinks);
+  delete_stream(writer);
+  unlink(first);
+  unlink(second);
+}
+END_TEST
+
+void write_test_commit(handler_t* handler, char* buffer, stream_t* writer, int64_t lsn) {
+  writer->current = buffer;
+  write_int64(writer, 0);
+  write_int64(writer, 0);
+  write_int64(writer, 0);
+  write_char(writer, 'C');
+  write_int8(writer, 0);
+  write_int64(writer, lsn);
+  write_int64(writer, lsn);
+  write_int64(writer, 0);
+  write_test_wal(handler, buffer, writer);
+}
+
+START_TEST(handler_batching_test)
+{
+  char buffer[1024];
+  char path[] = "/tmp/pgoutput2yml-check-batching-XXXXXX";
+  close(mkstemp(path));
+  char spec[64];
+  sprintf(spec, "file:%s", path);
+  char* specs[] = { spec };
+
+  options_t options = parse_options(0, NULL);
+  sinks_t* sinks = create_sinks(specs, 1, &options);
+  handler_t* handler = create_handler(sinks, NULL, &options);
+  handler_set_batching(handler, true);
+
+  stream_t* writer = create_stream(buffer, sizeof(buffer));
+  write_test_commit(handler, buffer, writer, 10);
+  write_test_commit(handler, buffer, writer, 20);
+  ck_assert_int_eq(atomic_load(&handler->pending), true);
+  ck_assert_int_eq(handler_feedback_lsn(handler, 0, 30), 0);
+
+  flush_handler(handler);
+  handler_set_batching(handler, false);
+  write_test_commit(handler, buffer, writer, 30);
+  ck_assert_int_eq(atomic_load(&handler->pending), false);
+
+  close_sinks(sinks);
+  ck_assert_int_eq(sinks_durable_lsn(sinks), 30);
+
+  delete_handler(handler);
+  delete_sinks(sinks);
+  delete_stream(writer);
+  unlink(path);
+}
+END_TEST
+
+void write_test_stream_message(handler_t* handler, char* buffer, stream_t* writer, char type, int32_t transaction) {
+  writer->current = buffer;
+  write_int64(writer, 0);
+  write_int64(writer, 0);
+  write_int64(writer, 0);
+  write_char(writer, type);
+  if(type == 'S') {
+    write_int32(writer, transaction);
+    write_int8(writer, 0);
+  } else if(type == 'I') {
+    write_int32(writer, transaction);
+    write_int32(writer, 1);
+    write_char(writer, 'N');
+    write_int16(writer, 1);
+    write_char(writer, 't');
+    write_int32(writer, 4);
+    sprintf(writer->current, "v%03d", transaction);
+    writer->current += 4;
+  }
+  write_test_wal(handler, buffer, writer);
+}
+
+START_TEST(handler_streaming_test)
+{
+  char buffer[1024];
+  char path[] = "/tmp/pgoutput2yml-check-streaming-XXXXXX";
+  close(mkstemp(path));
+  char spec[64];
+  sprintf(spec, "file:%s", path);
+  char* specs[] = { spec };
+
+  options_t options = parse_options(0, NULL);
+  sinks_t* sinks = create_sinks(specs, 1, &options);
+  handler_t* handler = create_handler(sinks, NULL, &options);
+
+  stream_t* writer = create_stream(buffer, sizeof(buffer));
+  write_test_stream_message(handler, buffer, writer, 'S', 10);
+  write_test_stream_message(handler, buffer, writer, 'I', 10);
+  write_test_stream_message(handler, buffer, writer, 'E', 0);
+  write_test_stream_message(handler, buffer, writer, 'S', 20);
+  write_test_stream_message(handler, buffer, writer, 'I', 20);
+  write_test_stream_message(handler, buffer, writer, 'E', 0);
+  write_test_stream_message(handler, buffer, writer, 'S', 10);
+  write_test_stream_message(handler, buffer, writer, 'I', 11);
+  write_test_stream_message(handler, buffer, writer, 'I', 10);
+  write_test_stream_message(handler, buffer, writer, 'E', 0);
+  ck_assert_int_eq(atomic_load(&handler->open_streams), 2);
+  ck_assert_int_eq(handler_feedback_lsn(handler, 0, 30), 0);
+
+  writer->current = buffer;
+  write_int64(writer, 0);
+  write_int64(writer, 0);
+  write_int64(writer, 0);
+  write_char(writer, 'A');
+  write_int32(writer, 10);
+  write_int32(writer, 11);
+  write_test_wal(handler, buffer, writer);
+
+  for(int i=0; i<2; i++) {
+    writer->current = buffer;
+    write_int64(writer, 0);
+    write_int64(writer, 0);
+    write_int64(writer, 0);
+    write_char(writer, 'c');
+    write_int32(writer, i == 0 ? 20 : 10);
+    write_int8(writer, 0);
+    write_int64(writer, 5 + i);
+    write_int64(writer, 5 + i);
+    write_int64(writer, 0);
+    write_test_wal(handler, buffer, writer);
+  }
+  ck_assert_int_eq(atomic_load(&handler->open_streams), 0);
+
+  close_sinks(sinks);
+  ck_assert_int_eq(sinks_durable_lsn(sinks), 6);
+  ck_assert_str_eq(read_test_file(path), "---\n"
+    "relation_id: 1\noperation: insert\ndata:\n  - v020\n---\n"
+    "relation_id: 1\noperation: insert\ndata:\n  - v010\n---\n"
+    "relation_id: 1\noperation: insert\ndata:\n  - v010\n---\n");
+
+  delete_handler(handler);
+  delete_sinks(sinks);
+  delete_stream(writer);
+  unlink(path);
+}
+END_TEST
+
+START_TEST(handler_streaming_toast_cache_test)
+{
+  char buffer[1024];
+  stream_t* writer = create_stream(buffer, sizeof(buffer));
+  stream_t* reader = create_stream(buffer, sizeof(buffer));
+  write_int32(writer, 1);
+  write_string(writer, "public");
+  write_string(writer, "documents");
+  write_int8(writer, 'd');
+  write_int16(writer, 1);
+  write_int8(writer, COLUMN_FLAG_KEY);
+  write_string(writer, "id");
+  write_int32(writer, 25);
+  write_int32(writer, -1);
+
+  char* specs[] = { "file:/dev/null" };
+  options_t options = parse_options(0, NULL);
+  options.toast_cache = 1024*1024;
+  sinks_t* sinks = create_sinks(specs, 1, &options);
+  handler_t* handler = create_handler(sinks, NULL, &options);
+  put_relation(handler->relations, parse_relation(reader));
+
+  // rows of a transaction that may still abort are kept out of the cache
+  write_test_stream_message(handler, buffer, writer, 'S', 10);
+  write_test_stream_message(handler, buffer, writer, 'I', 10);
+  write_test_stream_message(handler, buffer, writer, 'E', 0);
+  ck_assert_int_eq(handler->toast_cache->bytes, 0);
+
+  close_sinks(sinks);
+  delete_handler(handler);
+  delete_sinks(sinks);
+  delete_stream(reader);
+  delete_stream(writer);
+}
+END_TEST
+
+START_TEST(handler_partitions_test)
+{
+  char buffer[1024];
+  char paths[2][64];
+  char specs_data[2][80];
+  char* specs[2];
+  for(int i=0; i<2; i++) {
+    sprintf(paths[i], "/tmp/pgoutput2yml-check-partition-XXXXXX");
+    close(mkstemp(paths[i]));
+    sprintf(specs_data[i], "file:%s", paths[i]);
+    specs[i] = specs_data[i];
+  }
+
+  options_t options = parse_options(0, NULL);
+  options.partitions = 2;
+  sinks_t* sinks = create_sinks(specs, 2, &options);
+  handler_t* handler = create_handler(sinks, NULL, &options);
+  put_relation(handler->relations, create_test_relation(1));
+
+  stream_t* writer = create_stream(buffer, sizeof(buffer));
+  write_int64(writer, 0);
+  write_int64(writer, 0);
+  write_int64(writer, 0);
+  write_char(writer, 'B');
+  write_int64(writer, 0x100000020LL);
+  write_int64(writer, 0);
+  write_int32(writer, 7);
+  write_test_wal(handler, buffer, writer);
+
+  char* keys[] = { "1", "2", "3", "4", "1" };
+  for(int i=0; i<5; i++) {
+    writer->current = buffer;
+    write_int64(writer, 0);
+    write_int64(writer, 0);
+    write_int64(writer, 0);
+    write_char(writer, 'I');
+    write_int32(writer, 1);
+    write_char(writer, 'N');
+    write_int16(writer, 2);
+    write_char(writer, 't');
+    write_int32(writer, 1);
+    write_char(writer, keys[i][0]);
+    write_char(writer, 't');
+    write_int32(writer, 1);
+    write_char(writer, '0' + i);
+    write_test_wal(handler, buffer, writer);
+  }
+
+  // the key 1 becomes a key of the other partition
+  char new_key[] = "5";
+  while(hash_relation_key(1, new_key, 2) % 2 == hash_relation_key(1, "1", 2) % 2) {
+    new_key[0]++;
+  }
+  writer->current = buffer;
+  write_int64(writer, 0);
+  write_int64(writer, 0);
+  write_int64(writer, 0);
+  write_char(writer, 'U');
+  write_int32(writer, 1);
+  write_char(writer, 'K');
+  write_int16(writer, 2);
+  write_char(writer, 't');
+  write_int32(writer, 1);
+  write_char(writer, '1');
+  write_char(writer, 'n');
+  write_char(writer, 'N');
+  write_int16(writer, 2);
+  write_char(writer, 't');
+  write_int32(writer, 1);
+  write_char(writer, new_key[0]);
+  write_char(writer, 't');
+  write_int32(writer, 1);
+  write_char(writer, '5');
+  write_test_wal(handler, buffer, writer);
+  write_test_commit(handler, buffer, writer, 0x100000020LL);
+
+  close_sinks(sinks);
+  ck_assert_int_eq(sinks_durable_lsn(sinks), 0x100000020LL);
+
+  int records = 0;
+  for(int i=0; i<2; i++) {
+    char* output = read_test_file(paths[i]);
+    for(char* found = output; (found = strstr(found, "commit_lsn: 1/20\n")) != NULL; found++) {
+      records++;
+    }
+    char* first = strstr(output, "  - 1\n  - 0\n");
+    char* second = strstr(output, "  - 1\n  - 4\n");
+    char* update = strstr(output, "operation: update\n");
+    ck_assert((first == NULL) == (second == NULL));
+    ck_assert(first == NULL || first < second);
+    ck_assert((first == NULL) == (update == NULL));
+    ck_assert(first == NULL || second < update);
+  }
+  ck_assert_int_eq(records, 6);
+
+  delete_handler(handler);
+  delete_sinks(sinks);
+  delete_stream(writer);
+  unlink(paths[0]);
+  unlink(paths[1]);
+}
+END_TEST
+
+START_TEST(crc32c_test)
+{
+  ck_assert_uint_eq(crc32c(0, "123456789", 9), 0xe3069283);
+  ck_assert_uint_eq(crc32c_portable(0, "123456789", 9), 0xe3069283);
+
+  char data[1027];
+  for(size_t i=0; i<sizeof(data); i++) {
+    data[i] = i * 31 + 7;
+  }
+  uint32_t crc = crc32c(0, data, sizeof(data));
+  ck_assert_uint_eq(crc32c_portable(0, data, sizeof(data)), crc);
+  ck_assert_uint_eq(crc32c(crc32c(0, data, 100), data + 100, sizeof(data) - 100), crc);
+}
+END_TEST
+
+START_TEST(handler_checksum_test)
+{
+  char buffer[1024];
+  char path[] = "/tmp/pgoutput2yml-check-checksum-XXXXXX";
+  close(mkstemp(path));
+  char spec[64];
+  sprintf(spec, "file:%s", path);
+  char* specs[] = { spec };
+
+  options_t options = parse_options(0, NULL);
+  options.checksum = true;
+  sinks_t* sinks = create_sinks(specs, 1, &options);
+  handler_t* handler = create_handler(sinks, NULL, &options);
+
+  stream_t* writer = create_stream(buffer, sizeof(buffer));
+  for(int lsn=1; lsn<=2; lsn++) {
+    writer->current = buffer;
+    write_int64(writer, 0);
+    write_int64(writer, 0);
+    write_int64(writer, 0);
+    write_char(writer, 'I');
+    write_int32(writer, 1);
+    write_char(writer, 'N');
+    write_int16(writer, 1);
+    write_char(writer, 't');
+    write_int32(writer, 4);
+    write_string(writer, "test");
+    write_test_wal(handler, buffer, writer);
+    write_test_commit(handler, buffer, writer, lsn);
+  }
+  write_test_commit(handler, buffer, writer, 3);
+  close_sinks(sinks);
+
+  char* record = "relation_id: 1\noperation: insert\ndata:\n  - test\n---\n";
+  char expected[256];
+  sprintf(expected, "---\n%scrc32c: %08x\n---\n%scrc32c: %08x\n---\n", record,
+    crc32c(0, record, strlen(record)), record, crc32c(0, record, strlen(record)));
+  ck_assert_str_eq(read_test_file(path), expected);
+  ck_assert_int_eq(verify_checksums(path), 0);
+
+  // a restarted sink appends its header after the last trailer
+  FILE* file = fopen(path, "a");
+  fprintf(file, "---\n%scrc32c: %08x\n---\n", record, crc32c(0, record, strlen(record)));
+  fclose(file);
+  ck_assert_int_eq(verify_checksums(path), 0);
+
+  file = fopen(path, "r+");
+  fseek(file, 10, SEEK_SET);
+  fputc('X', file);
+  fclose(file);
+  ck_assert_int_eq(verify_checksums(path), 1);
+
+  delete_handler(handler);
+  delete_sinks(sinks);
+  delete_stream(writer);
+  unlink(path);
+}
+END_TEST
+
+START_TEST(mirror_test)
+{
+  char* tables[] = { "public.documents" };
+  relations_t* relations = create_relations();
+  relation_t* relation = create_test_relation(1);
+  put_relation(relations, relation);
+  put_relation(relations, create_test_relation(2));
+  free(get_relation(relations, 2)->name);
+  get_relation(relations, 2)->name = strdup("other");
+
+  char path[] = "/tmp/pgoutput2yml-check-mirror-XXXXXX";
+  close(mkstemp(path));
+  mirror_t* mirror = create_mirror(tables, 1, path, 0);
+  mirror_relation(mirror, relation);
+  mirror_relation(mirror, get_relation(relations, 2));
+  ck_assert_int_eq(mirror->number_relations, 1);
+
+  tuples_t* first = create_test_tuples("1", "one");
+  tuples_t* second = create_test_tuples("2", "two");
+  tuples_t* third = create_test_tuples("3", "three");
+  mirror_insert(mirror, relation, first);
+  mirror_insert(mirror, relation, second);
+  mirror_insert(mirror, relation, third);
+  mirror_insert(mirror, get_relation(relations, 2), first);
+  mirror_delete(mirror, relation, second);
+
+  tuples_t* unchanged = create_test_tuples("1", (char*)UNCHANGED_STR);
+  for(int i=0; i<50000; i++) {
+    mirror_update(mirror, relation, NULL, unchanged);
+  }
+  tuples_t* renamed_from = create_test_tuples("3", "three");
+  tuples_t* renamed_to = create_test_tuples("4", "four");
+  mirror_update(mirror, relation, renamed_from, renamed_to);
+  ck_assert_int_eq(mirror->size, 2);
+  ck_assert(mirror->bytes < 2 * 1024 * 1024);
+
+  mirror_request_dump(mirror);
+  ck_assert_int_eq(mirror_remaining_ms(mirror), 0);
+  mirror_dump(mirror, relations, 0x100000020LL);
+  ck_assert(mirror_remaining_ms(mirror) > 0);
+  delete_mirror(mirror);
+
+  char* output = read_test_file(path);
+  char* header = "---\nmirror_lsn: 1/20\n---\nrelation_id: 1\noperation: relation\n";
+  ck_assert(strncmp(output, header, strlen(header)) == 0);
+  ck_assert_ptr_nonnull(strstr(output, "relation_id: 1\noperation: insert\ndata:\n  - 1\n  - one\n---\n"));
+  ck_assert_ptr_nonnull(strstr(output, "relation_id: 1\noperation: insert\ndata:\n  - 4\n  - four\n---\n"));
+  ck_assert_ptr_null(strstr(output, "  - two\n"));
+  ck_assert_ptr_null(strstr(output, "  - three\n"));
+  ck_assert_ptr_null(strstr(output, "relation_id: 2\n"));
+
+  delete_tuples(first);
+  delete_tuples(second);
+  delete_tuples(third);
+  delete_tuples(unchanged);
+  delete_tuples(renamed_from);
+  delete_tuples(renamed_to);
+  delete_relations(relations);
+  unlink(path);
+}
+END_TEST
+
+START_TEST(stats_test)
+{
+  relations_t* relations = create_relations();
+  relation_t* relation = create_test_relation(1);
+  put_relation(relations, relation);
+
+  char path[] = "/tmp/pgoutput2yml-check-stats-XXXXXX";
+  close(mkstemp(path));
+  stats_t* stats = create_stats(path);
+
+  char id[16];
+  for(int i=0; i<10000; i++) {
+    sprintf(id, "%d", i);
+    tuples_t* tuples = create_test_tuples(id, "value");
+    stats_change(stats, 1, relation, 'I', 30, tuples);
+    delete_tuples(tuples);
+  }
+  tuples_t* hot = create_test_tuples("7", "hot");
+  for(int i=0; i<500; i++) {
+    stats_change(stats, 1, relation, 'U', 20, hot);
+  }
+  stats_change(stats, 1, relation, 'D', 10, hot);
+  stats_change(stats, 2, NULL, 'I', 40, hot);
+  for(int i=3; i<200; i++) {
+    stats_change(stats, i, NULL, 'D', 1, NULL);
+  }
+  ck_assert_int_eq(stats->number_tables, 199);
+  ck_assert_int_le(stats->number_hot_keys, STATS_HOT_KEYS);
+
+  stats_request_dump(stats);
+  ck_assert_int_eq(stats_remaining_ms(stats), 0);
+  stats_dump(stats, relations, 0x100000020LL);
+  ck_assert(stats_remaining_ms(stats) > 0);
+  delete_stats(stats);
+
+  static char output[65536];
+  FILE* file = fopen(path, "r");
+  output[fread(output, 1, sizeof(output)-1, file)] = '\0';
+  fclose(file);
+  char* tables = "---\nstats_lsn: 1/20\ntables:\n  - relation_id: 1\n    name: public.documents\n"
+    "    inserts: 10000\n    updates: 500\n    deletes: 1\n    bytes: 310010\n    average_width: 29\n"
+    "  - relation_id: 2\n    inserts: 1\n";
+  ck_assert(strncmp(output, tables, strlen(tables)) == 0);
+  char* hot_keys = "hot_keys:\n  - relation_id: 1\n    name: public.documents\n    count: ";
+  char* hottest = strstr(output, hot_keys);
+  ck_assert_ptr_nonnull(hottest);
+  ck_assert(atoi(hottest + strlen(hot_keys)) >= 502);
+  ck_assert_ptr_nonnull(strstr(hottest, "    key:\n      - 7\n"));
+
+  delete_tuples(hot);
+  delete_relations(relations);
+  unlink(path);
+}
+END_TEST
+
+void write_test_tenant_wal(tenant_t* tenant, char* buffer, stream_t* writer) {
+  stream_t reader;
+  init_stream(&reader, buffer, stream_pos(writer));
+  ck_assert_int_eq(handle_tenant_wal(tenant, &reader), OK);
+  writer->current = buffer;
+  write_int64(writer, 0);
+  write_int64(writer, 0);
+  write_int64(writer, 0);
+}
+
+START_TEST(multiplexer_test)
+{
+  char path[] = "/tmp/pgoutput2yml-check-tenants-XXXXXX";
+  char first[] = "/tmp/pgoutput2yml-check-tenant-XXXXXX";
+  char second[] = "/tmp/pgoutput2yml-check-tenant-XXXXXX";
+  close(mkstemp(first));
+  close(mkstemp(second));
+  int fd = mkstemp(path);
+  dprintf(fd, "# database slot publication output\n\nfirst first_slot pub %s\n  second\tsecond_slot pub %s\n", first, second);
+  close(fd);
+
+  options_t options = parse_options(0, NULL);
+  options.changed_columns[options.number_changed_columns++] = "*";
+  multiplexer_t* multiplexer = create_multiplexer(&options, path);
+  ck_assert_ptr_nonnull(multiplexer);
+  ck_assert_int_eq(multiplexer->number_tenants, 2);
+  tenant_t* tenant = &multiplexer->tenants[1];
+  ck_assert_str_eq(tenant->dbname, "second");
+  ck_assert_str_eq(tenant->slotname, "second_slot");
+  ck_assert_str_eq(tenant->publication, "pub");
+  ck_assert_str_eq(tenant->output, second);
+  ck_assert_int_eq(tenant->state, TENANT_WAITING);
+
+  char buffer[1024];
+  stream_t* writer = create_stream(buffer, sizeof(buffer));
+  write_int64(writer, 0);
+  write_int64(writer, 0);
+  write_int64(writer, 0);
+  write_char(writer, 'B');
+  write_int64(writer, 42);
+  write_int64(writer, 0);
+  write_int32(writer, 7);
+  write_test_tenant_wal(tenant, buffer, writer);
+  ck_assert(tenant->in_transaction);
+
+  write_char(writer, 'I');
+  write_int32(writer, 1);
+  write_char(writer, 'N');
+  write_int16(writer, 1);
+  write_char(writer, 't');
+  write_int32(writer, 5);
+  write_string(writer, "test");
+  write_test_tenant_wal(tenant, buffer, writer);
+
+  tenant->server_lsn = 100;
+  ck_assert_int_eq(tenant_feedback_lsn(tenant), 0);
+  write_char(writer, 'C');
+  write_int8(writer, 0);
+  write_int64(writer, 42);
+  write_int64(writer, 43);
+  write_int64(writer, 0);
+  write_test_tenant_wal(tenant, buffer, writer);
+  ck_assert_int_eq(tenant->received_lsn, 42);
+  ck_assert(!tenant->in_transaction);
+  ck_assert_int_eq(tenant_feedback_lsn(tenant), 100);
+
+  ck_assert_str_eq(read_test_file(second), "---\nrelation_id: 1\noperation: insert\ndata:\n  - test\n---\n");
+  ck_assert_str_eq(read_test_file(first), "---\n");
+
+  write_char(writer, 'R');
+  write_int32(writer, 1);
+  write_string(writer, "public");
+  write_string(writer, "documents");
+  write_int8(writer, 'f');
+  write_int16(writer, 1);
+  write_int8(writer, COLUMN_FLAG_KEY);
+  write_string(writer, "id");
+  write_int32(writer, 23);
+  write_int32(writer, -1);
+  write_test_tenant_wal(tenant, buffer, writer);
+  ck_assert(get_relation(tenant->relations, 1)->changed_columns);
+
+  delete_multiplexer(multiplexer);
+  FILE* file = fopen(path, "a");
+  fputs("third slot\n", file);
+  fclose(file);
+  ck_assert_ptr_null(create_multiplexer(&options, path));
+
+  delete_stream(writer);
+  unlink(path);
+  unlink(first);
+  unlink(second);
+}
+END_TEST
+
+START_TEST(counters_test)
+{
+  counter_sample_t sample;
+  counters_begin(NULL, &sample);
+  ck_assert_int_eq(sample.valid, false);
+
+  FILE* report = fopen("/dev/null", "w");
+  counters_t* counters = create_counters(3600, report);
+  if(counters != NULL) {
+    counters_begin(counters, &sample);
+    volatile long sum = 0;
+    for(int i=0; i<10000; i++) {
+      sum += i;
+    }
+    counters_end(counters, &sample, 'I', STAGE_PARSE);
+    ck_assert_int_eq(counters->stages['I'][STAGE_PARSE].count, 1);
+    ck_assert(counters->stages['I'][STAGE_PARSE].values[1] > 10000);
+    delete_counters(counters);
+  }
+  fclose(report);
+}
+END_TEST
+
+START_TEST(histogram_percentile_test)
+{
+  histogram_t* histogram = create_histogram();
+  ck_assert_int_eq(histogram_percentile(histogram, 50), 0);
+
+  for(int i=1; i<=1000; i++) {
+    histogram_record(histogram, i * 1000);
+  }
+
+  ck_assert_int_eq(histogram_count(histogram), 1000);
+  int64_t p50 = histogram_percentile(histogram, 50);
+  int64_t p99 = histogram_percentile(histogram, 99);
+  ck_assert(p50 > 500000 * 0.96 && p50 <= 500000);
+  ck_assert(p99 > 990000 * 0.96 && p99 <= 990000);
+  ck_assert_int_eq(histogram_percentile(histogram, 100), 1000000);
+  delete_histogram(histogram);
+}
+END_TEST
+
+START_TEST(handler_latency_test)
+{
+  char buffer[1024];
+  char path[] = "/tmp/pgoutput2yml-check-latency-XXXXXX";
+  close(mkstemp(path));
+  char spec[64];
+  sprintf(spec, "file:%s", path);
+  char* specs[] = { spec };
+
+  FILE* report = fopen("/dev/null", "w");
+  latency_t* latency = create_latency(3600, report);
+  options_t options = parse_options(0, NULL);
+  sinks_t* sinks = create_sinks(specs, 1, &options);
+  sinks_track_latency(sinks, latency);
+  options.stamp_latency = true;
+  handler_t* handler = create_handler(sinks, NULL, &options);
+
+  int64_t timestamp = postgres_now() - 5000;
+  stream_t* writer = create_stream(buffer, sizeof(buffer));
+  write_int64(writer, 0);
+  write_int64(writer, 0);
+  write_int64(writer, 0);
+  write_char(writer, 'B');
+  write_int64(writer, 42);
+  write_int64(writer, timestamp);
+  write_int32(writer, 7);
+  write_test_wal(handler, buffer, writer);
+
+  writer->current = buffer;
+  write_int64(writer, 0);
+  write_int64(writer, 0);
+  write_int64(writer, 0);
+  write_char(writer, 'I');
+  write_int32(writer, 1);
+  write_char(writer, 'N');
+  write_int16(writer, 1);
+  write_char(writer, 'n');
+  write_test_wal(handler, buffer, writer);
+
+  writer->current = buffer;
+  write_int64(writer, 0);
+  write_int64(writer, 0);
+  write_int64(writer, 0);
+  write_char(writer, 'C');
+  write_int8(writer, 0);
+  write_int64(writer, 42);
+  write_int64(writer, 43);
+  write_int64(writer, timestamp);
+  write_test_wal(handler, buffer, writer);
+
+  close_sinks(sinks);
+  ck_assert_int_eq(latency->number_sinks, 1);
+  ck_assert_int_eq(histogram_count(latency->sinks[0]->written), 1);
+  ck_assert_int_eq(histogram_count(latency->sinks[0]->flushed), 1);
+  ck_assert(histogram_percentile(latency->sinks[0]->written, 50) >= 5000 * 0.96);
+
+  char* output = read_test_file(path);
+  ck_assert_ptr_nonnull(strstr(output, "commit_timestamp: "));
+  ck_assert_ptr_nonnull(strstr(output, "encode_latency_us: "));
+
+  char formatted[64];
+  format_timestamp(1, formatted, sizeof(formatted));
+  ck_assert_str_eq(formatted, "2000-01-01T00:00:00.000001Z");
+
+  delete_handler(handler);
+  delete_sinks(sinks);
+  delete_latency(latency);
+  fclose(report);
+  delete_stream(writer);
+  unlink(path);
+}
+END_TEST
+
+START_TEST(handler_feedback_lsn_test)
+{
+  char* specs[] = { "file:/dev/null" };
+  options_t options = parse_options(0, NULL);
+  sinks_t* sinks = create_sinks(specs, 1, &options);
+  handler_t* handler = create_handler(sinks, NULL, &options);
+  atomic_store(&sinks->sinks[0]->durable_lsn, 100);
+  atomic_store(&handler->handled, 2);
+  while(!sinks_idle(sinks));
+
+  ck_assert_int_eq(handler_feedback_lsn(handler, 3, 200), 100);
+  ck_assert_int_eq(handler_feedback_lsn(handler, 2, 200), 200);
+  ck_assert_int_eq(handler_feedback_lsn(handler, 2, 50), 100);
+
+  // rows held in an arrow batch are never confirmed
+  atomic_store(&handler->buffered_lsn, 150);
+  ck_assert_int_eq(handler_feedback_lsn(handler, 2, 200), 149);
+  atomic_store(&handler->buffered_lsn, 0);
+
+  atomic_store(&handler->in_transaction, true);
+  ck_assert_int_eq(handler_feedback_lsn(handler, 2, 200), 100);
+
+  close_sinks(sinks);
+  delete_handler(handler);
+  delete_sinks(sinks);
+}
+END_TEST
+
+START_TEST(buffer_references_test)
+{
+  buffer_t* buffer = create_buffer(strdup("test"), 4, 1);
+  retain_buffer(buffer);
+  ck_assert_int_eq(atomic_load(&buffer->references), 2);
+  release_buffer(buffer);
+  ck_assert_int_eq(atomic_load(&buffer->references), 1);
+  release_buffer(buffer);
+}
+END_TEST
+
+START_TEST(uring_sink_test)
+{
+  char path[] = "/tmp/pgoutput2yml-check-uring-XXXXXX";
+  int fd = mkstemp(path);
+  ck_assert_int_eq(write(fd, "old\n", 4), 4);
+  close(fd);
+
+  char spec[64];
+  sprintf(spec, "uring:%s", path);
+  options_t options = parse_options(0, NULL);
+  sink_t* sink = create_sink(spec, &options);
+  ck_assert_ptr_nonnull(sink);
+
+  size_t large = 3*1024*1024 + 7;
+  char* data = malloc(large);
+  memset(data, 'x', large);
+  buffer_t* buffers[] = {
+    create_buffer(strdup("a"), 1, 1),
+    create_buffer(data, large, 2),
+    create_buffer(strdup(""), 0, 3),
+    create_buffer(strdup("b"), 1, 4),
+  };
+  for(int i=0; i<4; i++) {
+    sink_push(sink, buffers[i]);
+    release_buffer(buffers[i]);
+  }
+
+  close_sink(sink);
+  ck_assert_int_eq(atomic_load(&sink->failed), false);
+  ck_assert_int_eq(atomic_load(&sink->durable_lsn), 4);
+
+  FILE* file = fopen(path, "r");
+  char* content = malloc(large + 16);
+  size_t size = fread(content, 1, large + 16, file);
+  fclose(file);
+  ck_assert_int_eq(size, 4 + 4 + 1 + large + 1);
+  ck_assert(memcmp(content, "old\n---\na", 9) == 0);
+  ck_assert_int_eq(content[9], 'x');
+  ck_assert_int_eq(content[9 + large - 1], 'x');
+  ck_assert_int_eq(content[9 + large], 'b');
+
+  free(content);
+  delete_sink(sink);
+  unlink(path);
+}
+END_TEST
+
+START_TEST(segment_sink_test)
+{
+  char directory[] = "/tmp/pgoutput2yml-check-segments-XXXXXX";
+  ck_assert_ptr_nonnull(mkdtemp(directory));
+  char path[128];
+  sprintf(path, "%s/00000000000000000000.yaml", directory);
+  FILE* file = fopen(path, "w");
+  fwrite("---\nold\n\0\0\0\0", 1, 12, file);
+  fclose(file);
+
+  char spec[64];
+  sprintf(spec, "segment:%s", directory);
+  options_t options = parse_options(0, NULL);
+  options.segment_size = 64;
+  sink_t* sink = create_sink(spec, &options);
+  ck_assert_ptr_nonnull(sink);
+
+  char record[] = "relation_id: 1\nsize: 30\n---\n";
+  for(int i=1; i<=3; i++) {
+    buffer_t* buffer = create_buffer(strdup(record), strlen(record), i);
+    sink_push(sink, buffer);
+    release_buffer(buffer);
+  }
+
+  close_sink(sink);
+  ck_assert_int_eq(atomic_load(&sink->failed), false);
+  ck_assert_int_eq(atomic_load(&sink->durable_lsn), 3);
+  delete_sink(sink);
+
+  ck_assert_str_eq(read_test_file(path), "---\nold\n");
+  char expected[128];
+  sprintf(path, "%s/00000000000000000001.yaml", directory);
+  sprintf(expected, "---\n%s%s", record, record);
+  ck_assert_str_eq(read_test_file(path), expected);
+  unlink(path);
+  sprintf(path, "%s/00000000000000000002.yaml", directory);
+  sprintf(expected, "---\n%s", record);
+  ck_assert_str_eq(read_test_file(path), expected);
+  unlink(path);
+  sprintf(path, "%s/00000000000000000000.yaml", directory);
+  unlink(path);
+  rmdir(directory);
+}
+END_TEST
+
+START_TEST(shm_sink_test)
+{
+  char spec[64];
+  sprintf(spec, "shm:/pgoutput2yml-check-ring-%d", getpid());
+  options_t options = parse_options(0, NULL);
+  options.shm_size = 128;
+  sink_t* sink = create_sink(spec, &options);
+  ck_assert_ptr_nonnull(sink);
+
+  ring_t* ring = open_ring(spec + 4);
+  ck_assert_ptr_nonnull(ring);
+  int consumer = ring_register(ring);
+  ck_assert_int_ge(consumer, 0);
+
+  char record[] = "relation_id: 1\nsize: 30\n---\n";
+  for(int i=1; i<=3; i++) {
+    buffer_t* buffer = create_buffer(strdup(record), strlen(record), i);
+    sink_push(sink, buffer);
+    release_buffer(buffer);
+  }
+
+  char* data;
+  int64_t lsn;
+  ck_assert_int_eq(ring_read(ring, consumer, &data, &lsn, 1000), 4);
+  ck_assert_int_eq(strncmp(data, "---\n", 4), 0);
+  ring_consume(ring, consumer);
+  for(int i=1; i<=3; i++) {
+    ck_assert_int_eq(ring_read(ring, consumer, &data, &lsn, 1000), strlen(record));
+    ck_assert_int_eq(strncmp(data, record, strlen(record)), 0);
+    ck_assert_int_eq(lsn, i);
+    ring_consume(ring, consumer);
+  }
+
+  close_sink(sink);
+  ck_assert_int_eq(atomic_load(&sink->failed), false);
+  ck_assert_int_eq(atomic_load(&sink->durable_lsn), 3);
+  delete_sink(sink);
+
+  ck_assert_int_eq(ring_read(ring, consumer, &data, &lsn, 1000), 0);
+  ring_unregister(ring, consumer);
+  delete_ring(ring);
+}
+END_TEST
+
+START_TEST(shm_sink_close_test)
+{
+  char spec[64];
+  sprintf(spec, "shm:/pgoutput2yml-check-full-ring-%d", getpid());
+  options_t options = parse_options(0, NULL);
+  options.shm_size = 64;
+  sink_t* sink = create_sink(spec, &options);
+  ck_assert_ptr_nonnull(sink);
+
+  // nothing reads the full ring, closing must not wait for it
+  char record[] = "relation_id: 1\nsize: 30\n---\n";
+  buffer_t* buffer = create_buffer(strdup(record), strlen(record), 1);
+  sink_push(sink, buffer);
+  release_buffer(buffer);
+
+  close_sink(sink);
+  ck_assert_int_eq(atomic_load(&sink->failed), true);
+  ck_assert_int_eq(atomic_load(&sink->durable_lsn), 0);
+  delete_sink(sink);
+}
+END_TEST
+
+static void write_message(int fd, char type, char* body, size_t size) {
+  char header[5];
+  uint32_t length = htobe32(size + 4);
+  header[0] = type;
+  memcpy(header + 1, &length, sizeof(length));
+  ck_assert_int_eq(write(fd, header, sizeof(header)), sizeof(header));
+  for(size_t written = 0; written < size; ) {
+    ssize_t count = write(fd, body + written, size - written);
+    ck_assert_int_gt(count, 0);
+    written += count;
+  }
+}
+
+static void* run_replication_server(void* arg) {
+  int fd = *(int*)arg;
+  char query[64];
+  ck_assert_int_eq(read(fd, query, 5 + 6), 5 + 6);
+  ck_assert_int_eq(query[0], 'Q');
+  ck_assert_str_eq(query + 5, "START");
+
+  write_message(fd, 'N', "SNOTICE", 8);
+  write_message(fd, 'W', "\0\0\0", 3);
+  char frame[64];
+  for(int i=0; i<100000; i++) {
+    int size = sprintf(frame, "w%d", i);
+    write_message(fd, 'd', frame, size);
+  }
+  char* large = malloc(3*RECEIVE_BLOCK_SIZE);
+  memset(large, 'x', 3*RECEIVE_BLOCK_SIZE);
+  large[0] = 'w';
+  write_message(fd, 'd', large, 3*RECEIVE_BLOCK_SIZE);
+  free(large);
+  write_message(fd, 'd', "wlast", 5);
+  write_message(fd, 'c', NULL, 0);
+  return NULL;
+}
+
+START_TEST(receiver_test)
+{
+  int fds[2];
+  ck_assert_int_eq(socketpair(AF_UNIX, SOCK_STREAM, 0, fds), 0);
+  pthread_t server;
+  pthread_create(&server, NULL, run_replication_server, &fds[1]);
+
+  receiver_t* receiver = create_receiver(2*RECEIVE_BLOCK_SIZE);
+  ck_assert_int_eq(receiver_start(receiver, fds[0], "START"), 0);
+
+  char* held[1000];
+  char* data;
+  char expected[64];
+  for(int i=0; i<100000; i++) {
+    ssize_t size = receiver_next(receiver, &data, 1000);
+    int expected_size = sprintf(expected, "w%d", i);
+    ck_assert_int_eq(size, expected_size);
+    ck_assert_int_eq(memcmp(data, expected, size), 0);
+    held[i % 1000] = data;
+    if(i % 1000 == 999) {
+      for(int j=0; j<1000; j++) {
+        release_received(held[j]);
+      }
+    }
+  }
+  ck_assert_int_le(receiver->number_blocks, receiver->max_blocks);
+
+  ck_assert_int_eq(receiver_next(receiver, &data, 1000), 3*RECEIVE_BLOCK_SIZE);
+  ck_assert_int_eq(data[0], 'w');
+  ck_assert_int_eq(data[3*RECEIVE_BLOCK_SIZE - 1], 'x');
+  char* large = data;
+  ck_assert_int_eq(receiver_next(receiver, &data, 1000), 5);
+  ck_assert_int_eq(memcmp(data, "wlast", 5), 0);
+  release_received(large);
+  release_received(data);
+  ck_assert_int_eq(receiver_next(receiver, &data, 1000), -1);
+  pthread_join(server, NULL);
+
+  ck_assert_int_eq(receiver_send(receiver, "r", 1), 0);
+  char reply[6];
+  ck_assert_int_eq(read(fds[1], reply, sizeof(reply)), sizeof(reply));
+  ck_assert_int_eq(memcmp(reply, "d\0\0\0\5r", 6), 0);
+
+  delete_receiver(receiver);
+  close(fds[0]);
+  close(fds[1]);
+}
+END_TEST
+
+START_TEST(durable_sink_test)
+{
+  char path[] = "/tmp/pgoutput2yml-check-durable-XXXXXX";
+  close(mkstemp(path));
+  char spec[64];
+  sprintf(spec, "file:%s", path);
+
+  options_t options = parse_options(0, NULL);
+  options.durable = true;
+  options.sync_interval = 1000;
+  sink_t* sink = create_sink(spec, &options);
+  ck_assert_int_eq(sink->sync, true);
+
+  buffer_t* buffer = create_buffer(strdup("a\n"), 2, 5);
+  sink_push(sink, buffer);
+  release_buffer(buffer);
+  for(int i=0; i<100 && atomic_load(&sink->durable_lsn) != 5; i++) {
+    usleep(10000);
+  }
+  ck_assert_int_eq(atomic_load(&sink->durable_lsn), 5);
+
+  for(int lsn=6; lsn<=7; lsn++) {
+    buffer = create_buffer(strdup("b\n"), 2, lsn);
+    sink_push(sink, buffer);
+    release_buffer(buffer);
+  }
+  ck_assert_int_eq(atomic_load(&sink->durable_lsn), 5);
+  ck_assert_int_eq(sink_idle(sink), false);
+
+  close_sink(sink);
+  ck_assert_int_eq(atomic_load(&sink->durable_lsn), 7);
+  ck_assert_str_eq(read_test_file(path), "---\na\nb\nb\n");
+  delete_sink(sink);
+  unlink(path);
+}
+END_TEST
+
+int connect_test_socket(char* path) {
+  struct sockaddr_un address = { .sun_family = AF_UNIX };
+  strcpy(address.sun_path, path);
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  ck_assert_int_eq(connect(fd, (struct sockaddr*)&address, sizeof(address)), 0);
+  return fd;
+}
+
+void read_test_socket(int fd, char* content, size_t size) {
+  size_t total = 0;
+  while(total < size) {
+    ssize_t received = read(fd, content + total, size - total);
+    ck_assert_int_gt(received, 0);
+    total += received;
+  }
+  content[total] = '\0';
+}
+
+START_TEST(server_history_test)
+{
+  char path[] = "/tmp/pgoutput2yml-check-server.sock";
+  char address[64];
+  char content[64];
+  sprintf(address, "unix:%s", path);
+
+  server_t* server = create_server(address, 8);
+  ck_assert_ptr_nonnull(server);
+
+  buffer_t* one = create_buffer(strdup("one\n"), 4, 1);
+  buffer_t* two = create_buffer(strdup("two\n"), 4, 2);
+  buffer_t* three = create_buffer(strdup("three\n"), 6, 3);
+  server_publish(server, one);
+  server_publish(server, two);
+  server_publish(server, three);
+  release_buffer(one);
+  release_buffer(two);
+  release_buffer(three);
+
+  // the oldest buffer does not fit the history anymore
+  int first = connect_test_socket(path);
+  read_test_socket(first, content, 4 + 6);
+  ck_assert_str_eq(content, "---\nthree\n");
+
+  int second = connect_test_socket(path);
+  read_test_socket(second, content, 4 + 6);
+  ck_assert_str_eq(content, "---\nthree\n");
+
+  buffer_t* four = create_buffer(strdup("four\n"), 5, 4);
+  server_publish(server, four);
+  release_buffer(four);
+
+  read_test_socket(first, content, 5);
+  ck_assert_str_eq(content, "four\n");
+  read_test_socket(second, content, 5);
+  ck_assert_str_eq(content, "four\n");
+
+  close(first);
+  close(second);
+  close_server(server);
+  delete_server(server);
+  unlink(path);
+}
+END_TEST
+
+insert_t* create_test_insert(char* id, char* body) {
+  insert_t* insert = malloc(sizeof(insert_t));
+  insert->relation_id = 1;
+  insert->data = create_test_tuples(id, body);
+  return insert;
+}
+
+update_t* create_test_update(char* id, char* body) {
+  update_t* update = malloc(sizeof(update_t));
+  update->relation_id = 1;
+  update->identity = 'N';
+  update->from = NULL;
+  update->to = create_test_tuples(id, body);
+  return update;
+}
+
+delete_t* create_test_delete(char* id) {
+  delete_t* del = malloc(sizeof(delete_t));
+  del->relation_id = 1;
+  del->data = create_test_tuples(id, "NULL");
+  return del;
+}
+
+START_TEST(print_changed_update_test)
+{
+  char content[1024];
+  relation_t* relation = create_test_relation(1);
+  update_t* update = create_test_update("1", "b");
+  update->identity = 'O';
+  update->from = create_test_tuples("1", "a");
+
+  FILE* file = fmemopen(content, sizeof(content), "w");
+  print_changed_update(update, relation, file);
+  free(update->to->values[1]);
+  update->to->values[1] = strdup("a");
+  print_changed_update(update, relation, file);
+  update->identity = 'K';
+  print_changed_update(update, relation, file);
+  fclose(file);
+
+  ck_assert_str_eq(content,
+    "relation_id: 1\noperation: update\ncolumns:\n  - 0\n  - 1\nfrom:\n  - 1\n  - a\nto:\n  - 1\n  - b\n---\n"
+    "relation_id: 1\noperation: update\ncolumns:\n  - 0\nfrom:\n  - 1\nto:\n  - 1\n---\n"
+    "relation_id: 1\noperation: update\nfrom:\n  - 1\n  - a\nto:\n  - 1\n  - a\n---\n");
+
+  delete_update(update);
+  delete_relation(relation);
+}
+END_TEST
+
+START_TEST(print_changed_update_full_test)
+{
+  char content[1024];
+  relation_t* relation = create_test_relation(1);
+  relation->replicate_identity_settings = 'f';
+  relation->column_flags[1] = COLUMN_FLAG_KEY;
+  update_t* update = create_test_update("1", "b");
+  update->identity = 'O';
+  update->from = create_test_tuples("1", "a");
+
+  FILE* file = fmemopen(content, sizeof(content), "w");
+  print_changed_update(update, relation, file);
+  fclose(file);
+
+  ck_assert_str_eq(content,
+    "relation_id: 1\noperation: update\ncolumns:\n  - 1\nfrom:\n  - a\nto:\n  - b\n---\n");
+
+  delete_update(update);
+  delete_relation(relation);
+}
+END_TEST
+
+START_TEST(columnar_test)
+{
+  char dir[] = "/tmp/pgoutput2yml-check-arrow-XXXXXX";
+  ck_assert_ptr_nonnull(mkdtemp(dir));
+  ck_assert_int_eq(arrow_type(23), ARROW_INT32);
+  ck_assert_int_eq(arrow_type(701), ARROW_FLOAT64);
+  ck_assert_int_eq(arrow_type(3802), ARROW_UTF8);
+
+  relation_t* relation = create_test_relation(1);
+  columnar_t* columnar = create_columnar(dir, 2, 0);
+  ck_assert_int_eq(columnar_relation(columnar, relation, 0x20), OK);
+  tuples_t* tuples = create_test_tuples("1", "one");
+  for(int i=0; i<3; i++) {
+    columnar_append(columnar, relation, 'I', 0x30, tuples);
+  }
+  ck_assert_int_eq(columnar->head->rows, 1);
+  ck_assert_int_eq(columnar_buffered_lsn(columnar), 0x30);
+  ck_assert_int_eq(columnar->head->columns[2].type, ARROW_INT32);
+  ck_assert_int_eq(*(int32_t*)columnar->head->columns[2].values, 1);
+  columnar_commit(columnar);
+  ck_assert_int_eq(columnar->head->rows, 0);
+  ck_assert_int_eq(columnar_buffered_lsn(columnar), 0);
+  delete_columnar(columnar);
+
+  char path[128];
+  sprintf(path, "%s/public.documents.0000000000000020.arrows", dir);
+  FILE* file = fopen(path, "r");
+  ck_assert_ptr_nonnull(file);
+  int messages = 0;
+  uint32_t prefix[2];
+  while(fread(prefix, sizeof(prefix), 1, file) == 1 && prefix[1] > 0) {
+    ck_assert_uint_eq(prefix[0], 0xFFFFFFFF);
+    ck_assert_uint_eq(prefix[1] % 8, 0);
+    char* metadata = malloc(prefix[1]);
+    ck_assert_int_eq(fread(metadata, prefix[1], 1, file), 1);
+    int64_t body_size;
+    memcpy(&body_size, metadata + *(uint32_t*)metadata + 16, sizeof(body_size));
+    fseek(file, body_size, SEEK_CUR);
+    free(metadata);
+    messages++;
+  }
+  ck_assert_uint_eq(prefix[0], 0xFFFFFFFF);
+  ck_assert_uint_eq(prefix[1], 0);
+  ck_assert_int_eq(messages, 3);
+  fclose(file);
+
+  unlink(path);
+  rmdir(dir);
+  delete_tuples(tuples);
+  delete_relation(relation);
+}
+END_TEST
+
+char* flush_test_compactor(compactor_t* compactor) {
+  static char content[4096];
+  FILE* file = fmemopen(content, sizeof(content), "w");
+  compact_flush(compactor, file);
+  fclose(file);
+  return content;
+}
+
+START_TEST(compact_merge_test)
+{
+  relation_t* relation = create_test_relation(1);
+  compactor_t* compactor = create_compactor(1000, 0);
+
+  compact_insert(compactor, relation, create_test_insert("1", "a"));
+  compact_update(compactor, relation, create_test_update("1", "b"));
+  compact_update(compactor, relation, create_test_update("2", "c"));
+  compact_update(compactor, relation, create_test_update("2", "d"));
+  compact_insert(compactor, relation, create_test_insert("3", "e"));
+  compact_delete(compactor, relation, create_test_delete("3"));
+  compact_delete(compactor, relation, create_test_delete("4"));
+  compact_insert(compactor, relation, create_test_insert("4", "f"));
+  ck_assert_int_eq(compactor->size, 3);
+
+  char* expected =
+    "relation_id: 1\noperation: insert\ndata:\n  - 1\n  - b\n---\n"
+    "relation_id: 1\noperation: update\nto:\n  - 2\n  - d\n---\n"
+    "relation_id: 1\noperation: update\nfrom:\n  - 4\n  - NULL\nto:\n  - 4\n  - f\n---\n";
+  ck_assert_str_eq(flush_test_compactor(compactor), expected);
+  ck_assert_int_eq(compact_empty(compactor), true);
+
+  delete_compactor(compactor);
+  delete_relation(relation);
+}
+END_TEST
+
+START_TEST(compact_unchanged_test)
+{
+  relation_t* relation = create_test_relation(1);
+  compactor_t* compactor = create_compactor(1000, 0);
+
+  compact_insert(compactor, relation, create_test_insert("1", "large"));
+  compact_update(compactor, relation, create_test_update("1", (char*)UNCHANGED_STR));
+  compact_update(compactor, relation, create_test_update("2", "other"));
+  compact_update(compactor, relation, create_test_update("2", (char*)UNCHANGED_STR));
+
+  char* expected =
+    "relation_id: 1\noperation: insert\ndata:\n  - 1\n  - large\n---\n"
+    "relation_id: 1\noperation: update\nto:\n  - 2\n  - other\n---\n";
+  ck_assert_str_eq(flush_test_compactor(compactor), expected);
+
+  delete_compactor(compactor);
+  delete_relation(relation);
+}
+END_TEST
+
+START_TEST(compact_order_test)
+{
+  relation_t* relation = create_test_relation(1);
+  compactor_t* compactor = create_compactor(1000, 0);
+
+  compact_update(compactor, relation, create_test_update("1", "a"));
+  compact_update(compactor, NULL, create_test_update("9", "keyless"));
+  compact_update(compactor, relation, create_test_update("2", "b"));
+  compact_update(compactor, relation, create_test_update("1", "c"));
+
+  char* expected =
+    "relation_id: 1\noperation: update\nto:\n  - 9\n  - keyless\n---\n"
+    "relation_id: 1\noperation: update\nto:\n  - 2\n  - b\n---\n"
+    "relation_id: 1\noperation: update\nto:\n  - 1\n  - c\n---\n";
+  ck_assert_str_eq(flush_test_compactor(compactor), expected);
+
+  delete_compactor(compactor);
+  delete_relation(relation);
+}
+END_TEST
+
+START_TEST(compact_window_test)
+{
+  relation_t* relation = create_test_relation(1);
+  compactor_t* compactor = create_compactor(0, 100);
+
+  ck_assert_int_eq(compact_window_closed(compactor, 10), true);
+  compact_insert(compactor, relation, create_test_insert("1", "a"));
+  ck_assert_int_eq(compact_remaining_ms(compactor), -1);
+  ck_assert_int_eq(compact_window_closed(compactor, 10), false);
+  ck_assert_int_eq(compact_window_closed(compactor, 109), false);
+  ck_assert_int_eq(compact_window_closed(compactor, 110), true);
+
+  delete_compactor(compactor);
+  delete_relation(relation);
+}
+END_TEST
+
+START_TEST(parse_copy_row_test)
+{
+  char line[] = "1\t\\N\tline\\nbreak\\t\\\\x\t\\x41\\101\t\n";
+  tuples_t* tuples = parse_copy_row(line, strlen(line));
+
+  ck_assert_int_eq(tuples->size, 5);
+  ck_assert_str_eq(tuples->values[0], "1");
+  ck_assert_ptr_eq(tuples->values[1], NULL_STR);
+  ck_assert_str_eq(tuples->values[2], "line\nbreak\t\\x");
+  ck_assert_str_eq(tuples->values[3], "AA");
+  ck_assert_str_eq(tuples->values[4], "");
+  delete_tuples(tuples);
+}
+END_TEST
 
 Suite* create_suite(void) {
   Suite *s;
@@ -500,6 +2324,8 @@ Suite* create_suite(void) {
   tcase_add_test(tc_core, read_int32_test);
   tcase_add_test(tc_core, read_int64_test);
   tcase_add_test(tc_core, read_string_test);
+  tcase_add_test(tc_core, stream_remaining_test);
+  tcase_add_test(tc_core, check_string_unterminated_test);
 
   tcase_add_test(tc_core, test_parse_options);
   tcase_add_test(tc_core, test_parse_options_file);
@@ -512,6 +2338,14 @@ Suite* create_suite(void) {
   tcase_add_test(tc_core, test_parse_options_publication);
   tcase_add_test(tc_core, test_parse_options_install);
   tcase_add_test(tc_core, test_parse_options_uninstall);
+  tcase_add_test(tc_core, test_parse_options_toast_cache);
+  tcase_add_test(tc_core, test_parse_options_queue);
+  tcase_add_test(tc_core, test_parse_options_reconnect);
+  tcase_add_test(tc_core, test_parse_options_sinks);
+  tcase_add_test(tc_core, test_parse_options_compact);
+  tcase_add_test(tc_core, test_parse_options_snapshot);
+  tcase_add_test(tc_core, test_parse_options_latency);
+  tcase_add_test(tc_core, test_parse_options_lag);
 
   tcase_add_test(tc_core, test_parse_commit_success);
   tcase_add_test(tc_core, test_parse_commit_failed);
@@ -519,13 +2353,60 @@ Suite* create_suite(void) {
 
   tcase_add_test(tc_core, parse_tuples_single_NULL_test);
   tcase_add_test(tc_core, parse_tuples_single_text_test);
+  tcase_add_test(tc_core, parse_tuples_unchanged_test);
   tcase_add_test(tc_core, parse_update_success_test);
   tcase_add_test(tc_core, parse_update_success_key_test);
   tcase_add_test(tc_core, parse_update_failed_key_test);
   tcase_add_test(tc_core, parse_update_without_n_test);
 
+  tcase_add_test(tc_core, parse_update_new_only_test);
+  tcase_add_test(tc_core, print_changed_update_test);
+  tcase_add_test(tc_core, print_changed_update_full_test);
+  tcase_add_test(tc_core, columnar_test);
+
   tcase_add_test(tc_core, parse_delete_test);
 
+  tcase_add_test(tc_core, validate_insert_test);
+  tcase_add_test(tc_core, validate_truncated_insert_test);
+  tcase_add_test(tc_core, validate_truncated_relation_test);
+
+  tcase_add_test(tc_core, relations_put_get_test);
+  tcase_add_test(tc_core, toast_cache_fill_test);
+  tcase_add_test(tc_core, mirror_test);
+  tcase_add_test(tc_core, stats_test);
+  tcase_add_test(tc_core, multiplexer_test);
+  tcase_add_test(tc_core, toast_cache_eviction_test);
+
+  tcase_add_test(tc_core, queue_order_test);
+  tcase_add_test(tc_core, queue_spill_test);
+  tcase_add_test(tc_core, queue_spill_failure_test);
+  tcase_add_test(tc_core, handler_fan_out_test);
+  tcase_add_test(tc_core, handler_feedback_lsn_test);
+  tcase_add_test(tc_core, handler_batching_test);
+  tcase_add_test(tc_core, handler_partitions_test);
+  tcase_add_test(tc_core, crc32c_test);
+  tcase_add_test(tc_core, handler_checksum_test);
+  tcase_add_test(tc_core, handler_streaming_test);
+  tcase_add_test(tc_core, handler_streaming_toast_cache_test);
+  tcase_add_test(tc_core, histogram_percentile_test);
+  tcase_add_test(tc_core, counters_test);
+  tcase_add_test(tc_core, handler_latency_test);
+  tcase_add_test(tc_core, buffer_references_test);
+  tcase_add_test(tc_core, server_history_test);
+  tcase_add_test(tc_core, uring_sink_test);
+  tcase_add_test(tc_core, segment_sink_test);
+  tcase_add_test(tc_core, shm_sink_test);
+  tcase_add_test(tc_core, shm_sink_close_test);
+  tcase_add_test(tc_core, receiver_test);
+  tcase_add_test(tc_core, durable_sink_test);
+
+  tcase_add_test(tc_core, compact_merge_test);
+  tcase_add_test(tc_core, compact_unchanged_test);
+  tcase_add_test(tc_core, compact_order_test);
+  tcase_add_test(tc_core, compact_window_test);
+
+  tcase_add_test(tc_core, parse_copy_row_test);
+
   suite_add_tcase(s, tc_core);
   return s;
 }